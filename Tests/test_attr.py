@@ -16,6 +16,7 @@ class GetAttrTestCase(unittest.TestCase):
 
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
         pyjion.disable_pgc()
 
     def tearDown(self) -> None:
@@ -40,6 +41,7 @@ class SetAttrTestCase(unittest.TestCase):
 
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
         pyjion.disable_pgc()
 
     def tearDown(self) -> None:
@@ -0,0 +1,54 @@
+import pyjion
+import unittest
+import gc
+import time
+
+
+class BackgroundCompileTestCase(unittest.TestCase):
+
+    def setUp(self) -> None:
+        pyjion.enable()
+        pyjion.config(threshold=0)
+        pyjion.config(background=True)
+
+    def tearDown(self) -> None:
+        pyjion.config(background=False)
+        pyjion.disable()
+        gc.collect()
+
+    def wait_for_compile(self, f, timeout=10.0):
+        deadline = time.monotonic() + timeout
+        while not pyjion.info(f)['compiled'] and time.monotonic() < deadline:
+            f()
+            time.sleep(0.01)
+
+    def test_config(self):
+        self.assertTrue(pyjion.config()['background'])
+        self.assertTrue(pyjion.status()['background'])
+
+    def test_compiles_in_background(self):
+        def test_f():
+            a = 1
+            b = 2
+            return a + b
+
+        self.assertEqual(test_f(), 3)
+        self.wait_for_compile(test_f)
+        info = pyjion.info(test_f)
+        self.assertTrue(info['compiled'])
+        self.assertFalse(info['failed'])
+        self.assertEqual(test_f(), 3)
+        queue = pyjion.status()['compile_queue']
+        self.assertGreaterEqual(queue['queued'], 1)
+        self.assertGreaterEqual(queue['completed'], 1)
+
+    def test_stop_queue(self):
+        pyjion.config(background=False)
+        self.assertFalse(pyjion.config()['background'])
+        self.assertEqual(pyjion.status()['compile_queue']['depth'], 0)
+
+        def test_f():
+            return 1 + 2
+
+        self.assertEqual(test_f(), 3)
+        self.assertTrue(pyjion.info(test_f)['compiled'])
@@ -0,0 +1,116 @@
+import pyjion
+import unittest
+import gc
+import sys
+import threading
+
+
+class ConcurrentCompileStressTestCase(unittest.TestCase):
+    """Many threads reaching the threshold of the same functions at once, each function must be compiled once."""
+
+    def setUp(self) -> None:
+        self.switch_interval = sys.getswitchinterval()
+        # Switch threads as often as possible so they race into the compiler together
+        sys.setswitchinterval(1e-6)
+        pyjion.disable_pgc()
+        pyjion.enable()
+        pyjion.config(threshold=0)
+
+    def tearDown(self) -> None:
+        pyjion.disable()
+        pyjion.enable_pgc()
+        sys.setswitchinterval(self.switch_interval)
+        gc.collect()
+
+    def make_functions(self, count):
+        functions = []
+        for i in range(count):
+            namespace = {}
+            exec(f"def stress_{i}(n):\n"
+                 f"    total = {i}\n"
+                 f"    for x in range(n):\n"
+                 f"        total += x * 2\n"
+                 f"    return total\n", namespace)
+            functions.append(namespace[f"stress_{i}"])
+        return functions
+
+    def run_threads(self, functions, thread_count=16, calls=50):
+        barrier = threading.Barrier(thread_count)
+        errors = []
+
+        def worker():
+            try:
+                barrier.wait()
+                for _ in range(calls):
+                    for i, f in enumerate(functions):
+                        if f(20) != i + 380:
+                            errors.append(f"{f.__name__} returned {f(20)}")
+            except Exception as e:
+                errors.append(repr(e))
+
+        threads = [threading.Thread(target=worker) for _ in range(thread_count)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        self.assertEqual(errors, [])
+
+    def test_compiled_once(self):
+        functions = self.make_functions(20)
+        self.run_threads(functions)
+        for f in functions:
+            info = pyjion.info(f)
+            self.assertTrue(info["compiled"], f.__name__)
+            self.assertFalse(info["compiling"], f.__name__)
+            self.assertEqual(info["compile_count"], 1, f.__name__)
+
+    def test_parallel_compiles(self):
+        # Each thread has its own functions, so the JIT runs for several of them at once without the GIL
+        thread_count = 8
+        functions = [self.make_functions(10) for _ in range(thread_count)]
+        errors = []
+
+        def worker(owned):
+            try:
+                for _ in range(pyjion.config()["threshold"] + 5):
+                    for i, f in enumerate(owned):
+                        if f(20) != i + 380:
+                            errors.append(f"{f.__name__} returned {f(20)}")
+            except Exception as e:
+                errors.append(repr(e))
+
+        threads = [threading.Thread(target=worker, args=(owned,)) for owned in functions]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        self.assertEqual(errors, [])
+        for owned in functions:
+            for f in owned:
+                self.assertTrue(pyjion.info(f)["compiled"], f.__name__)
+                self.assertEqual(pyjion.info(f)["compile_count"], 1, f.__name__)
+
+    def test_reentrant_compile(self):
+        # A finalizer run by a collection during the compile calls the function being compiled
+        functions = self.make_functions(1)
+        f = functions[0]
+        results = []
+
+        class CallsOnCollect:
+            def __del__(self):
+                results.append(f(20))
+
+        def make_garbage(_):
+            cycle = CallsOnCollect()
+            cycle.self = cycle
+
+        for _ in range(pyjion.config()["threshold"] + 5):
+            make_garbage(None)
+            self.assertEqual(f(20), 380)
+        gc.collect()
+        self.assertTrue(all(result == 380 for result in results))
+        self.assertEqual(pyjion.info(f)["compile_count"], 1)
+
+
+if __name__ == "__main__":
+    unittest.main()
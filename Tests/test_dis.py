@@ -11,6 +11,7 @@ class DisassemblerModuleTestCase(unittest.TestCase):
 
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
         pyjion.enable_debug()
 
     def tearDown(self) -> None:
@@ -12,6 +12,7 @@ class FloatArithmeticTestCase(unittest.TestCase):
 
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
 
     def tearDown(self) -> None:
         pyjion.disable()
@@ -67,6 +68,7 @@ class FloatFormattingTestCase(unittest.TestCase):
 
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
         pyjion.disable_pgc()
 
     def tearDown(self) -> None:
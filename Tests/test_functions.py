@@ -11,6 +11,7 @@ class ScopeLeaksTestCase(unittest.TestCase):
 
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
         pyjion.disable_pgc()
 
     def tearDown(self) -> None:
@@ -40,6 +41,7 @@ class FunctionCallsTestCase(unittest.TestCase):
 
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
         pyjion.disable_pgc()
 
     def tearDown(self) -> None:
@@ -327,6 +329,7 @@ class ClassMethodCallsTestCase(unittest.TestCase):
 
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
         pyjion.disable_pgc()
 
     def tearDown(self) -> None:
@@ -615,6 +618,7 @@ class FunctionKwCallsTestCase(unittest.TestCase):
 
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
         pyjion.disable_pgc()
 
     def tearDown(self) -> None:
@@ -810,6 +814,7 @@ class ObjectMethodCallsTestCase(unittest.TestCase):
 
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
         pyjion.disable_pgc()
 
     def tearDown(self) -> None:
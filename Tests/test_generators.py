@@ -8,6 +8,7 @@ class GeneratorsTestCase(unittest.TestCase):
 
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
         pyjion.disable_pgc()
 
     def tearDown(self) -> None:
@@ -10,6 +10,7 @@ class GlobalOptimizationTestCase(unittest.TestCase):
 
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
 
     def tearDown(self) -> None:
         pyjion.disable()
@@ -6,6 +6,7 @@ class RecursionTestCase(unittest.TestCase):
 
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
 
     def tearDown(self) -> None:
         pyjion.disable()
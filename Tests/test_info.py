@@ -1,12 +1,14 @@
 import pyjion
 import unittest
 import gc
+import weakref
 
 
 class JitInfoModuleTestCase(unittest.TestCase):
 
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
         print(pyjion.status())
 
     def tearDown(self) -> None:
@@ -28,6 +30,18 @@ class JitInfoModuleTestCase(unittest.TestCase):
         self.assertFalse(info['failed'])
         self.assertEqual(info['run_count'], 1)
 
+    def test_code_heap(self):
+        def test_f():
+            return 1 + 2
+
+        self.assertEqual(test_f(), 3)
+        heap = pyjion.status()['code_heap']
+        self.assertGreaterEqual(heap['regions'], 1)
+        self.assertGreaterEqual(heap['allocations'], 1)
+        self.assertLessEqual(heap['used'] + heap['free'], heap['reserved'])
+        self.assertGreaterEqual(heap['fragmentation'], 0.0)
+        self.assertLess(heap['fragmentation'], 1.0)
+
     def test_never(self):
         def test_f():
             a = 1
@@ -58,5 +72,283 @@ class JitInfoModuleTestCase(unittest.TestCase):
         self.assertEqual(info['run_count'], 2)
 
 
+class HotnessTestCase(unittest.TestCase):
+
+    def setUp(self) -> None:
+        pyjion.enable()
+        pyjion.config(threshold=0)
+        pyjion.enable_pgc()
+        self.previous = pyjion.config()['optimize_threshold']
+
+    def tearDown(self) -> None:
+        pyjion.config(optimize_threshold=self.previous)
+        pyjion.disable()
+        gc.collect()
+
+    def test_backedges_counted(self):
+        def test_f():
+            total = 0
+            for i in range(10):
+                total += i
+            return total
+
+        self.assertEqual(test_f(), 45)
+        info = pyjion.info(test_f)
+        self.assertEqual(info['pgc'], 1)
+        self.assertGreaterEqual(info['backedge_count'], 10)
+        self.assertEqual(info['hotness'], info['run_count'] + info['backedge_count'])
+
+    def test_threshold(self):
+        pyjion.config(threshold=3)
+
+        def test_f():
+            a = 1
+            b = 2
+            return a + b
+
+        for _ in range(3):
+            self.assertEqual(test_f(), 3)
+        self.assertFalse(pyjion.info(test_f)['compiled'])
+        self.assertEqual(test_f(), 3)
+        self.assertTrue(pyjion.info(test_f)['compiled'])
+
+    def test_threshold_changed_after_first_call(self):
+        pyjion.config(threshold=10)
+
+        def test_f():
+            a = 1
+            b = 2
+            return a + b
+
+        self.assertEqual(test_f(), 3)
+        self.assertFalse(pyjion.info(test_f)['compiled'])
+        pyjion.config(threshold=0)
+        self.assertEqual(test_f(), 3)
+        self.assertTrue(pyjion.info(test_f)['compiled'])
+
+    def test_optimize_threshold(self):
+        pyjion.config(optimize_threshold=5)
+
+        def test_f():
+            a = 1
+            b = 2
+            return a + b
+
+        for _ in range(4):
+            self.assertEqual(test_f(), 3)
+        self.assertEqual(pyjion.info(test_f)['pgc'], 1)
+        test_f()
+        test_f()
+        self.assertEqual(pyjion.info(test_f)['pgc'], 2)
+
+    def test_optimize_threshold_below_threshold(self):
+        pyjion.config(threshold=10, optimize_threshold=3)
+
+        def test_f():
+            a = 1
+            b = 2
+            return a + b
+
+        # The 11th call compiles the profiling tier, it is optimized after 3 profiled calls
+        for _ in range(11):
+            self.assertEqual(test_f(), 3)
+        self.assertEqual(pyjion.info(test_f)['pgc'], 1)
+        for _ in range(2):
+            self.assertEqual(test_f(), 3)
+        self.assertEqual(pyjion.info(test_f)['pgc'], 1)
+        self.assertEqual(test_f(), 3)
+        self.assertEqual(pyjion.info(test_f)['pgc'], 2)
+
+
+class CodeLifetimeTestCase(unittest.TestCase):
+
+    def setUp(self) -> None:
+        pyjion.enable()
+        pyjion.config(threshold=0)
+
+    def tearDown(self) -> None:
+        pyjion.config(code_budget=0)
+        pyjion.disable()
+        gc.collect()
+
+    def test_code_freed(self):
+        scope = {}
+        exec("def test_f():\n    return 1 + 2\n", scope)
+        test_f = scope.pop('test_f')
+        self.assertEqual(test_f(), 3)
+        self.assertTrue(pyjion.info(test_f)['compiled'])
+
+        code = weakref.ref(test_f.__code__)
+        del test_f
+        gc.collect()
+        self.assertIsNone(code())
+
+    def test_code_budget(self):
+        pyjion.config(code_budget=1)
+
+        def test_f():
+            return 1 + 2
+
+        def test_g():
+            return 3 + 4
+
+        self.assertEqual(test_f(), 3)
+        self.assertTrue(pyjion.info(test_f)['compiled'])
+        self.assertEqual(test_g(), 7)
+        self.assertTrue(pyjion.info(test_g)['compiled'])
+        info = pyjion.info(test_f)
+        self.assertFalse(info['compiled'])
+        self.assertEqual(info['evictions'], 1)
+        self.assertEqual(test_f(), 3)
+
+    def test_evicted_code_keeps_profile(self):
+        pyjion.enable_pgc()
+        pyjion.config(code_budget=1)
+
+        def test_f():
+            return 1 + 2
+
+        def test_g():
+            return 3 + 4
+
+        self.assertEqual(test_f(), 3)
+        self.assertEqual(test_f(), 3)
+        self.assertEqual(pyjion.info(test_f)['pgc'], 2)
+        self.assertEqual(test_g(), 7)
+        info = pyjion.info(test_f)
+        self.assertEqual(info['evictions'], 1)
+        self.assertEqual(info['pgc'], 1)
+        self.assertEqual(test_f(), 3)
+        self.assertEqual(pyjion.info(test_f)['pgc'], 2)
+
+    def test_suspended_generator_kept(self):
+        pyjion.config(code_budget=1)
+
+        def test_gen():
+            yield 1
+            yield 2
+
+        def test_g():
+            return 3 + 4
+
+        gen = test_gen()
+        self.assertEqual(next(gen), 1)
+        self.assertTrue(pyjion.info(test_gen)['compiled'])
+        self.assertEqual(test_g(), 7)
+        info = pyjion.info(test_gen)
+        self.assertTrue(info['compiled'])
+        self.assertEqual(info['evictions'], 0)
+        self.assertEqual(next(gen), 2)
+
+
+class CompileCostTestCase(unittest.TestCase):
+
+    def setUp(self) -> None:
+        pyjion.enable()
+        pyjion.config(threshold=0)
+
+    def tearDown(self) -> None:
+        pyjion.config(compile_time_budget=0)
+        pyjion.disable()
+        gc.collect()
+
+    def test_compile_time_recorded(self):
+        def test_f():
+            return 1 + 2
+
+        self.assertEqual(test_f(), 3)
+        info = pyjion.info(test_f)
+        self.assertGreaterEqual(info['compile_count'], 1)
+        self.assertGreater(info['il_size'], 0)
+        self.assertGreater(info['native_size'], 0)
+        compile_time = info['compile_time']
+        self.assertGreater(compile_time['compile_method'], 0)
+        self.assertEqual(compile_time['total'],
+                         compile_time['interpret'] + compile_time['compile_worker'] + compile_time['compile_method'])
+        self.assertFalse(info['blacklisted'])
+
+    def test_over_budget_blacklisted(self):
+        pyjion.config(compile_time_budget=1)
+
+        def test_f(a):
+            return a + 2
+
+        self.assertEqual(test_f(1), 3)
+        info = pyjion.info(test_f)
+        self.assertTrue(info['blacklisted'])
+        self.assertEqual(test_f(2.0), 4.0)
+        self.assertEqual(pyjion.info(test_f)['compile_count'], info['compile_count'])
+
+    def test_over_budget_probe_code_dropped(self):
+        pyjion.enable_pgc()
+        pyjion.config(compile_time_budget=1)
+
+        def test_f(a):
+            return a + 2
+
+        self.assertEqual(test_f(1), 3)
+        info = pyjion.info(test_f)
+        self.assertTrue(info['blacklisted'])
+        self.assertFalse(info['compiled'])
+        self.assertTrue(info['failed'])
+        self.assertEqual(info['pgc'], 0)
+        self.assertEqual(test_f(2), 4)
+
+
+class StatsTestCase(unittest.TestCase):
+
+    def setUp(self) -> None:
+        pyjion.enable()
+        pyjion.config(threshold=0)
+        pyjion.reset_stats()
+
+    def tearDown(self) -> None:
+        pyjion.disable()
+        gc.collect()
+
+    def test_compile_counted(self):
+        def test_f():
+            return 1 + 2
+
+        self.assertEqual(test_f(), 3)
+        stats = pyjion.stats()
+        compilations = stats['compilations']
+        self.assertGreaterEqual(compilations['succeeded'], 1)
+        self.assertEqual(compilations['attempted'], compilations['succeeded'] + compilations['failed'])
+        self.assertEqual(compilations['results']['Success'], compilations['succeeded'])
+        self.assertGreater(stats['compile_time']['total']['total_ns'], 0)
+        self.assertGreater(stats['compile_time']['compile_method']['p99_ns'], 0)
+        self.assertGreater(stats['native_bytes'], 0)
+        self.assertGreater(stats['il_bytes'], 0)
+
+    def test_reset(self):
+        def test_f():
+            return 1 + 2
+
+        self.assertEqual(test_f(), 3)
+        pyjion.reset_stats()
+        stats = pyjion.stats()
+        self.assertEqual(stats['compilations']['attempted'], 0)
+        self.assertEqual(stats['compile_time']['total']['total_ns'], 0)
+        self.assertEqual(stats['guard_failures'], 0)
+        self.assertEqual(stats['osr_declines'], 0)
+
+    def test_guard_failure_counted(self):
+        pyjion.enable_pgc()
+
+        def test_f(x):
+            a = x[0]
+            b = x[1]
+            return a + b
+
+        self.assertEqual(test_f([1.0, 2.0]), 3.0)
+        self.assertEqual(test_f([1.0, 2.0]), 3.0)
+        failures = pyjion.stats()['guard_failures']
+        self.assertEqual(test_f([1, 2]), 3)
+        stats = pyjion.stats()
+        self.assertEqual(stats['guard_failures'], failures + 1)
+        self.assertEqual(stats['osr_declines'], 0)
+
+
 if __name__ == "__main__":
     unittest.main()
@@ -1,4 +1,5 @@
 import pyjion
+import sys
 import unittest
 import gc
 
@@ -7,6 +8,7 @@ class IteratorTestCase(unittest.TestCase):
 
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
 
     def tearDown(self) -> None:
         pyjion.disable()
@@ -23,3 +25,107 @@ class IteratorTestCase(unittest.TestCase):
         for n in l:
             for x in dict(), dict():
                 pass
+
+    def test_range_sum(self):
+        def f(n):
+            total = 0
+            for i in range(n):
+                total += i
+            return total
+        self.assertEqual(f(100), 4950)
+        self.assertEqual(f(0), 0)
+        self.assertTrue(pyjion.info(f)['compiled'])
+
+    def test_range_step(self):
+        def f():
+            total = 0
+            for i in range(10, -10, -3):
+                total += i
+            return total, i
+        self.assertEqual(f(), (7, -8))
+
+    def test_range_break(self):
+        def f():
+            for i in range(1000):
+                if i == 25:
+                    break
+            return i * 2
+        self.assertEqual(f(), 50)
+
+    def test_range_shadowed(self):
+        def f(range):
+            total = 0
+            for i in range(3):
+                total += i
+            return total
+        self.assertEqual(f(lambda n: [10, 20, 30][:n]), 60)
+
+    def test_range_shadowed_after_compile(self):
+        def f():
+            total = 0
+            for i in range(3):
+                total += i
+            return total
+        self.assertEqual(f(), 3)
+        self.assertEqual(f(), 3)
+        f.__globals__['range'] = lambda n: [0.5, 1.5, 2.5][:n]
+        try:
+            self.assertEqual(f(), 4.5)
+            self.assertEqual(f(), 4.5)
+        finally:
+            del f.__globals__['range']
+        self.assertEqual(f(), 3)
+
+    def test_range_outside_int64(self):
+        def f(start, stop):
+            total = 0
+            for i in range(start, stop):
+                total += i
+            return total
+        self.assertEqual(f(0, 2), 1)
+        self.assertEqual(f(0, 2), 1)
+        self.assertEqual(f(2 ** 63, 2 ** 63 + 2), 2 ** 64 + 1)
+        self.assertEqual(f(-2 ** 63 - 2, -2 ** 63), -2 ** 64 - 3)
+
+    def test_list_appended_in_loop(self):
+        def f():
+            l = [1, 2, 3]
+            seen = []
+            for x in l:
+                if x < 3:
+                    l.append(x + 10)
+                seen.append(x)
+            return seen
+        self.assertEqual(f(), [1, 2, 3, 11, 12])
+
+    def test_list_shrunk_in_loop(self):
+        def f():
+            l = [1, 2, 3, 4, 5]
+            seen = []
+            for x in l:
+                seen.append(x)
+                l.clear()
+            return seen, l
+        self.assertEqual(f(), ([1], []))
+
+    def test_tuple_items(self):
+        def f():
+            t = ("a", "b", "c")
+            result = ""
+            for x in t:
+                result += x
+            return result
+        self.assertEqual(f(), "abc")
+        self.assertEqual(f(), "abc")
+
+    def test_list_refcounts(self):
+        def f():
+            o = object()
+            l = [o, o, o]
+            before = sys.getrefcount(o)
+            for x in l:
+                pass
+            del x
+            return before, sys.getrefcount(o)
+        before, after = f()
+        self.assertEqual(before, after)
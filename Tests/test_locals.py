@@ -8,6 +8,7 @@ import gc
 class LocalsTestCase(unittest.TestCase):
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
 
     def tearDown(self) -> None:
         pyjion.disable()
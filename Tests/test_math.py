@@ -1,7 +1,11 @@
 import pyjion
 import unittest
 import gc
+import sys
+import math
+import cmath
 import statistics
+from math import floor, sqrt
 from fractions import Fraction
 
 
@@ -9,6 +13,7 @@ class MathTestCase(unittest.TestCase):
 
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
 
     def tearDown(self) -> None:
         pyjion.disable()
@@ -126,11 +131,289 @@ class MathTestCase(unittest.TestCase):
         x = c % (a + b)
         self.assertEqual(x, "boo 3")
 
+    def test_int_multiply_overflow(self):
+        def factorial(n):
+            result = 1
+            for i in range(1, n + 1):
+                result *= i
+            return result
+        for _ in range(3):
+            self.assertEqual(factorial(25), 15511210043330985984000000)
+            self.assertEqual(factorial(5), 120)
+
+    def test_int_add_overflow(self):
+        def f(n):
+            total = 9223372036854775000
+            for i in range(n):
+                total += i
+            return total
+        for _ in range(3):
+            self.assertEqual(f(100), 9223372036854775000 + 4950)
+
+    def test_int_subtract_overflow(self):
+        def f(n):
+            total = -9223372036854775000
+            for i in range(n):
+                total -= i
+            return total
+        for _ in range(3):
+            self.assertEqual(f(100), -9223372036854775000 - 4950)
+
+    def test_int_overflow_in_generator(self):
+        def f(n):
+            x = 3
+            for _ in range(n):
+                x *= 3
+                yield x
+        for _ in range(3):
+            self.assertEqual(list(f(50))[-1], 3 ** 51)
+
+    def test_int_overflow_in_try(self):
+        def f(n):
+            x = 3
+            try:
+                for _ in range(n):
+                    x *= 3
+            except ValueError:
+                pass
+            return x
+        for _ in range(3):
+            self.assertEqual(f(50), 3 ** 51)
+
+    def test_int_overflow_in_nested_expression(self):
+        def f(n):
+            x = 3
+            for _ in range(n):
+                x = 1 + x * 3
+            return x
+        expected = 3
+        for _ in range(50):
+            expected = 1 + expected * 3
+        for _ in range(3):
+            self.assertEqual(f(50), expected)
+
+    def test_int_overflow_above_unboxed_values(self):
+        def f(n):
+            x = 3
+            y = 0.0
+            for _ in range(n):
+                y = 0.5 + (True + x * 3)
+                x = x * 3
+            return x, y
+        x = 3
+        y = 0.0
+        for _ in range(50):
+            y = 0.5 + (True + x * 3)
+            x = x * 3
+        for _ in range(3):
+            self.assertEqual(f(50), (x, y))
+
+    def test_int_bitwise(self):
+        def f(n):
+            h = 5381
+            for i in range(n):
+                h = ((h << 5) ^ i) & 0xFFFFFFFF
+                h |= i >> 2
+            return h
+        expected = 5381
+        for i in range(100):
+            expected = ((expected << 5) ^ i) & 0xFFFFFFFF
+            expected |= i >> 2
+        for _ in range(3):
+            self.assertEqual(f(100), expected)
+
+    def test_int_shift_overflow(self):
+        def f(n):
+            x = 1
+            for i in range(n):
+                x <<= 1
+            return x
+        for _ in range(3):
+            self.assertEqual(f(100), 2 ** 100)
+
+    def test_int_shift_out_of_range(self):
+        def f(a, b):
+            c = a + 1
+            return c >> b, c << b
+        self.assertEqual(f(1, 70), (0, 2 << 70))
+        self.assertEqual(f(-3, 70), (-1, -2 << 70))
+        with self.assertRaises(ValueError):
+            f(1, -1)
+
+    def test_int_shift_overflow_in_generator(self):
+        def f(n):
+            x = 1
+            for _ in range(n):
+                x <<= 1
+                yield x >> 70
+        for _ in range(3):
+            self.assertEqual(list(f(100))[-1], 2 ** 30)
+
+    def test_int_negate_overflow_in_try(self):
+        def f():
+            try:
+                x = -9223372036854775807
+                y = x - 1
+                return -y
+            except ValueError:
+                return None
+        for _ in range(3):
+            self.assertEqual(f(), 9223372036854775808)
+
+    def test_float_invert(self):
+        def f():
+            b = 2.0
+            return ~b
+        for _ in range(3):
+            with self.assertRaises(TypeError):
+                f()
+
+    def test_int_unary(self):
+        def f(a):
+            b = a + 1
+            return -b, ~b, not b
+        self.assertEqual(f(1), (-2, -3, False))
+        self.assertEqual(f(-1), (0, -1, True))
+
+    def test_bool_bitwise(self):
+        def f(a, b):
+            x = a < b
+            y = a > b
+            return x & y, x | y, x ^ y, -x, ~x, not x
+        self.assertEqual(f(1, 2), (False, True, True, -1, -2, False))
+        self.assertEqual(f(2, 1), (False, True, True, 0, -1, True))
+
+    def test_math_functions(self):
+        def f(n):
+            total = 0.0
+            for i in range(1, n):
+                x = i * 0.5
+                total += math.sqrt(x) + math.sin(x) + math.cos(x) + math.exp(-x)
+            return total
+        expected = sum(math.sqrt(i * 0.5) + math.sin(i * 0.5) + math.cos(i * 0.5) + math.exp(-i * 0.5) for i in range(1, 100))
+        for _ in range(3):
+            self.assertAlmostEqual(f(100), expected)
+
+    def test_math_floor(self):
+        def f(n):
+            total = 0
+            for i in range(n):
+                total += math.floor(i / 3) + math.floor(i - 7)
+            return total
+        expected = sum(i // 3 + i - 7 for i in range(100))
+        for _ in range(3):
+            self.assertEqual(f(100), expected)
+
+    def test_math_imported_function(self):
+        from math import sqrt
+
+        def f(a):
+            b = a * 4.0
+            return sqrt(b)
+        for _ in range(3):
+            self.assertEqual(f(4.0), 4.0)
+
+    def test_math_domain_errors(self):
+        def f(a, b):
+            x = a - 2.0
+            y = b + 1.0
+            return math.sqrt(x), math.exp(y)
+        self.assertEqual(f(6.0, -1.0), (2.0, 1.0))
+        with self.assertRaises(ValueError):
+            f(1.0, 0.0)
+        with self.assertRaises(OverflowError):
+            f(2.0, 1000.0)
+
+    def test_math_floor_out_of_range(self):
+        def f(a):
+            b = a * 2.0
+            return math.floor(b)
+        self.assertEqual(f(1.75), 3)
+        with self.assertRaises(ValueError):
+            f(float("nan"))
+        with self.assertRaises(OverflowError):
+            f(float("inf"))
+
+    def test_math_floor_outside_int64(self):
+        def f():
+            x = 2e19
+            return math.floor(x)
+        for _ in range(3):
+            self.assertEqual(f(), 20000000000000000000)
+
+    def test_math_imported_floor_outside_int64(self):
+        def f(n):
+            x = 1e16
+            total = 0
+            for _ in range(n):
+                x *= 10.0
+                total += floor(x)
+            return total
+        expected = 0
+        x = 1e16
+        for _ in range(6):
+            x *= 10.0
+            expected += math.floor(x)
+        for _ in range(3):
+            self.assertEqual(f(6), expected)
+
+    def test_math_function_reference_released(self):
+        source = "def f():\n    x = 2.5\n    return math.floor(x)\n"
+        before = sys.getrefcount(math.floor)
+        for _ in range(10):
+            scope = {"math": math}
+            exec(source, scope)
+            self.assertEqual(scope["f"](), 2)
+            del scope
+        gc.collect()
+        self.assertEqual(sys.getrefcount(math.floor), before)
+
+    def test_math_function_replaced_with_complex(self):
+        def f():
+            x = 4.0
+            return math.sqrt(x) + 1.0
+        self.assertEqual(f(), 3.0)
+        original = math.sqrt
+        math.sqrt = cmath.sqrt
+        try:
+            self.assertEqual(f(), 3 + 0j)
+            self.assertIsInstance(f(), complex)
+        finally:
+            math.sqrt = original
+        self.assertEqual(f(), 3.0)
+
+    def test_math_imported_function_rebound(self):
+        def f():
+            x = 4.0
+            return sqrt(x) + 1.0
+        self.assertEqual(f(), 3.0)
+        f.__globals__['sqrt'] = lambda x: 7
+        try:
+            self.assertEqual(f(), 8.0)
+            self.assertEqual(f(), 8.0)
+        finally:
+            f.__globals__['sqrt'] = math.sqrt
+        self.assertEqual(f(), 3.0)
+
+    def test_math_function_replaced(self):
+        def f(a):
+            b = a + 1.0
+            return math.sqrt(b)
+        self.assertEqual(f(3.0), 2.0)
+        original = math.sqrt
+        math.sqrt = lambda x: -x
+        try:
+            self.assertEqual(f(3.0), -4.0)
+        finally:
+            math.sqrt = original
+        self.assertEqual(f(8.0), 3.0)
+
 
 class StatisticsTestCase(unittest.TestCase):
 
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
         pyjion.enable_pgc()
         pyjion.enable_graphs()
 
@@ -7,6 +7,7 @@ class NumpyTestCase(unittest.TestCase):
 
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
         pyjion.enable_graphs()
 
     def tearDown(self) -> None:
@@ -0,0 +1,142 @@
+import pyjion
+import unittest
+import gc
+import sys
+import traceback
+
+
+class OSRTestCase(unittest.TestCase):
+
+    def setUp(self) -> None:
+        pyjion.enable()
+        self.previous = pyjion.config()
+        pyjion.config(threshold=10, osr=True)
+
+    def tearDown(self) -> None:
+        pyjion.config(threshold=self.previous['threshold'], osr=self.previous['osr'])
+        pyjion.disable()
+        gc.collect()
+
+    def test_for_loop_called_once(self):
+        def main():
+            total = 0
+            for i in range(1000):
+                total += i
+            return total
+
+        self.assertEqual(main(), 499500)
+        info = pyjion.info(main)
+        self.assertTrue(info['compiled'])
+        self.assertEqual(info['run_count'], 1)
+        self.assertEqual(info['osr_count'], 1)
+
+    def test_while_loop_called_once(self):
+        def main():
+            i = 0
+            values = []
+            while i < 100:
+                values.append(i * 2)
+                i += 1
+            return values
+
+        self.assertEqual(main(), [i * 2 for i in range(100)])
+        self.assertEqual(pyjion.info(main)['osr_count'], 1)
+
+    def test_exception_in_loop(self):
+        def main():
+            total = 0
+            for i in range(100):
+                total += 100 // (50 - i)
+            return total
+
+        with self.assertRaises(ZeroDivisionError) as context:
+            main()
+        self.assertEqual(pyjion.info(main)['osr_count'], 1)
+        frames = [frame for frame, _ in traceback.walk_tb(context.exception.__traceback__)
+                  if frame.f_code is main.__code__]
+        self.assertEqual(len(frames), 1)
+
+    def test_short_loop_stays_interpreted(self):
+        def main():
+            total = 0
+            for i in range(3):
+                total += i
+            return total
+
+        self.assertEqual(main(), 3)
+        info = pyjion.info(main)
+        self.assertFalse(info['compiled'])
+        self.assertEqual(info['osr_count'], 0)
+
+    def test_disabled(self):
+        pyjion.config(osr=False)
+
+        def main():
+            total = 0
+            for i in range(1000):
+                total += i
+            return total
+
+        self.assertEqual(main(), 499500)
+        info = pyjion.info(main)
+        self.assertEqual(info['osr_count'], 0)
+        # Without OSR loops in interpreted frames aren't watched, only the call counts
+        self.assertEqual(info['backedge_count'], 0)
+        self.assertEqual(info['hotness'], 1)
+        self.assertFalse(info['compiled'])
+
+    def test_existing_tracer_kept(self):
+        lines = []
+
+        def tracer(frame, event, arg):
+            if frame.f_code is main.__code__ and event == 'line':
+                lines.append(frame.f_lineno)
+            return tracer
+
+        def main():
+            total = 0
+            for i in range(100):
+                total += i
+            return total
+
+        sys.settrace(tracer)
+        try:
+            self.assertEqual(main(), 4950)
+            self.assertIs(sys.gettrace(), tracer)
+        finally:
+            sys.settrace(None)
+        # Every iteration was traced in the interpreter
+        self.assertGreaterEqual(len(lines), 200)
+        self.assertEqual(pyjion.info(main)['osr_count'], 0)
+
+    def test_tracer_set_in_watched_frame_kept(self):
+        def tracer(frame, event, arg):
+            return None
+
+        def main():
+            total = 0
+            for i in range(3):
+                total += i
+            sys.settrace(tracer)
+            return total
+
+        try:
+            self.assertEqual(main(), 3)
+            self.assertIs(sys.gettrace(), tracer)
+        finally:
+            sys.settrace(None)
+        self.assertIsNone(sys.gettrace())
+
+    def test_no_tracer_left_installed(self):
+        def main():
+            total = 0
+            for i in range(1000):
+                total += i
+            return total
+
+        self.assertEqual(main(), 499500)
+        self.assertIsNone(sys.gettrace())
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,131 @@
+import pyjion
+import unittest
+import ctypes
+import gc
+import os
+import platform
+import struct
+import sys
+
+
+@unittest.skipUnless(sys.platform.startswith("linux"), "perf files are written on Linux")
+class PerfFilesTestCase(unittest.TestCase):
+
+    def setUp(self) -> None:
+        pyjion.enable()
+        pyjion.config(threshold=0)
+
+    def tearDown(self) -> None:
+        pyjion.config(perf_map=False, jitdump=False, gdb=False)
+        pyjion.disable()
+        gc.collect()
+
+    def test_perf_map(self):
+        pyjion.config(perf_map=True)
+
+        def test_perf_map_f():
+            return 1 + 2
+
+        self.assertEqual(test_perf_map_f(), 3)
+        with open("/tmp/perf-{}.map".format(os.getpid())) as perf_map:
+            entries = [line.split(" ", 2) for line in perf_map.read().splitlines()]
+        names = [name for _, _, name in entries]
+        self.assertTrue(any(name.startswith("py::test_perf_map_f:") for name in names), names)
+        for address, size, _ in entries:
+            self.assertGreater(int(address, 16), 0)
+            self.assertGreater(int(size, 16), 0)
+
+    def test_jitdump(self):
+        pyjion.config(jitdump=True)
+
+        def test_jitdump_f():
+            return 1 + 2
+
+        self.assertEqual(test_jitdump_f(), 3)
+        pyjion.config(jitdump=False)
+        with open("/tmp/jit-{}.dump".format(os.getpid()), "rb") as dump:
+            data = dump.read()
+        magic, version, header_size = struct.unpack_from("<III", data)
+        self.assertEqual(magic, 0x4A695444)
+        self.assertEqual(version, 1)
+
+        record_types = []
+        offset = header_size
+        while offset < len(data):
+            record_type, size = struct.unpack_from("<II", data, offset)
+            record_types.append(record_type)
+            offset += size
+        self.assertEqual(offset, len(data))
+        self.assertIn(0, record_types)  # Code load
+        self.assertEqual(record_types[-1], 3)  # Close
+
+    def test_gdb_jit_interface(self):
+        pyjion.config(gdb=True)
+
+        def test_gdb_f():
+            return 1 + 2
+
+        self.assertEqual(test_gdb_f(), 3)
+
+        class CodeEntry(ctypes.Structure):
+            pass
+        CodeEntry._fields_ = [("next_entry", ctypes.POINTER(CodeEntry)), ("prev_entry", ctypes.POINTER(CodeEntry)),
+                              ("symfile_addr", ctypes.c_void_p), ("symfile_size", ctypes.c_uint64)]
+
+        class Descriptor(ctypes.Structure):
+            _fields_ = [("version", ctypes.c_uint32), ("action_flag", ctypes.c_uint32),
+                        ("relevant_entry", ctypes.POINTER(CodeEntry)), ("first_entry", ctypes.POINTER(CodeEntry))]
+
+        descriptor = Descriptor.in_dll(ctypes.CDLL(pyjion._pyjion.__file__), "__jit_debug_descriptor")
+        self.assertEqual(descriptor.version, 1)
+        symfiles = []
+        entry = descriptor.first_entry
+        while entry:
+            symfiles.append(ctypes.string_at(entry.contents.symfile_addr, entry.contents.symfile_size))
+            entry = entry.contents.next_entry
+        self.assertTrue(symfiles)
+        self.assertTrue(all(symfile.startswith(b"\x7fELF") for symfile in symfiles))
+        self.assertTrue(any(b"py::test_gdb_f:" in symfile for symfile in symfiles))
+
+
+
+class DlInfo(ctypes.Structure):
+    _fields_ = [("dli_fname", ctypes.c_char_p), ("dli_fbase", ctypes.c_void_p),
+                ("dli_sname", ctypes.c_char_p), ("dli_saddr", ctypes.c_void_p)]
+
+
+@unittest.skipUnless(sys.platform.startswith("linux") and platform.machine() == "x86_64",
+                     "unwind info is registered on x64 Linux")
+class UnwindTestCase(unittest.TestCase):
+
+    def setUp(self) -> None:
+        pyjion.enable()
+        pyjion.config(threshold=0)
+
+    def tearDown(self) -> None:
+        pyjion.disable()
+        gc.collect()
+
+    def test_backtrace_through_jitted_code(self):
+        libc = ctypes.CDLL(None)
+        libc.backtrace.argtypes = [ctypes.POINTER(ctypes.c_void_p), ctypes.c_int]
+        libc.dladdr.argtypes = [ctypes.c_void_p, ctypes.POINTER(DlInfo)]
+        addresses = (ctypes.c_void_p * 512)()
+
+        def test_backtrace_f():
+            # libc's backtrace() unwinds with the registered .eh_frame data
+            return libc.backtrace(addresses, len(addresses))
+
+        depth = test_backtrace_f()
+        self.assertTrue(pyjion.info(test_backtrace_f)['compiled'])
+        names = []
+        for address in addresses[:depth]:
+            info = DlInfo()
+            if libc.dladdr(address, ctypes.byref(info)) and info.dli_sname:
+                names.append(info.dli_sname.decode())
+        # The interpreter frames that called the test are only reached by unwinding the jitted frames
+        self.assertIn("_PyEval_EvalFrameDefault", names)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -127,6 +127,41 @@ TEST_CASE("test UNPACK_SEQUENCE PGC") {
         CHECK(t.pgcStatus() == PgcStatus::Optimized);
     }
 
+    SECTION("test probe counts every execution"){
+        auto t = PgcProfilingTest(
+                "def f():\n"
+                "  x = [(1,2), (3,4), (5,6)]\n"
+                "  results = []\n"
+                "  for i, j in x:\n"
+                "    results.append(i); results.append(j)\n"
+                "  return results\n"
+        );
+        CHECK(t.returns() == "[1, 2, 3, 4, 5, 6]");
+        CHECK(t.pgcStatus() == PgcStatus::CompiledWithProbes);
+        CHECK(t.profileEquals(18, 0, &PyTuple_Type));
+        CHECK(t.profileHits(18, 0) == 3);
+        CHECK(t.profileShape(18, 0) == PgcMonomorphic);
+    }
+
+    SECTION("test polymorphic site histogram"){
+        auto t = PgcProfilingTest(
+                "def f():\n"
+                "  x = [(1,2), [3,4], (5,6)]\n"
+                "  results = []\n"
+                "  for i, j in x:\n"
+                "    results.append(i); results.append(j)\n"
+                "  return results\n"
+        );
+        CHECK(t.returns() == "[1, 2, 3, 4, 5, 6]");
+        CHECK(t.pgcStatus() == PgcStatus::CompiledWithProbes);
+        CHECK(t.profileHits(18, 0) == 3);
+        CHECK(t.profileShape(18, 0) == PgcPolymorphic);
+        CHECK(t.profileEquals(18, 0, &PyTuple_Type));
+        CHECK(t.profileSpecializedType(18, 0) == nullptr);
+        CHECK(t.returns() == "[1, 2, 3, 4, 5, 6]");
+        CHECK(t.pgcStatus() == PgcStatus::Optimized);
+    }
+
     SECTION("test changed types"){
         auto t = PgcProfilingTest(
                 "def f():\n"
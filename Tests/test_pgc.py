@@ -2,12 +2,16 @@ import pyjion
 import pyjion.dis
 import unittest
 import gc
+import marshal
+import os
+import tempfile
 
 
 class UnpackSequenceTest(unittest.TestCase):
 
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
         pyjion.enable_pgc()
 
     def tearDown(self) -> None:
@@ -58,4 +62,157 @@ class UnpackSequenceTest(unittest.TestCase):
         self.assertEqual(pyjion.info(f)['pgc'], 2)
         r = f((3, 4))
         self.assertEqual(r, (3, 4))
-        self.assertEqual(pyjion.info(f)['pgc'], 2)
\ No newline at end of file
+        self.assertEqual(pyjion.info(f)['pgc'], 2)
+
+class DeoptimizeTest(unittest.TestCase):
+
+    def setUp(self) -> None:
+        pyjion.enable()
+        pyjion.config(threshold=0)
+        pyjion.enable_pgc()
+
+    def tearDown(self) -> None:
+        pyjion.disable()
+        gc.collect()
+
+    def test_changed_numeric_type(self):
+        def f(x):
+            a = x[0]
+            b = x[1]
+            c = a + b
+            return c * 2.0
+
+        self.assertEqual(f([1.0, 2.0]), 6.0)
+        self.assertEqual(f([1.0, 2.0]), 6.0)
+        self.assertEqual(pyjion.info(f)['pgc'], 2)
+        self.assertEqual(pyjion.info(f)['deoptimizations'], 0)
+        self.assertEqual(f([1, 2]), 6.0)
+        self.assertEqual(pyjion.info(f)['deoptimizations'], 1)
+        self.assertEqual(f([1.0, 2.0]), 6.0)
+        self.assertEqual(f([1, 2]), 6.0)
+        self.assertEqual(pyjion.info(f)['deoptimizations'], 1)
+
+    def test_changed_type_in_loop(self):
+        def f(items):
+            total = 0.0
+            for item in items:
+                total = total + item
+            return total
+
+        self.assertEqual(f([1.0, 2.0, 3.0]), 6.0)
+        self.assertEqual(f([1.0, 2.0, 3.0]), 6.0)
+        self.assertEqual(pyjion.info(f)['deoptimizations'], 0)
+        self.assertEqual(f([1.0, 2.0, 3]), 6.0)
+        self.assertEqual(pyjion.info(f)['deoptimizations'], 1)
+        self.assertEqual(f([1.0, 2.0, 3.0]), 6.0)
+
+    def test_repeated_deoptimization_blacklisted(self):
+        def f(x):
+            a = x[0] + 1.0
+            b = x[1] + 1.0
+            c = x[2] + 1.0
+            d = x[3] + 1.0
+            e = x[4] + 1.0
+            return a + b + c + d + e
+
+        self.assertEqual(f([1.0, 2.0, 3.0, 4.0, 5.0]), 20.0)
+        self.assertEqual(f([1.0, 2.0, 3.0, 4.0, 5.0]), 20.0)
+        for _ in range(10):
+            self.assertEqual(f([1, 2, 3, 4, 5]), 20.0)
+        info = pyjion.info(f)
+        self.assertTrue(info['blacklisted'])
+        self.assertFalse(info['compiled'])
+        deoptimizations = info['deoptimizations']
+        self.assertEqual(f([1, 2, 3, 4, 5]), 20.0)
+        self.assertEqual(pyjion.info(f)['deoptimizations'], deoptimizations)
+
+
+class SpecializationTest(unittest.TestCase):
+
+    def setUp(self) -> None:
+        pyjion.enable()
+        pyjion.config(threshold=0)
+        pyjion.enable_pgc()
+
+    def tearDown(self) -> None:
+        pyjion.disable()
+        gc.collect()
+
+    def test_int_and_float_entry_points(self):
+        def f(x, y):
+            return x * y + x
+
+        self.assertEqual(f(2, 3), 8)
+        self.assertEqual(f(2, 3), 8)
+        self.assertEqual(pyjion.info(f)['pgc'], 2)
+        self.assertEqual(f(2.0, 3.0), 8.0)
+        self.assertEqual(pyjion.info(f)['specializations'], 1)
+        self.assertEqual(f(2, 3), 8)
+        self.assertEqual(f(2.0, 3.0), 8.0)
+        self.assertEqual(pyjion.info(f)['specializations'], 1)
+        self.assertFalse(pyjion.info(f)['generic'])
+
+    def test_two_digit_integers(self):
+        def f(x, y):
+            return x * y + x
+
+        self.assertEqual(f(2 ** 40, 3), 2 ** 42)
+        self.assertEqual(f(2 ** 40, 3), 2 ** 42)
+        self.assertEqual(pyjion.info(f)['pgc'], 2)
+        self.assertEqual(f(2 ** 61, 3), 2 ** 63)
+
+    def test_generic_fallback(self):
+        def f(x):
+            return x + x
+
+        f(1)
+        f(1)
+        for value in (1.0, "a", b"b", (1,), [1]):
+            self.assertEqual(f(value), value + value)
+        info = pyjion.info(f)
+        self.assertEqual(info['specializations'], 4)
+        self.assertTrue(info['generic'])
+        self.assertEqual(f(1j), 2j)
+
+
+class ProfileStoreTest(unittest.TestCase):
+    source = """
+def f(x, y):
+    return x + y
+"""
+
+    def setUp(self) -> None:
+        pyjion.enable()
+        pyjion.config(threshold=0)
+        pyjion.enable_pgc()
+        fd, self.path = tempfile.mkstemp()
+        os.close(fd)
+
+    def tearDown(self) -> None:
+        pyjion.disable()
+        os.remove(self.path)
+        gc.collect()
+
+    def make_function(self):
+        scope = {}
+        exec(compile(self.source, "profile_store_test.py", "exec"), scope)
+        return scope['f']
+
+    def test_loaded_profile_skips_probes(self):
+        f = self.make_function()
+        self.assertEqual(f(1, 2), 3)
+        self.assertEqual(pyjion.info(f)['pgc'], 1)
+        pyjion.save_profiles(self.path)
+
+        g = self.make_function()
+        self.assertIsNot(f.__code__, g.__code__)
+        self.assertGreaterEqual(pyjion.load_profiles(self.path), 1)
+        self.assertEqual(g(3, 4), 7)
+        self.assertEqual(pyjion.info(g)['pgc'], 2)
+        self.assertEqual(g(1.5, 2), 3.5)
+
+    def test_invalid_file(self):
+        with open(self.path, "wb") as out:
+            marshal.dump("not a profile", out)
+        with self.assertRaises(ValueError):
+            pyjion.load_profiles(self.path)
@@ -0,0 +1,63 @@
+import pyjion
+import unittest
+import gc
+import sys
+import time
+from pyjion import sampling_profiler
+
+
+@unittest.skipIf(sys.platform.startswith("win"), "the sampling profiler uses SIGPROF")
+class SamplingProfilerTestCase(unittest.TestCase):
+
+    def setUp(self) -> None:
+        pyjion.enable()
+        pyjion.config(threshold=0)
+        sampling_profiler.clear()
+
+    def tearDown(self) -> None:
+        sampling_profiler.stop()
+        sampling_profiler.clear()
+        pyjion.disable()
+        gc.collect()
+
+    def test_samples_jitted_lines(self):
+        def test_sampled_f(n):
+            total = 0
+            for i in range(n):
+                total += i * 2
+            return total
+
+        for _ in range(5):
+            test_sampled_f(10)
+        self.assertTrue(pyjion.info(test_sampled_f)["compiled"])
+
+        sampling_profiler.start(1000)
+        deadline = time.process_time() + 0.5
+        while time.process_time() < deadline:
+            test_sampled_f(10000)
+        sampling_profiler.stop()
+
+        samples = sampling_profiler.samples()
+        self.assertGreater(samples["total"], 0)
+        self.assertEqual(samples["total"], samples["other"] + sum(samples["lines"].values()))
+        names = [entry.name for entry in sampling_profiler.top(5)]
+        self.assertIn("test_sampled_f", names)
+
+    def test_clear(self):
+        sampling_profiler.start(1000)
+        deadline = time.process_time() + 0.1
+        while time.process_time() < deadline:
+            pass
+        sampling_profiler.stop()
+        sampling_profiler.clear()
+        samples = sampling_profiler.samples()
+        self.assertEqual(samples["total"], 0)
+        self.assertEqual(samples["lines"], {})
+
+    def test_invalid_rate(self):
+        with self.assertRaises(ValueError):
+            sampling_profiler.start(0)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -61,7 +61,7 @@ private:
         Py_DECREF(frame);
         size_t collected = PyGC_Collect();
         printf("Collected %zu values\n", collected);
-        REQUIRE(!m_jittedcode->j_failed);
+        REQUIRE(!m_jittedcode->failed());
         return res;
     }
 
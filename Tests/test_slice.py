@@ -10,6 +10,7 @@ import contextlib
 class SliceTestCase(unittest.TestCase):
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
         pyjion.disable_pgc()
 
     def tearDown(self) -> None:
@@ -8,6 +8,7 @@ class StringFormattingTestCase(unittest.TestCase):
 
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
         pyjion.disable_pgc()
 
     def tearDown(self) -> None:
@@ -49,6 +50,7 @@ class FStringFormattingTestCase(unittest.TestCase):
 
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
         pyjion.disable_pgc()
 
     def tearDown(self) -> None:
@@ -79,6 +81,7 @@ def _is_sunder(name):
 class StringIfsTestCase(unittest.TestCase):
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
         pyjion.enable_pgc()
 
     def tearDown(self) -> None:
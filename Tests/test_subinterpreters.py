@@ -0,0 +1,94 @@
+import pyjion
+import unittest
+import gc
+import _xxsubinterpreters as interpreters
+
+
+class SubinterpreterTestCase(unittest.TestCase):
+    """Subinterpreters keep their own JIT settings and compiled code."""
+
+    def setUp(self) -> None:
+        pyjion.enable()
+        pyjion.config(threshold=0)
+
+    def tearDown(self) -> None:
+        pyjion.disable()
+        gc.collect()
+
+    def test_enable_in_subinterpreter(self):
+        threshold = pyjion.config()["threshold"]
+        interp = interpreters.create()
+        try:
+            interpreters.run_string(interp, f"""if True:
+                import pyjion
+                assert pyjion.enable()
+                pyjion.config(threshold={threshold + 2})
+
+                def f(n):
+                    total = 0
+                    for i in range(n):
+                        total += i
+                    return total
+
+                for _ in range({threshold + 5}):
+                    assert f(10) == 45
+                assert pyjion.info(f)["compiled"]
+                pyjion.disable()
+            """)
+        finally:
+            interpreters.destroy(interp)
+        # The main interpreter is still enabled with its own threshold
+        self.assertFalse(pyjion.enable())
+        self.assertEqual(pyjion.config()["threshold"], threshold)
+
+    def test_subinterpreter_not_enabled(self):
+        interp = interpreters.create()
+        try:
+            interpreters.run_string(interp, """if True:
+                import pyjion
+
+                def f():
+                    return 1
+
+                for _ in range(5):
+                    f()
+                assert not pyjion.info(f)["compiled"]
+            """)
+        finally:
+            interpreters.destroy(interp)
+
+
+    def test_code_budget_per_interpreter(self):
+        def f():
+            return 1 + 2
+
+        self.assertEqual(f(), 3)
+        self.assertTrue(pyjion.info(f)["compiled"])
+        interp = interpreters.create()
+        try:
+            interpreters.run_string(interp, """if True:
+                import pyjion
+                assert pyjion.enable()
+                pyjion.config(threshold=0, code_budget=1)
+
+                def g():
+                    return 3 + 4
+
+                def h():
+                    return 5 + 6
+
+                assert g() == 7
+                assert h() == 11
+                assert pyjion.info(h)["compiled"]
+                assert pyjion.info(g)["evictions"] == 1
+                pyjion.disable()
+            """)
+        finally:
+            interpreters.destroy(interp)
+        # The subinterpreter only evicts its own code
+        info = pyjion.info(f)
+        self.assertTrue(info["compiled"])
+        self.assertEqual(info["evictions"], 0)
+
+if __name__ == "__main__":
+    unittest.main()
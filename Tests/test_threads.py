@@ -11,6 +11,7 @@ import test.support as support
 class TestPendingCalls(unittest.TestCase):
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
 
     def tearDown(self) -> None:
         pyjion.disable()
@@ -3,6 +3,7 @@ import pyjion
 import unittest
 import io
 import contextlib
+import time
 import dis
 import sys
 import gc
@@ -20,6 +21,7 @@ class TracingTestCase(unittest.TestCase):
 
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
 
     def tearDown(self) -> None:
         pyjion.disable()
@@ -114,6 +116,7 @@ class ProfilingTestCase(unittest.TestCase):
 
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
 
     def tearDown(self) -> None:
         pyjion.disable()
@@ -169,5 +172,100 @@ class ProfilingTestCase(unittest.TestCase):
         self.assertIn("Returning ", f.getvalue())
 
 
+class TimingTestCase(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls) -> None:
+        pyjion.enable_timing()
+
+    @classmethod
+    def tearDownClass(cls) -> None:
+        pyjion.disable_timing()
+
+    def setUp(self) -> None:
+        pyjion.enable()
+        pyjion.config(threshold=0)
+
+    def tearDown(self) -> None:
+        pyjion.disable()
+
+    def test_counts_calls_and_cycles(self):
+        def test_f(n):
+            total = 0
+            for i in range(n):
+                total += i
+            return total
+
+        for _ in range(10):
+            self.assertEqual(test_f(100), 4950)
+        info = pyjion.info(test_f)
+        self.assertTrue(info["compiled"])
+        self.assertGreater(info["calls"], 0)
+        self.assertLessEqual(info["calls"], 10)
+        self.assertGreater(info["cycles"], 0)
+
+        f = io.StringIO()
+        with contextlib.redirect_stdout(f):
+            pyjion.dis.dis(test_f)
+        self.assertIn("METHOD_READ_TIMESTAMP", f.getvalue())
+        self.assertNotIn("METHOD_PROFILE_FRAME_ENTRY", f.getvalue())
+
+    def test_generator_resumes(self):
+        def test_gen(n):
+            for i in range(n):
+                yield i
+
+        start = time.perf_counter()
+        self.assertEqual(list(test_gen(3)), [0, 1, 2])
+        elapsed = time.perf_counter() - start
+        info = pyjion.info(test_gen)
+        self.assertTrue(info["compiled"])
+        # Started once and resumed after each of the 3 yields
+        self.assertEqual(info["calls"], 4)
+        self.assertGreater(info["cycles"], 0)
+        # Well above any clock rate, a resumption timed from 0 adds the whole counter value
+        self.assertLess(info["cycles"], elapsed * 10 ** 10)
+
+
+class OpcodeCountsTestCase(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls) -> None:
+        pyjion.enable_opcode_counts()
+
+    @classmethod
+    def tearDownClass(cls) -> None:
+        pyjion.disable_opcode_counts()
+
+    def setUp(self) -> None:
+        pyjion.enable()
+        pyjion.config(threshold=0)
+
+    def tearDown(self) -> None:
+        pyjion.disable()
+
+    def test_counts_instructions(self):
+        def test_f(n):
+            total = 0
+            for i in range(n):
+                total += i
+            return total
+
+        for _ in range(10):
+            self.assertEqual(test_f(100), 4950)
+        info = pyjion.info(test_f)
+        self.assertTrue(info["compiled"])
+        counts = info["opcode_counts"]
+        self.assertTrue(counts)
+        # The loop body runs 100 times for every call
+        self.assertGreaterEqual(max(counts.values()), 100 * min(counts.values()))
+        self.assertTrue(all(offset % 2 == 0 for offset in counts))
+
+        f = io.StringIO()
+        with contextlib.redirect_stdout(f):
+            pyjion.dis.dis(test_f, include_offsets=True)
+        self.assertIn("x]", f.getvalue())
+
+
 if __name__ == "__main__":
     unittest.main()
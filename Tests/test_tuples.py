@@ -7,6 +7,7 @@ import sys
 class TupleTestCase(unittest.TestCase):
     def setUp(self) -> None:
         pyjion.enable()
+        pyjion.config(threshold=0)
 
     def tearDown(self) -> None:
         pyjion.disable()
@@ -201,7 +201,7 @@ public:
         if (result_t == nullptr)
             return nullptr;
 
-        auto res = PyByteArray_FromStringAndSize(reinterpret_cast<const char *>(m_jittedcode->j_addr), m_jittedcode->j_nativeSize);
+        auto res = PyByteArray_FromStringAndSize(reinterpret_cast<const char *>(m_jittedcode->j_addr.load()), m_jittedcode->j_nativeSize);
         if (res == nullptr)
             return nullptr;
 
@@ -305,6 +305,19 @@ public:
         return profile->getType(position, stackPosition) == pyType;
     }
 
+    PgcSiteShape profileShape(int position, int stackPosition) {
+        return AbstractInterpreter::pgcSiteShape(profile, position, stackPosition);
+    }
+
+    PyTypeObject* profileSpecializedType(int position, int stackPosition) {
+        return AbstractInterpreter::pgcSpecializedType(profile, position, stackPosition);
+    }
+
+    size_t profileHits(int position, int stackPosition) {
+        auto slot = profile->getSlot(position, stackPosition);
+        return slot == nullptr ? 0 : slot->hits();
+    }
+
     PgcStatus pgcStatus() {
         return m_jittedcode->j_pgc_status;
     }
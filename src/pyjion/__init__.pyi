@@ -25,6 +25,18 @@ def enable_profiling() -> None:
 def disable_profiling() -> None:
     ...
 
+def enable_timing() -> None:
+    ...
+
+def disable_timing() -> None:
+    ...
+
+def enable_opcode_counts() -> None:
+    ...
+
+def disable_opcode_counts() -> None:
+    ...
+
 def enable_pgc() -> None:
     ...
 
@@ -55,6 +67,35 @@ def get_graph(f: callable) -> str:
 def status() -> dict:
     ...
 
+def config(*, background: bool = None, threshold: int = None, optimize_threshold: int = None, osr: bool = None, code_budget: int = None,
+           compile_time_budget: int = None, perf_map: bool = None, jitdump: bool = None,
+           gdb: bool = None) -> dict:
+    ...
+
+def stats() -> dict:
+    ...
+
+def reset_stats() -> None:
+    ...
+
+def save_profiles(path: str) -> None:
+    ...
+
+def load_profiles(path: str) -> int:
+    ...
+
+def start_sampling(hz: int = 100) -> None:
+    ...
+
+def stop_sampling() -> None:
+    ...
+
+def get_samples() -> dict:
+    ...
+
+def clear_samples() -> None:
+    ...
+
 def symbols(f: callable) -> dict:
     ...
 
@@ -29,21 +29,22 @@
 #include <deque>
 #include <unordered_map>
 #include <algorithm>
+#include <chrono>
 
 #include "absint.h"
 #include "pyjit.h"
 
-#define PGC_READY() g_pyjionSettings.pgc && profile != nullptr
+#define PGC_READY() PyJit_Settings().pgc && profile != nullptr
 
 #define PGC_PROBE(count) pgcRequired = true; pgcSize = count;
 
 #define PGC_UPDATE_STACK(count) \
-    if (pgc_status == PgcStatus::CompiledWithProbes) {                      \
+    if (pgc_status == PgcStatus::CompiledWithProbes && !profile->isDeoptimized(curByte)) { \
         for (int pos = 0; pos < (count) ; pos++) \
             lastState.push_n(pos,                                           \
                              lastState.fromPgc(                             \
                                 pos,                                        \
-                                profile->getType(curByte, pos),             \
+                                pgcSpecializedType(profile, curByte, pos),  \
                                 profile->getKind(curByte, pos)));          \
         mStartStates[curByte] = lastState; \
     }
@@ -61,6 +62,8 @@ AbstractInterpreter::AbstractInterpreter(PyCodeObject *code, IPythonCompiler* co
     mSize = PyBytes_Size(code->co_code);
     mTracingEnabled = false;
     mProfilingEnabled = false;
+    mTimingEnabled = false;
+    mOpcodeCountsEnabled = false;
 
     if (comp != nullptr) {
         m_retLabel = comp->emit_define_label();
@@ -88,7 +91,7 @@ AbstractInterpreterResult AbstractInterpreter::preprocess() {
         // all parameters are initially definitely assigned
         m_assignmentState[i] = true;
     }
-    if (mSize >= g_pyjionSettings.codeObjectSizeLimit){
+    if (mSize >= PyJit_Settings().codeObjectSizeLimit){
         return IncompatibleSize;
     }
 
@@ -223,12 +226,31 @@ void AbstractInterpreter::initStartingState() {
     updateStartState(lastState, 0);
 }
 
+// Failed guards can only hand the frame back to the interpreter when CPython's block
+// stack would be empty and nothing else expects the jitted frame to finish.
+bool AbstractInterpreter::canDeoptimizeFrame() {
+    if (mCode->co_flags & (CO_GENERATOR | CO_COROUTINE | CO_ASYNC_GENERATOR | CO_ITERABLE_COROUTINE))
+        return false;
+    if (mTracingEnabled || mProfilingEnabled)
+        return false;
+    for (py_opindex i = 0; i < mSize; i += SIZEOF_CODEUNIT){
+        switch (GET_OPCODE(i)){
+            case SETUP_FINALLY:
+            case SETUP_WITH:
+            case SETUP_ASYNC_WITH:
+                return false;
+        }
+    }
+    return true;
+}
+
 AbstractInterpreterResult
 AbstractInterpreter::interpret(PyObject *builtins, PyObject *globals, PyjionCodeProfile *profile, PgcStatus pgc_status) {
     auto preprocessResult = preprocess();
     if (preprocessResult != Success) {
         return preprocessResult;
     }
+    mCanDeoptimize = canDeoptimizeFrame();
 
     // walk all the blocks in the code one by one, analyzing them, and enqueing any
     // new blocks that we encounter from branches.
@@ -409,6 +431,9 @@ AbstractInterpreter::interpret(PyObject *builtins, PyObject *globals, PyjionCode
                     one = POP_VALUE();
 
                     auto out = one.Value->binary(one.Sources, opcode, two);
+                    // An unboxed version of this operation overflowed, keep the result boxed
+                    if (profile != nullptr && profile->isDeoptimized(curByte) && out->kind() == AVK_Integer)
+                        out = &BigInteger;
                     PUSH_INTERMEDIATE(out)
                 }
                 break;
@@ -620,8 +645,10 @@ AbstractInterpreter::interpret(PyObject *builtins, PyObject *globals, PyjionCode
                     }
                     int argCnt = oparg & 0xff;
                     int kwArgCnt = (oparg >> 8) & 0xff;
+                    AbstractValueKind argKind = AVK_Any;
                     for (int i = 0; i < argCnt; i++) {
-                        POP_VALUE();
+                        auto arg = POP_VALUE();
+                        argKind = arg.Value->kind();
                     }
                     for (int i = 0; i < kwArgCnt; i++) {
                         POP_VALUE();
@@ -630,8 +657,13 @@ AbstractInterpreter::interpret(PyObject *builtins, PyObject *globals, PyjionCode
 
                     // pop the function...
                     auto func = POP_VALUE();
+                    auto returnKind = knownFunctionReturnType(func);
+                    // The compiled call deoptimizes when the function returns something else
+                    if (oparg == 1 && knownMathFunction(func) != MathNone && mCanDeoptimize &&
+                            !(profile != nullptr && profile->isDeoptimized(curByte)))
+                        returnKind = mathFunctionReturnType(knownMathFunction(func), argKind);
                     auto source = AbstractValueWithSources(
-                        avkToAbstractValue(knownFunctionReturnType(func)),
+                        avkToAbstractValue(returnKind),
                         newSource(new LocalSource(curByte)));
                     lastState.push(source);
                     break;
@@ -704,6 +736,9 @@ AbstractInterpreter::interpret(PyObject *builtins, PyObject *globals, PyjionCode
                 case UNARY_NOT: {
                     auto in = POP_VALUE();
                     auto out = in.Value->unary(in.Sources, opcode);
+                    // An unboxed version of this operation overflowed, keep the result boxed
+                    if (profile != nullptr && profile->isDeoptimized(curByte) && out->kind() == AVK_Integer)
+                        out = &BigInteger;
                     PUSH_INTERMEDIATE(out);
                     break;
                 }
@@ -787,7 +822,15 @@ AbstractInterpreter::interpret(PyObject *builtins, PyObject *globals, PyjionCode
                     // When we compile this we don't actually leave the value on the stack,
                     // but the sequence of opcodes assumes that happens.  to keep our stack
                     // properly balanced we match what's really going on.
-                    PUSH_INTERMEDIATE(&Any);
+                    // The values of a range iterator are only ints if range() wasn't shadowed and the range fits
+                    // in a C long, the compiled code deoptimizes at FOR_ITER when that turns out to be wrong.
+                    if (isRangeIterator(iterator) && mCanDeoptimize && !(profile != nullptr && profile->isDeoptimized(curByte))) {
+                        m_rangeIterators.insert(curByte);
+                        PUSH_INTERMEDIATE(&Integer);
+                    } else {
+                        m_rangeIterators.erase(curByte);
+                        PUSH_INTERMEDIATE(&Any);
+                    }
                     break;
                 }
                 case POP_BLOCK: {
@@ -874,9 +917,25 @@ AbstractInterpreter::interpret(PyObject *builtins, PyObject *globals, PyjionCode
                     break;
                 case LOAD_METHOD: {
                     auto object = POP_VALUE();
+                    AbstractSource* methodSource = nullptr;
+                    auto globalSource = object.hasSource() ? dynamic_cast<GlobalSource*>(object.Sources) : nullptr;
+                    if (globalSource != nullptr && isMathModule(globalSource->getValue())) {
+                        // The module dict keeps the function alive, so the source can borrow it
+                        auto attr = PyObject_GetAttr(globalSource->getValue(), PyTuple_GetItem(mCode->co_names, oparg));
+                        if (attr == nullptr) {
+                            PyErr_Clear();
+                        } else {
+                            auto function = mathFunction(attr);
+                            if (function != MathNone)
+                                methodSource = newSource(new MathFunctionSource(utf8_names[oparg], function, attr, curByte));
+                            Py_DECREF(attr);
+                        }
+                    }
+                    if (methodSource == nullptr)
+                        methodSource = newSource(new MethodSource(utf8_names[oparg], curByte));
                     auto method = AbstractValueWithSources(
                             &Method,
-                            newSource(new MethodSource(utf8_names[oparg], curByte)));
+                            methodSource);
                     object.Sources = newSource(new IntermediateSource(curByte));
                     lastState.push(object);
                     lastState.push(method);
@@ -909,7 +968,10 @@ AbstractInterpreter::interpret(PyObject *builtins, PyObject *globals, PyjionCode
                     auto method = POP_VALUE();
                     auto self = POP_VALUE();
 
-                    if (method.hasValue() && method.Value->kind() == AVK_Method && self.Value->known()){
+                    if (oparg == 1 && knownMathFunction(method) != MathNone) {
+                        // The result stays boxed, a replaced function can return anything
+                        PUSH_INTERMEDIATE(&Any);
+                    } else if (method.hasValue() && method.Value->kind() == AVK_Method && self.Value->known()){
                         auto meth_source = dynamic_cast<MethodSource*>(method.Sources);
                         lastState.push(AbstractValueWithSources(avkToAbstractValue(avkToAbstractValue(self.Value->kind())->resolveMethod(meth_source->name())),
                                                                 newSource(new IntermediateSource(curByte))));
@@ -990,6 +1052,16 @@ AbstractInterpreter::interpret(PyObject *builtins, PyObject *globals, PyjionCode
     next:;
     } while (!queue.empty());
 
+    mProfile = profile;
+    if (PGC_READY() && pgc_status == PgcStatus::Uncompiled) {
+        // Size the profile from the probe sites so the probes can write to it directly
+        vector<pair<size_t, size_t>> sites;
+        for (auto &state: mStartStates) {
+            if (state.second.requiresPgcProbe)
+                sites.emplace_back(state.first, state.second.pgcProbeSize);
+        }
+        profile->allocateSlots(sites);
+    }
     return Success;
 }
 
@@ -1104,6 +1176,39 @@ short AbstractInterpreter::pgcProbeSize(py_opindex byteCodeIndex) {
     return mStartStates[byteCodeIndex].pgcProbeSize;
 }
 
+PgcSiteShape AbstractInterpreter::pgcSiteShape(PyjionCodeProfile* profile, py_opindex byteCodeIndex, size_t stackPosition) {
+    auto slot = profile->getSlot(byteCodeIndex, stackPosition);
+    if (slot == nullptr || slot->hits() == 0)
+        return PgcUnseen;
+    if (slot->megamorphic > 0)
+        return PgcMegamorphic;
+    size_t seen = 0;
+    for (auto type : slot->types) {
+        if (type != nullptr)
+            seen++;
+    }
+    return seen == 1 ? PgcMonomorphic : PgcPolymorphic;
+}
+
+// Chooses the type to specialize a profiled stack position on, or nullptr for generic code.
+// Monomorphic sites are specialized, polymorphic sites only when one type is seen almost all
+// of the time, megamorphic sites never.
+PyTypeObject* AbstractInterpreter::pgcSpecializedType(PyjionCodeProfile* profile, py_opindex byteCodeIndex, size_t stackPosition) {
+    switch (pgcSiteShape(profile, byteCodeIndex, stackPosition)) {
+        case PgcMonomorphic:
+            return profile->getType(byteCodeIndex, stackPosition);
+        case PgcPolymorphic: {
+            auto slot = profile->getSlot(byteCodeIndex, stackPosition);
+            auto dominant = slot->dominant();
+            if ((double)slot->counts[dominant] >= PGC_DOMINANT_RATIO * (double)slot->hits())
+                return slot->types[dominant];
+            return nullptr;
+        }
+        default:
+            return nullptr;
+    }
+}
+
 bool AbstractInterpreter::pgcProbeRequired(py_opindex byteCodeIndex, PgcStatus status) {
     if (status == PgcStatus::Uncompiled)
         return mStartStates[byteCodeIndex].requiresPgcProbe;
@@ -1478,7 +1583,7 @@ void AbstractInterpreter::incStack(size_t size, LocalKind kind) {
             m_stack.inc(size, STACK_KIND_VALUE_FLOAT);
             break;
         case LK_Bool:
-            m_stack.inc(size, STACK_KIND_VALUE_INT);
+            m_stack.inc(size, STACK_KIND_VALUE_BOOL);
             break;
     }
 }
@@ -1526,7 +1631,7 @@ void AbstractInterpreter::loadEscapedLocalsFromFrame(const unordered_map<py_opar
     }
 }
 
-void AbstractInterpreter::escapeEdges(const vector<Edge>& edges, py_opindex curByte) {
+void AbstractInterpreter::escapeEdges(const vector<Edge>& edges, py_opindex curByte, InstructionGraph* graph) {
     // Check if edges need boxing/unboxing
     // If none of the edges need escaping, skip
     bool needsEscapes = false;
@@ -1537,6 +1642,11 @@ void AbstractInterpreter::escapeEdges(const vector<Edge>& edges, py_opindex curB
     if (!needsEscapes)
         return;
 
+    // Check speculated types before anything is unboxed so a failed guard can
+    // fall back to the interpreter instead of raising
+    if (canDeoptimize(edges))
+        guardEdges(edges, curByte, graph);
+
     // Escape edges
     Local escapeSuccess = m_comp->emit_define_local(LK_Int);
     Label noError = m_comp->emit_define_label();
@@ -1547,6 +1657,193 @@ void AbstractInterpreter::escapeEdges(const vector<Edge>& edges, py_opindex curB
     m_comp->emit_mark_label(noError);
 }
 
+bool AbstractInterpreter::canDeoptimize(const vector<Edge>& edges) {
+    if (!mCanDeoptimize)
+        return false;
+
+    bool hasGuards = false;
+    for (auto & edge : edges){
+        if (edge.escaped == Unbox && edge.value->needsGuard())
+            hasGuards = true;
+    }
+    return hasGuards;
+}
+
+void AbstractInterpreter::guardEdges(const vector<Edge>& edges, py_opindex curByte, InstructionGraph* graph) {
+    vector<Local> values = vector<Local>(edges.size());
+    Label guardsPassed = m_comp->emit_define_label();
+    Label guardFailed = m_comp->emit_define_label();
+
+    for (size_t i = 0; i < edges.size(); i++){
+        if (edges[i].escaped == Unboxed || edges[i].escaped == Box){
+            values[i] = m_comp->emit_define_local(edges[i].value->kind());
+        } else {
+            values[i] = m_comp->emit_define_local(LK_Pointer);
+        }
+        m_comp->emit_store_local(values[i]);
+    }
+    for (size_t i = 0; i < edges.size(); i++){
+        if (edges[i].escaped == Unbox && edges[i].value->needsGuard())
+            m_comp->emit_unbox_guard(values[i], edges[i].value->kind(), guardFailed);
+    }
+    // Recover the stack in the right order
+    for (size_t i = edges.size(); i > 0; --i){
+        m_comp->emit_load_local(values[i-1]);
+    }
+    m_comp->emit_branch(BranchAlways, guardsPassed);
+
+    m_comp->emit_mark_label(guardFailed);
+    deoptimize(edges, values, curByte, graph);
+
+    m_comp->emit_mark_label(guardsPassed);
+    for (auto & value : values){
+        m_comp->emit_free_local(value);
+    }
+}
+
+// Writes the unboxed locals and the value stack back to the frame, sets f_lasti to resume
+// at curByte and exits. PyJit_ExecuteJittedFrame sees the non-null f_stacktop and hands
+// the frame over to the interpreter.
+void AbstractInterpreter::deoptimize(const vector<Edge>& edges, const vector<Local>& values, py_opindex curByte, InstructionGraph* graph) {
+    for (auto &loc: graph->getUnboxedFastLocals()){
+        auto localInfo = getLocalInfo(curByte, loc.first);
+        if (!localInfo.ValueInfo.hasValue() || localInfo.ValueInfo.Value->kind() == AVK_Undefined)
+            continue; // Not assigned yet, leave it unbound in the frame
+        m_comp->emit_load_local(m_fastNativeLocals[loc.first]);
+        m_comp->emit_box(loc.second);
+        m_comp->emit_store_fast(loc.first);
+    }
+
+    for (size_t i = edges.size(); i > 0; --i){
+        m_comp->emit_load_local(values[i-1]);
+        if (edges[i-1].escaped == Unboxed || edges[i-1].escaped == Box)
+            m_comp->emit_box(edges[i-1].value->kind());
+    }
+    for (size_t i = m_stack.size(); i > 0; --i){
+        // Unboxed values below the edges are boxed on the way into the frame
+        size_t depth = m_stack.size() - i;
+        if (depth >= edges.size()) {
+            switch (m_stack.peek(depth)) {
+                case STACK_KIND_VALUE_INT:
+                    m_comp->emit_box(AVK_Integer);
+                    break;
+                case STACK_KIND_VALUE_FLOAT:
+                    m_comp->emit_box(AVK_Float);
+                    break;
+                case STACK_KIND_VALUE_BOOL:
+                    m_comp->emit_box(AVK_Bool);
+                    break;
+                default:
+                    break;
+            }
+        }
+        m_comp->emit_store_in_frame_value_stack(i-1);
+    }
+    m_comp->emit_set_stacktop(m_stack.size());
+
+    // Resume from the start of the instruction, including any EXTENDED_ARG prefix
+    py_opindex resumeAt = curByte;
+    while (resumeAt >= SIZEOF_CODEUNIT && GET_OPCODE(resumeAt - SIZEOF_CODEUNIT) == EXTENDED_ARG)
+        resumeAt -= SIZEOF_CODEUNIT;
+    assert(resumeAt >= SIZEOF_CODEUNIT); // a guarded value always has a producer before it
+    m_comp->emit_lasti_update(resumeAt - SIZEOF_CODEUNIT);
+
+    m_comp->emit_pgc_deoptimize(curByte);
+    m_comp->emit_null();
+    m_comp->emit_store_local(m_retValue);
+    m_comp->emit_branch(BranchAlways, m_retLabel);
+}
+
+// Emits an operation on unboxed ints and bools (and floats for unary - and not), kinds are the operand kinds from
+// the top of the stack down. If the result doesn't fit in 64 bits or a shift count is out of range, the frame
+// deoptimizes with the operands boxed and the interpreter redoes the operation with PyLong arithmetic. The site is
+// marked in the profile so the result is a BigInteger, and stays boxed, when the function is recompiled. Frames that
+// can't deoptimize don't unbox these operations.
+void AbstractInterpreter::unboxedOperation(py_opcode opcode, const vector<AbstractValueKind>& kinds, py_opindex curByte, InstructionGraph* graph) {
+    vector<Local> values;
+    for (auto kind: kinds) {
+        values.push_back(m_comp->emit_define_local(kind));
+        m_comp->emit_store_local(values.back());
+    }
+    Label overflow = m_comp->emit_define_label();
+    Label done = m_comp->emit_define_label();
+    LocalKind retKind;
+    if (kinds.size() == 1)
+        retKind = m_comp->emit_unary_unboxed(opcode, values[0], kinds[0], overflow);
+    else
+        retKind = m_comp->emit_binary_int_checked(opcode, values[1], kinds[1], values[0], kinds[0], overflow);
+
+    if (canOverflow(opcode) && (kinds.size() > 1 || kinds[0] == AVK_Integer)) {
+        m_comp->emit_branch(BranchAlways, done);
+        m_comp->emit_mark_label(overflow);
+        // fixInstructions() only unboxes these operations in frames that can deoptimize
+        auto edges = graph->getEdges(curByte);
+        for (auto & edge: edges)
+            edge.escaped = Unboxed;
+        deoptimize(edges, values, curByte, graph);
+        decStack(kinds.size());
+    } else {
+        decStack(kinds.size());
+    }
+
+    m_comp->emit_mark_label(done);
+    for (auto & value: values)
+        m_comp->emit_free_local(value);
+    incStack(1, retKind);
+}
+
+// Calls a math function natively on an unboxed argument. A method call (math.sqrt(x)) boxes the result, as a replaced
+// function can return anything and Pyjion's method location can't be handed to the interpreter. A function call (sqrt(x)
+// after `from math import sqrt`) keeps the result unboxed and deoptimizes when the global was rebound or the result needs
+// the real function to raise or doesn't fit, the site is then marked in the profile so the recompiled call stays boxed.
+void AbstractInterpreter::unboxedMathCall(py_opcode opcode, AbstractValueWithSources callee, AbstractValueKind argKind, py_opindex curByte, InstructionGraph* graph) {
+    bool isMethod = opcode == CALL_METHOD;
+    auto function = knownMathFunction(callee);
+    auto returnKind = mathFunctionReturnType(function, argKind);
+    Label generic = m_comp->emit_define_label();
+    Label done = m_comp->emit_define_label();
+
+    // ..., [self], callee, arg -> ..., result
+    Local argument = m_comp->emit_define_local(argKind);
+    m_comp->emit_store_local(argument);
+    m_comp->emit_math_function_call(function, knownMathFunctionObject(callee), isMethod, argument, argKind, generic);
+
+    if (isMethod) {
+        m_comp->emit_box(returnKind);
+        m_comp->emit_branch(BranchAlways, done);
+
+        // The callee was replaced, or the result needs the real function to raise, so call it
+        m_comp->emit_mark_label(generic);
+        m_comp->emit_load_local(argument);
+        m_comp->emit_box(argKind);
+        m_comp->emit_method_call(1);
+
+        m_comp->emit_mark_label(done);
+        m_comp->emit_free_local(argument);
+        decStack(3);
+        errorCheck("math function call failed", curByte);
+        incStack();
+        return;
+    }
+
+    m_comp->emit_branch(BranchAlways, done);
+
+    // fixInstructions() only unboxes function calls in frames that can deoptimize
+    m_comp->emit_mark_label(generic);
+    Local calleeValue = m_comp->emit_define_local(LK_Pointer);
+    m_comp->emit_store_local(calleeValue);
+    auto edges = graph->getEdges(curByte);
+    edges[0].escaped = Unboxed; // argument
+    edges[1].escaped = NoEscape; // callee
+    deoptimize(edges, {argument, calleeValue}, curByte, graph);
+    m_comp->emit_free_local(calleeValue);
+    decStack(2);
+
+    m_comp->emit_mark_label(done);
+    m_comp->emit_free_local(argument);
+    incStack(1, returnKind == AVK_Float ? LK_Float : LK_Int);
+}
+
 void AbstractInterpreter::decExcVars(size_t count){
     m_comp->emit_dec_local(mExcVarsOnStack, count);
 }
@@ -1570,29 +1867,57 @@ void AbstractInterpreter::popExcVars(){
 }
 
 void AbstractInterpreter::emitPgcProbes(py_opindex curByte, size_t stackSize) {
+    if (mProfile == nullptr || mProfile->getSlot(curByte, 0) == nullptr)
+        return;
     vector<Local> stack;
     stack.resize(stackSize);
-    Local hasProbedFlag = m_comp->emit_define_local(LK_Bool);
-    auto hasProbed = m_comp->emit_define_label();
 
-    m_comp->emit_load_local(hasProbedFlag);
-    m_comp->emit_branch(BranchTrue, hasProbed);
-    
+    // The probes are inline stores into the profile, so every execution is counted
     for (size_t i = 0; i < stackSize; i++){
         stack[i] = m_comp->emit_define_local(stackEntryKindAsLocalKind(m_stack.peek(i)));
         m_comp->emit_store_local(stack[i]);
         if (m_stack.peek(i) == STACK_KIND_OBJECT) {
-            m_comp->emit_pgc_profile_capture(stack[i], curByte, i);
+            m_comp->emit_pgc_profile_capture(stack[i], mProfile->getSlot(curByte, i));
         }
     }
-    m_comp->emit_int(1);
-    m_comp->emit_store_local(hasProbedFlag);
     // Recover the stack in the right order
     for (size_t i = stackSize; i > 0; --i){
         m_comp->emit_load_and_free_local(stack[i-1]);
     }
+}
 
-    m_comp->emit_mark_label(hasProbed);
+bool canOverflow(py_opcode opcode){
+    switch(opcode){ // NOLINT(hicpp-multiway-paths-covered)
+        case BINARY_ADD:
+        case INPLACE_ADD:
+        case BINARY_SUBTRACT:
+        case INPLACE_SUBTRACT:
+        case BINARY_MULTIPLY:
+        case INPLACE_MULTIPLY:
+        case BINARY_LSHIFT:
+        case INPLACE_LSHIFT:
+        case BINARY_RSHIFT:
+        case INPLACE_RSHIFT:
+        case UNARY_NEGATIVE:
+            return true;
+    }
+    return false;
+}
+
+// Is this a binary operation with an overflow checked int64 implementation
+bool isUnboxedIntOperation(py_opcode opcode, AbstractValueKind left, AbstractValueKind right){
+    if ((left != AVK_Integer && left != AVK_Bool) || (right != AVK_Integer && right != AVK_Bool))
+        return false;
+    switch(opcode){ // NOLINT(hicpp-multiway-paths-covered)
+        case BINARY_AND:
+        case INPLACE_AND:
+        case BINARY_OR:
+        case INPLACE_OR:
+        case BINARY_XOR:
+        case INPLACE_XOR:
+            return true;
+    }
+    return canOverflow(opcode) && opcode != UNARY_NEGATIVE;
 }
 
 bool canReturnInfinity(py_opcode opcode){
@@ -1641,12 +1966,80 @@ void AbstractInterpreter::yieldValue(py_opindex index, size_t stackSize, Instruc
     m_comp->emit_shrink_stacktop_local(stackSize);
 }
 
+void AbstractInterpreter::osrJumps(){
+    for (auto &pair: m_osrEntries){
+        m_comp->emit_lasti();
+        m_comp->emit_int(pair.first);
+        m_comp->emit_branch(BranchEqual, pair.second);
+    }
+}
+
+// Entry point for an interpreted frame moving into the loop at index (on-stack replacement).
+// The unboxed locals are checked and unboxed from the frame, then the value stack is loaded
+// the same way as a generator being resumed. If the frame doesn't match what the loop was
+// compiled for, f_lasti is left pointing at the loop header and the interpreter carries on.
+// Returns false if the loop can never be entered, e.g. it has unboxed values on the stack.
+bool AbstractInterpreter::osrEntry(py_opindex index, Label entry, Label declined, InstructionGraph* graph) {
+    m_comp->emit_mark_label(entry);
+
+    auto stack = m_osrStacks.find(index);
+    bool canEnter = stack != m_osrStacks.end();
+    for (size_t i = 0; canEnter && i < stack->second.size(); i++){
+        if (stack->second.peek(i) != STACK_KIND_OBJECT)
+            canEnter = false;
+    }
+    Label guardFailed = m_comp->emit_define_label();
+    if (canEnter) {
+        Local failFlag = m_comp->emit_define_local(LK_Int);
+        m_comp->emit_int(0);
+        m_comp->emit_store_local(failFlag);
+        for (auto &loc: graph->getUnboxedFastLocals()) {
+            // Unbound locals are assigned in the loop before they're used
+            Label unbound = m_comp->emit_define_label();
+            Local value = m_comp->emit_define_local(LK_Pointer);
+            m_comp->emit_load_fast(loc.first);
+            m_comp->emit_store_local(value);
+            m_comp->emit_load_local(value);
+            m_comp->emit_branch(BranchFalse, unbound);
+            m_comp->emit_unbox_guard(value, loc.second, guardFailed);
+            m_comp->emit_load_local(value);
+            m_comp->emit_dup();
+            m_comp->emit_incref(); // the frame keeps its reference
+            m_comp->emit_unbox(loc.second, false, failFlag);
+            m_comp->emit_store_local(m_fastNativeLocals[loc.first]);
+            m_comp->emit_mark_label(unbound);
+            m_comp->emit_free_local(value);
+        }
+        m_comp->emit_load_and_free_local(failFlag);
+        m_comp->emit_branch(BranchTrue, guardFailed);
+
+        size_t stackSize = stack->second.size();
+        for (size_t i = stackSize; i > 0 ; --i) {
+            m_comp->emit_load_from_frame_value_stack(i);
+        }
+        m_comp->emit_shrink_stacktop_local(stackSize);
+        m_comp->emit_branch(BranchAlways, m_offsetLabels[index]);
+    }
+
+    m_comp->emit_mark_label(guardFailed);
+    m_comp->emit_lasti_update(index - SIZEOF_CODEUNIT);
+    m_comp->emit_branch(BranchAlways, declined);
+    return canEnter;
+}
+
 AbstactInterpreterCompileResult AbstractInterpreter::compileWorker(PgcStatus pgc_status, InstructionGraph* graph) {
     Label ok;
     m_comp->emit_lasti_init();
     m_comp->emit_push_frame();
     m_comp->emit_init_stacktop_local();
 
+    // A resumed generator jumps to its yield point, so the timer starts before that.
+    // Each resumption of a generator is timed and counted as a call.
+    if (mTimingEnabled) {
+        mTimingStart = m_comp->emit_define_local(LK_Int);
+        m_comp->emit_timing_entry(mTimingStart);
+    }
+
     if (mCode->co_flags & CO_GENERATOR){
         yieldJumps();
     }
@@ -1690,6 +2083,23 @@ AbstactInterpreterCompileResult AbstractInterpreter::compileWorker(PgcStatus pgc
     // Push root block to stack, has no end offset
     m_blockStack.push_back(BlockInfo(-1, NOP, rootHandler));
 
+    // Interpreted frames can be moved into the targets of backward jumps, this has
+    // the same frame requirements as deoptimizing back into the interpreter.
+    if (PyJit_Settings().osr && mCanDeoptimize) {
+        for (py_opindex i = 0; i < mSize; i += SIZEOF_CODEUNIT) {
+            auto op = graph->operator[](i);
+            switch (op.opcode) {
+                case JUMP_ABSOLUTE:
+                case POP_JUMP_IF_FALSE:
+                case POP_JUMP_IF_TRUE:
+                    if ((py_opindex)op.oparg <= i && m_osrEntries.find(op.oparg) == m_osrEntries.end())
+                        m_osrEntries[op.oparg] = m_comp->emit_define_label();
+                    break;
+            }
+        }
+        osrJumps();
+    }
+
     // Loop through all opcodes in this frame
     for (py_opindex curByte = 0; curByte < mSize; curByte += SIZEOF_CODEUNIT) {
         assert(curByte % SIZEOF_CODEUNIT == 0);
@@ -1706,6 +2116,8 @@ AbstactInterpreterCompileResult AbstractInterpreter::compileWorker(PgcStatus pgc
 
         markOffsetLabel(curByte);
         m_comp->mark_sequence_point(curByte);
+        if (mOpcodeCountsEnabled)
+            m_comp->emit_count_opcode(curByte);
 
         // See if current index is part of offset stack, used for jump operations
         auto curStackDepth = m_offsetStack.find(curByte);
@@ -1713,6 +2125,9 @@ AbstactInterpreterCompileResult AbstractInterpreter::compileWorker(PgcStatus pgc
             // Recover stack from jump
             m_stack = curStackDepth->second;
         }
+        if (m_osrEntries.find(curByte) != m_osrEntries.end()) {
+            m_osrStacks[curByte] = m_stack;
+        }
         if (m_exceptionHandler.IsHandlerAtOffset(curByte)){
             ExceptionHandler* handler = m_exceptionHandler.HandlerAtOffset(curByte);
             m_comp->emit_mark_label(handler->ErrorTarget);
@@ -1731,12 +2146,12 @@ AbstactInterpreterCompileResult AbstractInterpreter::compileWorker(PgcStatus pgc
         bool skipEffect = false;
 
         auto edges = graph->getEdges(curByte);
-        if (g_pyjionSettings.pgc && pgcProbeRequired(curByte, pgc_status) && !(CAN_UNBOX() && op.escape)){
+        if (PyJit_Settings().pgc && pgcProbeRequired(curByte, pgc_status) && !(CAN_UNBOX() && op.escape)){
             emitPgcProbes(curByte, pgcProbeSize(curByte));
         }
 
         if (CAN_UNBOX()) {
-            escapeEdges(edges, curByte);
+            escapeEdges(edges, curByte, graph);
         }
 
         switch (byte) {
@@ -1775,7 +2190,7 @@ AbstactInterpreterCompileResult AbstractInterpreter::compileWorker(PgcStatus pgc
                     if (CAN_UNBOX() && op.escape) {
                         m_comp->emit_compare_unboxed(oparg, stackInfo.second(), stackInfo.top());
                         decStack(2);
-                        incStack(1, STACK_KIND_VALUE_INT);
+                        incStack(1, STACK_KIND_VALUE_BOOL);
                     } else if (OPT_ENABLED(internRichCompare)){
                         m_comp->emit_compare_known_object(oparg, stackInfo.second(), stackInfo.top());
                         decStack(2);
@@ -1805,6 +2220,10 @@ AbstactInterpreterCompileResult AbstractInterpreter::compileWorker(PgcStatus pgc
                 intErrorCheck("failed to setup annotations", curByte);
                 break;
             case JUMP_ABSOLUTE:
+                if (PyJit_Settings().pgc && pgc_status == PgcStatus::Uncompiled && oparg <= curByte) {
+                    // Loop back-edge in the profiling tier, feeds the hotness of the function
+                    m_comp->emit_count_backedge();
+                }
                 jumpAbsolute(oparg, opcodeIndex); break;
             case JUMP_FORWARD:
                 jumpAbsolute(oparg + curByte + SIZEOF_CODEUNIT, opcodeIndex); break;
@@ -1956,6 +2375,10 @@ AbstactInterpreterCompileResult AbstractInterpreter::compileWorker(PgcStatus pgc
                 break;
             case CALL_FUNCTION:
             {
+                if (CAN_UNBOX() && op.escape) {
+                    unboxedMathCall(byte, stackInfo.second(), stackInfo.top().Value->kind(), curByte, graph);
+                    break;
+                }
                 if (OPT_ENABLED(functionCalls) &&
                     stackInfo.size() >= (oparg + 1) &&
                     stackInfo.nth(oparg + 1).hasSource() &&
@@ -2026,18 +2449,30 @@ AbstactInterpreterCompileResult AbstractInterpreter::compileWorker(PgcStatus pgc
                 incStack();
                 break;
             case UNARY_NEGATIVE:
+                if (CAN_UNBOX() && op.escape && !stackInfo.empty()) {
+                    unboxedOperation(byte, {stackInfo.top().Value->kind()}, curByte, graph);
+                    break;
+                }
                 m_comp->emit_unary_negative();
                 decStack();
                 errorCheck("unary negative failed", opcodeIndex);
                 incStack();
                 break;
             case UNARY_NOT:
+                if (CAN_UNBOX() && op.escape && !stackInfo.empty()) {
+                    unboxedOperation(byte, {stackInfo.top().Value->kind()}, curByte, graph);
+                    break;
+                }
                 m_comp->emit_unary_not();
                 decStack(1);
                 errorCheck("unary not failed", opcodeIndex);
                 incStack();
                 break;
             case UNARY_INVERT:
+                if (CAN_UNBOX() && op.escape && !stackInfo.empty()) {
+                    unboxedOperation(byte, {stackInfo.top().Value->kind()}, curByte, graph);
+                    break;
+                }
                 m_comp->emit_unary_invert();
                 decStack(1);
                 errorCheck("unary invert failed", curByte);
@@ -2083,7 +2518,10 @@ AbstactInterpreterCompileResult AbstractInterpreter::compileWorker(PgcStatus pgc
             case INPLACE_XOR:
             case INPLACE_OR:
                 if (OPT_ENABLED(typeSlotLookups) && stackInfo.size() >= 2) {
-                    if (CAN_UNBOX() && op.escape) {
+                    if (CAN_UNBOX() && op.escape &&
+                        isUnboxedIntOperation(byte, stackInfo.second().Value->kind(), stackInfo.top().Value->kind())) {
+                        unboxedOperation(byte, {stackInfo.top().Value->kind(), stackInfo.second().Value->kind()}, curByte, graph);
+                    } else if (CAN_UNBOX() && op.escape) {
                         auto retKind = m_comp->emit_unboxed_binary_object(byte, stackInfo.second(), stackInfo.top());
                         decStack(2);
                         if (canReturnInfinity(byte)) {
@@ -2142,7 +2580,10 @@ AbstactInterpreterCompileResult AbstractInterpreter::compileWorker(PgcStatus pgc
                 auto postIterStack = ValueStack(m_stack);
                 postIterStack.dec(1); // pop iter when stopiter happens
                 py_opindex jumpTo = curByte + oparg + SIZEOF_CODEUNIT;
-                if (OPT_ENABLED(inlineIterators) && !stackInfo.empty()){
+                // The range fast path deoptimizes when the iterator is something else, so it needs a frame that can
+                if (mCanDeoptimize && m_rangeIterators.find(curByte) != m_rangeIterators.end()) {
+                    forIterRange(jumpTo, curByte, graph, CAN_UNBOX() && op.escape);
+                } else if (OPT_ENABLED(inlineIterators) && !stackInfo.empty()){
                     auto iterator = stackInfo.top();
                     forIter(
                             jumpTo,
@@ -2464,6 +2905,10 @@ AbstactInterpreterCompileResult AbstractInterpreter::compileWorker(PgcStatus pgc
             }
             case CALL_METHOD:
             {
+                if (CAN_UNBOX() && op.escape) {
+                    unboxedMathCall(byte, stackInfo.second(), stackInfo.top().Value->kind(), curByte, graph);
+                    break;
+                }
                 if (!m_comp->emit_method_call(oparg)) {
                     buildTuple(oparg);
                     m_comp->emit_method_call_n();
@@ -2499,6 +2944,20 @@ AbstactInterpreterCompileResult AbstractInterpreter::compileWorker(PgcStatus pgc
 
     // label branch for error handling when we have no EH handlers, (return NULL).
     m_comp->emit_branch(BranchAlways, rootHandlerLabel);
+
+    unordered_set<py_opindex> osrEntries;
+    if (!m_osrEntries.empty()) {
+        auto osrDeclined = m_comp->emit_define_label();
+        for (auto &pair: m_osrEntries){
+            if (osrEntry(pair.first, pair.second, osrDeclined, graph))
+                osrEntries.insert(pair.first);
+        }
+        // Hand the frame back untouched, PyJit_ExecuteOsrFrame sees f_stacktop is still null
+        m_comp->emit_mark_label(osrDeclined);
+        m_comp->emit_null();
+        m_comp->emit_store_local(m_retValue);
+        m_comp->emit_branch(BranchAlways, m_retLabel);
+    }
     m_comp->emit_mark_label(rootHandlerLabel);
 
     m_comp->emit_null();
@@ -2519,14 +2978,19 @@ AbstactInterpreterCompileResult AbstractInterpreter::compileWorker(PgcStatus pgc
     if (mProfilingEnabled) {
         m_comp->emit_profile_frame_exit();
     }
+    if (mTimingEnabled) {
+        m_comp->emit_timing_exit(mTimingStart);
+    }
 
     m_comp->emit_pop_frame();
 
     m_comp->emit_ret();
     auto code = m_comp->emit_compile();
-    if (code != nullptr)
-        return {code, Success};
-    else
+    if (code != nullptr) {
+        AbstactInterpreterCompileResult result = {code, Success};
+        result.osrEntries = osrEntries;
+        return result;
+    } else
         return {nullptr, CompilationJitFailure};
 }
 
@@ -2552,20 +3016,33 @@ InstructionGraph* AbstractInterpreter::buildInstructionGraph() {
     for (const auto &state: mStartStates){
         stacks[state.first] = &state.second.mStack;
     }
-    auto* graph = new InstructionGraph(mCode, stacks);
+    auto* graph = new InstructionGraph(mCode, stacks, mCanDeoptimize);
     updateIntermediateSources();
     return graph;
 }
 
+static uint64_t elapsedNanoseconds(chrono::steady_clock::time_point start) {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
 AbstactInterpreterCompileResult AbstractInterpreter::compile(PyObject* builtins, PyObject* globals, PyjionCodeProfile* profile, PgcStatus pgc_status) {
+    AbstractInterpreterCompileTimings timings;
+    auto start = chrono::steady_clock::now();
     AbstractInterpreterResult interpreted = interpret(builtins, globals, profile, pgc_status);
+    timings.interpret = elapsedNanoseconds(start);
     if (interpreted != Success) {
-        return {nullptr, interpreted};
+        AbstactInterpreterCompileResult result = {nullptr, interpreted};
+        result.timings = timings;
+        return result;
     }
+    start = chrono::steady_clock::now();
     try {
         auto instructionGraph = buildInstructionGraph();
         auto result = compileWorker(pgc_status, instructionGraph);
-        if (g_pyjionSettings.graph) {
+        timings.compileMethod = m_comp->get_compile_method_time();
+        timings.compileWorker = elapsedNanoseconds(start) - timings.compileMethod;
+        result.timings = timings;
+        if (PyJit_Settings().graph) {
             result.instructionGraph = instructionGraph->makeGraph(PyUnicode_AsUTF8(mCode->co_name));
 
 #ifdef DUMP_INSTRUCTION_GRAPHS
@@ -2579,7 +3056,10 @@ AbstactInterpreterCompileResult AbstractInterpreter::compile(PyObject* builtins,
 #ifdef DEBUG
         printf("Error whilst compiling : %s\n", e.what());
 #endif
-        return {nullptr, CompilationException};
+        AbstactInterpreterCompileResult result = {nullptr, CompilationException};
+        timings.compileWorker = elapsedNanoseconds(start);
+        result.timings = timings;
+        return result;
     }
 }
 
@@ -2637,7 +3117,7 @@ void AbstractInterpreter::loadUnboxedConst(py_oparg constIndex, py_opindex opcod
                 m_comp->emit_int(1);
             else
                 m_comp->emit_int(0);
-            incStack(1, STACK_KIND_VALUE_INT);
+            incStack(1, STACK_KIND_VALUE_BOOL);
             break;
     }
 }
@@ -2719,6 +3199,38 @@ void AbstractInterpreter::forIter(py_opindex loopIndex) {
     forIter(loopIndex, nullptr);
 }
 
+// Steps a range iterator natively, pushing the value as an int64 when it's unboxed. CPython only makes a
+// range iterator when start, stop and step fit in a C long, if the iterator turns out to be anything else
+// (range() was shadowed after compiling, or it's a longrange_iterator) the frame deoptimizes at FOR_ITER.
+void AbstractInterpreter::forIterRange(py_opindex loopIndex, py_opindex curByte, InstructionGraph* graph, bool unboxed) {
+    auto exhausted = m_comp->emit_define_label();
+    auto notRange = m_comp->emit_define_label();
+    auto next = m_comp->emit_define_label();
+
+    // ..., iter -> ..., iter, int64 next
+    m_comp->emit_for_next_unboxed(exhausted, notRange);
+    if (!unboxed) {
+        m_comp->emit_box(AVK_Integer);
+        errorCheck("failed to fetch iter", curByte);
+    }
+    m_comp->emit_branch(BranchAlways, next);
+
+    /* Start deoptimize branch */
+    m_comp->emit_mark_label(notRange);
+    deoptimize({}, {}, curByte, graph);
+    /* End deoptimize branch */
+
+    /* Start stop iter branch */
+    m_comp->emit_mark_label(exhausted);
+    m_comp->emit_pop_top(); // POP and DECREF iter
+    m_comp->emit_pyerr_clear();
+    m_comp->emit_branch(BranchAlways, getOffsetLabel(loopIndex)); // Goto: post-stack
+    /* End stop iter branch */
+
+    m_comp->emit_mark_label(next);
+    incStack(1, unboxed ? STACK_KIND_VALUE_INT : STACK_KIND_OBJECT);
+}
+
 void AbstractInterpreter::loadFast(py_oparg local, py_opindex opcodeIndex) {
     bool checkUnbound = m_assignmentState.find(local) == m_assignmentState.end() || !m_assignmentState.find(local)->second;
     loadFastWorker(local, checkUnbound, opcodeIndex);
@@ -2930,4 +3442,20 @@ void AbstractInterpreter::enableProfiling() {
 
 void AbstractInterpreter::disableProfiling() {
     mProfilingEnabled = false;
+}
+
+void AbstractInterpreter::enableTiming() {
+    mTimingEnabled = true;
+}
+
+void AbstractInterpreter::disableTiming() {
+    mTimingEnabled = false;
+}
+
+void AbstractInterpreter::enableOpcodeCounts() {
+    mOpcodeCountsEnabled = true;
+}
+
+void AbstractInterpreter::disableOpcodeCounts() {
+    mOpcodeCountsEnabled = false;
 }
\ No newline at end of file
@@ -219,6 +219,18 @@ enum ComprehensionType {
     COMP_SET
 };
 
+// How many types a profiled stack position has seen
+enum PgcSiteShape {
+    PgcUnseen,
+    PgcMonomorphic,
+    PgcPolymorphic, // More than one type, all counted in the histogram
+    PgcMegamorphic, // More types than the histogram holds
+};
+
+// Share of the hits the most common type needs at a polymorphic site to be specialized on,
+// the guards deoptimize for the rest.
+#define PGC_DOMINANT_RATIO 0.9
+
 enum AbstractInterpreterResult {
     NoResult = 0,
     Success = 1,
@@ -226,6 +238,7 @@ enum AbstractInterpreterResult {
     // Failure codes
     CompilationException = 10,  // Exception within Pyjion
     CompilationJitFailure = 11, // JIT failed
+    CompilationTimeBudget = 12, // Predicted to take longer than the compile time budget
 
     // Incompat codes.
     IncompatibleCompilerFlags  = 100,
@@ -241,6 +254,8 @@ struct AbstactInterpreterCompileResult {
     JittedCode* compiledCode = nullptr;
     AbstractInterpreterResult result = NoResult;
     PyObject* instructionGraph = nullptr;
+    unordered_set<py_opindex> osrEntries;
+    AbstractInterpreterCompileTimings timings;
 };
 
 class StackImbalanceException: public std::exception {
@@ -270,6 +285,10 @@ class AbstractInterpreter {
     Local mExcVarsOnStack; // Counter of the number of exception variables on the stack.
     bool mTracingEnabled;
     bool mProfilingEnabled;
+    bool mTimingEnabled;
+    bool mOpcodeCountsEnabled;
+    Local mTimingStart;
+    bool mCanDeoptimize = false;
     Local mTracingInstrLowerBound;
     Local mTracingInstrUpperBound;
     Local mTracingLastInstr;
@@ -315,11 +334,17 @@ class AbstractInterpreter {
     //  This was so we don't need to have decref/frees spread all over the code
     vector<vector<Label>> m_raiseAndFree;
     unordered_set<py_opindex> m_jumpsTo;
+    // FOR_ITER instructions whose values are treated as ints from a range iterator
+    unordered_set<py_opindex> m_rangeIterators;
     Label m_retLabel;
     Local m_retValue;
     unordered_map<py_opindex, bool> m_assignmentState;
     unordered_map<py_opindex, bool> m_unboxableProducers;
     unordered_map<py_opindex, Label> m_yieldOffsets;
+    PyjionCodeProfile* mProfile = nullptr;
+    // Loop headers an interpreted frame can be moved into (OSR), with the value stack on entry
+    unordered_map<py_opindex, Label> m_osrEntries;
+    unordered_map<py_opindex, ValueStack> m_osrStacks;
 
 #pragma warning (default:4251)
 
@@ -341,10 +366,16 @@ public:
     AbstractValue* getReturnInfo();
     bool pgcProbeRequired(py_opindex byteCodeIndex, PgcStatus status);
     short pgcProbeSize(py_opindex byteCodeIndex);
+    static PgcSiteShape pgcSiteShape(PyjionCodeProfile* profile, py_opindex byteCodeIndex, size_t stackPosition);
+    static PyTypeObject* pgcSpecializedType(PyjionCodeProfile* profile, py_opindex byteCodeIndex, size_t stackPosition);
     void enableTracing();
     void disableTracing();
     void enableProfiling();
     void disableProfiling();
+    void enableTiming();
+    void disableTiming();
+    void enableOpcodeCounts();
+    void disableOpcodeCounts();
     InstructionGraph* buildInstructionGraph();
 private:
     AbstractValue* toAbstract(PyObject* obj);
@@ -376,6 +407,9 @@ private:
     Label getOffsetLabel(py_opindex jumpTo);
     void forIter(py_opindex loopIndex);
     void forIter(py_opindex loopIndex, AbstractValueWithSources* iterator);
+    void forIterRange(py_opindex loopIndex, py_opindex curByte, InstructionGraph* graph, bool unboxed);
+    void unboxedOperation(py_opcode opcode, const vector<AbstractValueKind>& kinds, py_opindex curByte, InstructionGraph* graph);
+    void unboxedMathCall(py_opcode opcode, AbstractValueWithSources callee, AbstractValueKind argKind, py_opindex curByte, InstructionGraph* graph);
 
     void yieldValue(py_opindex idx, size_t stackSize, InstructionGraph* graph);
 
@@ -432,12 +466,20 @@ private:
     void decExcVars(size_t count);
     void incExcVars(size_t count);
     void updateIntermediateSources();
-    void escapeEdges(const vector<Edge>& edges, py_opindex curByte);
+    void escapeEdges(const vector<Edge>& edges, py_opindex curByte, InstructionGraph* graph);
+    bool canDeoptimize(const vector<Edge>& edges);
+    bool canDeoptimizeFrame();
+    void guardEdges(const vector<Edge>& edges, py_opindex curByte, InstructionGraph* graph);
+    void deoptimize(const vector<Edge>& edges, const vector<Local>& values, py_opindex curByte, InstructionGraph* graph);
     void dumpEscapedLocalsToFrame(const unordered_map<py_oparg, AbstractValueKind>& locals, py_opindex at);
     void loadEscapedLocalsFromFrame(const unordered_map<py_oparg, AbstractValueKind>& locals, py_opindex at);
     void yieldJumps();
+    void osrJumps();
+    bool osrEntry(py_opindex index, Label entry, Label declined, InstructionGraph* graph);
 };
 bool canReturnInfinity(py_opcode opcode);
+bool canOverflow(py_opcode opcode);
+bool isUnboxedIntOperation(py_opcode opcode, AbstractValueKind left, AbstractValueKind right);
 
 // TODO : Fetch the range of interned integers from the interpreter state
 #define IS_SMALL_INT(ival) (-5 <= (ival) && (ival) < 257)
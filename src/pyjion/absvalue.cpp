@@ -53,6 +53,7 @@ MethodValue Method;
 CodeObjectValue CodeObject;
 EnumeratorValue Enumerator;
 FileValue File;
+RangeIteratorValue RangeIterator;
 
 
 AbstractSource::AbstractSource(py_opindex producer) {
@@ -1172,6 +1173,19 @@ const char *EnumeratorValue::describe() {
     return "enumerator";
 }
 
+/* Range Value, the object returned by range() */
+AbstractValueKind RangeIteratorValue::kind() {
+    return AVK_RangeIterator;
+}
+
+AbstractValue *RangeIteratorValue::unary(AbstractSource *selfSources, int op) {
+    return AbstractValue::unary(selfSources, op);
+}
+
+const char *RangeIteratorValue::describe() {
+    return "range";
+}
+
 /* File Value */
 AbstractValueKind FileValue::kind() {
     return AVK_File;
@@ -1211,6 +1225,70 @@ AbstractValueKind knownFunctionReturnType(AbstractValueWithSources source){
     return AVK_Any;
 }
 
+// Is this the math module, and not something else called math
+bool isMathModule(PyObject* value){
+    if (value == nullptr || !PyModule_Check(value))
+        return false;
+    auto def = PyModule_GetDef(value);
+    return def != nullptr && strcmp(def->m_name, "math") == 0;
+}
+
+// Which MathFunction this object is, if it's one of the builtins of the math module
+MathFunction mathFunction(PyObject* value){
+    if (value == nullptr || !PyCFunction_Check(value) || !isMathModule(PyCFunction_GET_SELF(value)))
+        return MathNone;
+    auto name = ((PyCFunctionObject*)value)->m_ml->ml_name;
+    for (auto const &f: mathFunctions){
+        if (strcmp(name, f.first) == 0)
+            return f.second;
+    }
+    return MathNone;
+}
+
+// The math function being called, from `math.sqrt(x)` or from `sqrt(x)` after `from math import sqrt`
+MathFunction knownMathFunction(AbstractValueWithSources callee){
+    auto object = knownMathFunctionObject(callee);
+    return object == nullptr ? MathNone : mathFunction(object);
+}
+
+// The function object the callee was at compile time, which is guarded on at runtime
+PyObject* knownMathFunctionObject(AbstractValueWithSources callee){
+    if (!callee.hasSource())
+        return nullptr;
+    auto methodSource = dynamic_cast<MathFunctionSource*>(callee.Sources);
+    if (methodSource != nullptr)
+        return methodSource->getValue();
+    auto globalSource = dynamic_cast<GlobalSource*>(callee.Sources);
+    if (globalSource != nullptr && mathFunction(globalSource->getValue()) != MathNone)
+        return globalSource->getValue();
+    return nullptr;
+}
+
+// The result of calling a math function with an argument of this kind, floor() returns whatever __floor__ does
+AbstractValueKind mathFunctionReturnType(MathFunction function, AbstractValueKind argument){
+    switch (function){
+        case MathNone:
+            return AVK_Any;
+        case MathFloor:
+            return argument == AVK_Float || argument == AVK_Integer ? AVK_Integer : AVK_Any;
+        default:
+            return AVK_Float;
+    }
+}
+
+// The kind of the object GET_ITER made this iterator from, or AVK_Any if unknown
+AbstractValueKind iterableKind(AbstractValueWithSources iterator){
+    if (!iterator.hasSource())
+        return AVK_Any;
+    auto source = dynamic_cast<IteratorSource*>(iterator.Sources);
+    return source == nullptr ? AVK_Any : source->kind();
+}
+
+// Is this the iterator GET_ITER made from a range() object
+bool isRangeIterator(AbstractValueWithSources iterator){
+    return iterableKind(iterator) == AVK_RangeIterator;
+}
+
 AbstractValue* avkToAbstractValue(AbstractValueKind kind){
     switch (kind) {
         case AVK_Any:
@@ -1259,6 +1337,8 @@ AbstractValue* avkToAbstractValue(AbstractValueKind kind){
             return &Type;
         case AVK_Module:
             return &Module;
+        case AVK_RangeIterator:
+            return &RangeIterator;
 
         default:
             return &Any;
@@ -1329,6 +1409,9 @@ AbstractValueKind GetAbstractType(PyTypeObject* type, PyObject* value) {
     else if (type == &PyCode_Type) {
         return AVK_Code;
     }
+    else if (type == &PyRange_Type) {
+        return AVK_RangeIterator;
+    }
     return AVK_Any;
 }
 
@@ -1356,6 +1439,7 @@ PyTypeObject* GetPyType(AbstractValueKind type) {
         case AVK_Bytearray: return &PyByteArray_Type;
         case AVK_Module: return &PyModule_Type;
         case AVK_Method: return &PyMethod_Type;
+        case AVK_RangeIterator: return &PyRange_Type;
         // TODO : resolve missing AVK_File and AVK_Iterable
         default:
         #ifdef DEBUG
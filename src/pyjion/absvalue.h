@@ -69,6 +69,16 @@ enum AbstractValueKind {
     AVK_RangeIterator
 };
 
+// Functions of the math module which are compiled to native calls on unboxed values
+enum MathFunction {
+    MathNone,
+    MathSqrt,
+    MathSin,
+    MathCos,
+    MathExp,
+    MathFloor
+};
+
 static bool isKnownType(AbstractValueKind kind) {
     switch (kind) {
         case AVK_Any:
@@ -203,6 +213,10 @@ public:
     const char* getName() {
         return _name;
     }
+
+    PyObject* getValue() {
+        return _value;
+    }
 };
 
 class BuiltinSource : public AbstractSource {
@@ -283,6 +297,25 @@ public:
     }
 };
 
+// A method loaded from the math module which was one of the functions in MathFunction at compile time
+class MathFunctionSource : public MethodSource {
+    MathFunction _function;
+    PyObject* _value;
+public:
+    explicit MathFunctionSource(const char* name, MathFunction function, PyObject* value, py_opindex producer) : MethodSource(name, producer){
+        _function = function;
+        _value = value;
+    }
+
+    MathFunction function() {
+        return _function;
+    }
+
+    PyObject* getValue() {
+        return _value;
+    }
+};
+
 class AbstractValue {
 public:
     virtual AbstractValue* unary(AbstractSource* selfSources, int op);
@@ -568,6 +601,12 @@ class FileValue : public AbstractValue {
     const char* describe() override;
 };
 
+class RangeIteratorValue : public AbstractValue {
+    AbstractValueKind kind() override;
+    AbstractValue* unary(AbstractSource* selfSources, int op) override;
+    const char* describe() override;
+};
+
 class VolatileValue: public AbstractValue{
     PyTypeObject* _type;
     PyObject* _object;
@@ -613,6 +652,13 @@ public:
 };
 
 AbstractValueKind knownFunctionReturnType(AbstractValueWithSources source);
+AbstractValueKind iterableKind(AbstractValueWithSources iterator);
+MathFunction mathFunction(PyObject* value);
+bool isMathModule(PyObject* value);
+MathFunction knownMathFunction(AbstractValueWithSources callee);
+PyObject* knownMathFunctionObject(AbstractValueWithSources callee);
+AbstractValueKind mathFunctionReturnType(MathFunction function, AbstractValueKind argument);
+bool isRangeIterator(AbstractValueWithSources iterator);
 
 extern UndefinedValue Undefined;
 extern AnyValue Any;
@@ -641,6 +687,7 @@ extern MethodValue Method;
 extern CodeObjectValue CodeObject;
 extern EnumeratorValue Enumerator;
 extern FileValue File;
+extern RangeIteratorValue RangeIterator;
 
 AbstractValue* avkToAbstractValue(AbstractValueKind);
 AbstractValueKind GetAbstractType(PyTypeObject* type, PyObject* value = nullptr);
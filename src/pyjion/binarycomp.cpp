@@ -37,7 +37,6 @@ typedef void(__cdecl* JITSTARTUP)(ICorJitHost*);
 #include "pyjit.h"
 
 using namespace std;
-extern BaseModule g_module;
 
 void PythonCompiler::emit_binary_object(uint16_t opcode) {
     switch (opcode) {
@@ -232,18 +231,18 @@ void PythonCompiler::emit_known_binary_op(AbstractValueWithSources &left, Abstra
     int left_func_token = -1, right_func_token = -1;
 
     if (binaryfunc_left) {
-        left_func_token = g_module.AddMethod(CORINFO_TYPE_NATIVEINT,
-                                             vector<Parameter>{
-                                                     Parameter(CORINFO_TYPE_NATIVEINT),
-                                                     Parameter(CORINFO_TYPE_NATIVEINT)},
-                                             (void *) binaryfunc_left);
+        left_func_token = m_methodModule->AddMethod(CORINFO_TYPE_NATIVEINT,
+                                                    vector<Parameter>{
+                                                            Parameter(CORINFO_TYPE_NATIVEINT),
+                                                            Parameter(CORINFO_TYPE_NATIVEINT)},
+                                                    (void *) binaryfunc_left);
     }
     if (binaryfunc_right) {
-        right_func_token = g_module.AddMethod(CORINFO_TYPE_NATIVEINT,
-                                              vector<Parameter>{
-                                                      Parameter(CORINFO_TYPE_NATIVEINT),
-                                                      Parameter(CORINFO_TYPE_NATIVEINT)},
-                                              (void *) binaryfunc_right);
+        right_func_token = m_methodModule->AddMethod(CORINFO_TYPE_NATIVEINT,
+                                                     vector<Parameter>{
+                                                             Parameter(CORINFO_TYPE_NATIVEINT),
+                                                             Parameter(CORINFO_TYPE_NATIVEINT)},
+                                                     (void *) binaryfunc_right);
     }
 
     if (binaryfunc_left != nullptr){
@@ -347,18 +346,18 @@ void PythonCompiler::emit_known_binary_op_multiply(AbstractValueWithSources &lef
     int left_func_token = -1, right_func_token = -1;
 
     if (binaryfunc_left) {
-        left_func_token = g_module.AddMethod(CORINFO_TYPE_NATIVEINT,
-                                             vector<Parameter>{
-                                                     Parameter(CORINFO_TYPE_NATIVEINT),
-                                                     Parameter(CORINFO_TYPE_NATIVEINT)},
-                                             (void *) binaryfunc_left);
+        left_func_token = m_methodModule->AddMethod(CORINFO_TYPE_NATIVEINT,
+                                                    vector<Parameter>{
+                                                            Parameter(CORINFO_TYPE_NATIVEINT),
+                                                            Parameter(CORINFO_TYPE_NATIVEINT)},
+                                                    (void *) binaryfunc_left);
     }
     if (binaryfunc_right) {
-        right_func_token = g_module.AddMethod(CORINFO_TYPE_NATIVEINT,
-                                              vector<Parameter>{
-                                                      Parameter(CORINFO_TYPE_NATIVEINT),
-                                                      Parameter(CORINFO_TYPE_NATIVEINT)},
-                                              (void *) binaryfunc_right);
+        right_func_token = m_methodModule->AddMethod(CORINFO_TYPE_NATIVEINT,
+                                                     vector<Parameter>{
+                                                             Parameter(CORINFO_TYPE_NATIVEINT),
+                                                             Parameter(CORINFO_TYPE_NATIVEINT)},
+                                                     (void *) binaryfunc_right);
     }
 
     if (binaryfunc_left != nullptr){
@@ -493,18 +492,18 @@ void PythonCompiler::emit_known_binary_op_add(AbstractValueWithSources &left, Ab
     int left_func_token = -1, right_func_token = -1;
 
     if (binaryfunc_left) {
-        left_func_token = g_module.AddMethod(CORINFO_TYPE_NATIVEINT,
-                                             vector<Parameter>{
-                                                     Parameter(CORINFO_TYPE_NATIVEINT),
-                                                     Parameter(CORINFO_TYPE_NATIVEINT)},
-                                             (void *) binaryfunc_left);
+        left_func_token = m_methodModule->AddMethod(CORINFO_TYPE_NATIVEINT,
+                                                    vector<Parameter>{
+                                                            Parameter(CORINFO_TYPE_NATIVEINT),
+                                                            Parameter(CORINFO_TYPE_NATIVEINT)},
+                                                    (void *) binaryfunc_left);
     }
     if (binaryfunc_right) {
-        right_func_token = g_module.AddMethod(CORINFO_TYPE_NATIVEINT,
-                                              vector<Parameter>{
-                                                      Parameter(CORINFO_TYPE_NATIVEINT),
-                                                      Parameter(CORINFO_TYPE_NATIVEINT)},
-                                              (void *) binaryfunc_right);
+        right_func_token = m_methodModule->AddMethod(CORINFO_TYPE_NATIVEINT,
+                                                     vector<Parameter>{
+                                                             Parameter(CORINFO_TYPE_NATIVEINT),
+                                                             Parameter(CORINFO_TYPE_NATIVEINT)},
+                                                     (void *) binaryfunc_right);
     }
 
     if (binaryfunc_left != nullptr){
@@ -605,20 +604,20 @@ void PythonCompiler::emit_known_binary_op_power(AbstractValueWithSources &left,
     int left_func_token = -1, right_func_token = -1;
 
     if (binaryfunc_left) {
-        left_func_token = g_module.AddMethod(CORINFO_TYPE_NATIVEINT,
-                                             vector<Parameter>{
-                                                     Parameter(CORINFO_TYPE_NATIVEINT),
-                                                     Parameter(CORINFO_TYPE_NATIVEINT),
-                                                     Parameter(CORINFO_TYPE_NATIVEINT)},
-                                             (void *) binaryfunc_left);
+        left_func_token = m_methodModule->AddMethod(CORINFO_TYPE_NATIVEINT,
+                                                    vector<Parameter>{
+                                                            Parameter(CORINFO_TYPE_NATIVEINT),
+                                                            Parameter(CORINFO_TYPE_NATIVEINT),
+                                                            Parameter(CORINFO_TYPE_NATIVEINT)},
+                                                    (void *) binaryfunc_left);
     }
     if (binaryfunc_right) {
-        right_func_token = g_module.AddMethod(CORINFO_TYPE_NATIVEINT,
-                                              vector<Parameter>{
-                                                      Parameter(CORINFO_TYPE_NATIVEINT),
-                                                      Parameter(CORINFO_TYPE_NATIVEINT),
-                                                      Parameter(CORINFO_TYPE_NATIVEINT)},
-                                              (void *) binaryfunc_right);
+        right_func_token = m_methodModule->AddMethod(CORINFO_TYPE_NATIVEINT,
+                                                     vector<Parameter>{
+                                                             Parameter(CORINFO_TYPE_NATIVEINT),
+                                                             Parameter(CORINFO_TYPE_NATIVEINT),
+                                                             Parameter(CORINFO_TYPE_NATIVEINT)},
+                                                     (void *) binaryfunc_right);
     }
 
     if (binaryfunc_left != nullptr){
@@ -0,0 +1,276 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+
+#include <mutex>
+#include <map>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+
+#ifdef WINDOWS
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#ifdef __APPLE__
+#include <pthread.h>
+#include <libkern/OSCacheControl.h>
+#endif
+#endif
+
+#include "codeheap.h"
+
+using namespace std;
+
+struct CodeHeapRegion {
+    uint8_t* rx;
+    uint8_t* rw;
+    size_t size;
+    size_t top; // Everything after this offset has never been allocated
+    size_t live;
+    map<size_t, size_t> freeBlocks; // Offset to size, neighbouring blocks are merged
+#ifdef WINDOWS
+    HANDLE mapping;
+#endif
+};
+
+struct CodeHeapAllocation {
+    CodeHeapRegion* region;
+    size_t offset;
+    size_t size;
+};
+
+static mutex g_codeHeapLock;
+static vector<CodeHeapRegion*> g_codeHeapRegions;
+static unordered_map<void*, CodeHeapAllocation> g_codeHeapAllocations;
+static size_t g_codeHeapUsed = 0;
+static bool g_codeHeapDoubleMapped = true;
+
+static size_t alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static CodeHeapRegion* mapRegion(size_t size) {
+    auto region = new CodeHeapRegion{nullptr, nullptr, size, 0, 0};
+#ifdef WINDOWS
+    region->mapping = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_EXECUTE_READWRITE | SEC_COMMIT,
+                                        (DWORD)((uint64_t)size >> 32), (DWORD)size, nullptr);
+    if (region->mapping != nullptr) {
+        region->rw = (uint8_t*)MapViewOfFile(region->mapping, FILE_MAP_WRITE, 0, 0, size);
+        region->rx = (uint8_t*)MapViewOfFile(region->mapping, FILE_MAP_READ | FILE_MAP_EXECUTE, 0, 0, size);
+        if (region->rw != nullptr && region->rx != nullptr)
+            return region;
+        if (region->rw != nullptr)
+            UnmapViewOfFile(region->rw);
+        if (region->rx != nullptr)
+            UnmapViewOfFile(region->rx);
+        CloseHandle(region->mapping);
+    }
+    delete region;
+    return nullptr;
+#else
+#if defined(__linux__) && defined(SYS_memfd_create)
+    int fd = (int)syscall(SYS_memfd_create, "pyjion-code", 1 /* MFD_CLOEXEC */);
+    if (fd != -1) {
+        if (ftruncate(fd, (off_t)size) == 0) {
+            void* rw = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            void* rx = mmap(nullptr, size, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+            if (rw != MAP_FAILED && rx != MAP_FAILED) {
+                close(fd);
+                region->rw = (uint8_t*)rw;
+                region->rx = (uint8_t*)rx;
+                return region;
+            }
+            if (rw != MAP_FAILED)
+                munmap(rw, size);
+            if (rx != MAP_FAILED)
+                munmap(rx, size);
+        }
+        close(fd);
+    }
+#endif
+    // Double mapping isn't available (or is blocked by the sandbox), use a single mapping. On macOS
+    // MAP_JIT pages are still only writable by a thread between PyJit_BeginCodeWrite and PyJit_EndCodeWrite.
+#if defined(__APPLE__) && defined(MAP_JIT)
+    const int mode = MAP_PRIVATE | MAP_ANONYMOUS | MAP_JIT;
+#elif defined(MAP_ANONYMOUS)
+    const int mode = MAP_PRIVATE | MAP_ANONYMOUS;
+#elif defined(MAP_ANON)
+    const int mode = MAP_PRIVATE | MAP_ANON;
+#else
+#error "not supported"
+#endif
+    void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE | PROT_EXEC, mode, -1, 0);
+    if (mem == MAP_FAILED) {
+        delete region;
+        return nullptr;
+    }
+    region->rx = region->rw = (uint8_t*)mem;
+    g_codeHeapDoubleMapped = false;
+    return region;
+#endif
+}
+
+static void unmapRegion(CodeHeapRegion* region) {
+#ifdef WINDOWS
+    UnmapViewOfFile(region->rw);
+    UnmapViewOfFile(region->rx);
+    CloseHandle(region->mapping);
+#else
+    if (region->rw != region->rx)
+        munmap(region->rw, region->size);
+    munmap(region->rx, region->size);
+#endif
+    delete region;
+}
+
+// First fit from the freed blocks, then from the end of the region.
+static bool allocFromRegion(CodeHeapRegion* region, size_t size, size_t alignment, size_t& offset) {
+    for (auto block = region->freeBlocks.begin(); block != region->freeBlocks.end(); ++block) {
+        auto blockStart = block->first;
+        auto blockEnd = block->first + block->second;
+        auto start = alignUp(blockStart, alignment);
+        if (start + size > blockEnd)
+            continue;
+        region->freeBlocks.erase(block);
+        if (start > blockStart)
+            region->freeBlocks[blockStart] = start - blockStart;
+        if (start + size < blockEnd)
+            region->freeBlocks[start + size] = blockEnd - start - size;
+        offset = start;
+        return true;
+    }
+    auto start = alignUp(region->top, alignment);
+    if (start + size > region->size)
+        return false;
+    if (start > region->top)
+        region->freeBlocks[region->top] = start - region->top;
+    region->top = start + size;
+    offset = start;
+    return true;
+}
+
+static void releaseBlock(CodeHeapRegion* region, size_t offset, size_t size) {
+    auto next = region->freeBlocks.lower_bound(offset);
+    if (next != region->freeBlocks.end() && next->first == offset + size) {
+        size += next->second;
+        next = region->freeBlocks.erase(next);
+    }
+    if (next != region->freeBlocks.begin()) {
+        auto previous = prev(next);
+        if (previous->first + previous->second == offset) {
+            offset = previous->first;
+            size += previous->second;
+            region->freeBlocks.erase(previous);
+        }
+    }
+    if (offset + size == region->top)
+        region->top = offset;
+    else
+        region->freeBlocks[offset] = size;
+}
+
+PyjionCodeBlock PyJit_AllocCode(size_t size, size_t alignment) {
+    lock_guard<mutex> lock(g_codeHeapLock);
+    size = alignUp(max(size, (size_t)1), CODE_HEAP_GRANULE);
+    alignment = max(alignment, (size_t)CODE_HEAP_GRANULE);
+
+    size_t offset = 0;
+    CodeHeapRegion* region = nullptr;
+    for (auto candidate : g_codeHeapRegions) {
+        if (allocFromRegion(candidate, size, alignment, offset)) {
+            region = candidate;
+            break;
+        }
+    }
+    if (region == nullptr) {
+        // Regions are page aligned, so a new one always fits the block
+        region = mapRegion(alignUp(size, CODE_HEAP_REGION_SIZE));
+        if (region == nullptr)
+            return {nullptr, nullptr};
+        g_codeHeapRegions.push_back(region);
+        allocFromRegion(region, size, alignment, offset);
+    }
+    region->live++;
+    g_codeHeapUsed += size;
+    auto rx = region->rx + offset;
+    g_codeHeapAllocations[rx] = {region, offset, size};
+    return {rx, region->rw + offset};
+}
+
+void PyJit_FreeCode(void* rx) {
+    lock_guard<mutex> lock(g_codeHeapLock);
+    auto allocation = g_codeHeapAllocations.find(rx);
+    if (allocation == g_codeHeapAllocations.end())
+        return;
+    auto region = allocation->second.region;
+    releaseBlock(region, allocation->second.offset, allocation->second.size);
+    g_codeHeapUsed -= allocation->second.size;
+    g_codeHeapAllocations.erase(allocation);
+
+    // Keep one region mapped so a function which is compiled and freed repeatedly doesn't remap each time
+    if (--region->live == 0 && g_codeHeapRegions.size() > 1) {
+        g_codeHeapRegions.erase(find(g_codeHeapRegions.begin(), g_codeHeapRegions.end(), region));
+        unmapRegion(region);
+    }
+}
+
+void PyJit_BeginCodeWrite() {
+#if defined(__APPLE__) && defined(__aarch64__)
+    pthread_jit_write_protect_np(0);
+#endif
+}
+
+void PyJit_EndCodeWrite(void* rx, size_t size) {
+#if defined(__APPLE__) && defined(__aarch64__)
+    pthread_jit_write_protect_np(1);
+    sys_icache_invalidate(rx, size);
+#elif defined(WINDOWS)
+    FlushInstructionCache(GetCurrentProcess(), rx, size);
+#elif defined(__aarch64__) || defined(__arm__)
+    __builtin___clear_cache((char*)rx, (char*)rx + size);
+#endif
+}
+
+PyjionCodeHeapStats PyJit_GetCodeHeapStats() {
+    lock_guard<mutex> lock(g_codeHeapLock);
+    PyjionCodeHeapStats stats = {g_codeHeapRegions.size(), 0, g_codeHeapUsed, 0, 0, g_codeHeapAllocations.size(), g_codeHeapDoubleMapped};
+    for (auto region : g_codeHeapRegions) {
+        stats.reserved += region->size;
+        stats.free += region->size - region->top;
+        stats.largestFree = max(stats.largestFree, region->size - region->top);
+        for (auto & block : region->freeBlocks) {
+            stats.free += block.second;
+            stats.largestFree = max(stats.largestFree, block.second);
+        }
+    }
+    return stats;
+}
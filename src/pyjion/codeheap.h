@@ -0,0 +1,67 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+
+#ifndef PYJION_CODEHEAP_H
+#define PYJION_CODEHEAP_H
+
+#include <cstddef>
+
+/* Native code is packed into large shared regions instead of a mapping per method. Each
+ * region is mapped twice where the platform allows it, a read/execute view which the code
+ * runs from and a read/write view the JIT writes through, so no page is ever writable and
+ * executable at the same address. */
+
+// Size of each region, larger requests get a region of their own
+#define CODE_HEAP_REGION_SIZE (1024 * 1024)
+// Allocation sizes are rounded up to this so freed blocks can be reused
+#define CODE_HEAP_GRANULE 16
+
+struct PyjionCodeBlock {
+    void* rx; // Address the code runs from
+    void* rw; // Address to write the code to, the same as rx if the region isn't double mapped
+};
+
+struct PyjionCodeHeapStats {
+    size_t regions;
+    size_t reserved;    // Bytes mapped for regions
+    size_t used;        // Bytes in live allocations
+    size_t free;        // Bytes in freed blocks plus the unused end of each region
+    size_t largestFree;
+    size_t allocations;
+    bool doubleMapped;
+};
+
+// Allocate size bytes aligned to alignment (a power of 2), returns nullptr blocks if out of memory.
+PyjionCodeBlock PyJit_AllocCode(size_t size, size_t alignment);
+// Return a block allocated by PyJit_AllocCode, rx is the address it returned.
+void PyJit_FreeCode(void* rx);
+// Called before the JIT writes to a block and after it has finished, for platforms which
+// toggle write access per thread and need the instruction cache flushed.
+void PyJit_BeginCodeWrite();
+void PyJit_EndCodeWrite(void* rx, size_t size);
+PyjionCodeHeapStats PyJit_GetCodeHeapStats();
+
+#endif //PYJION_CODEHEAP_H
@@ -42,6 +42,7 @@
 #include <utility>
 #include <vector>
 #include <unordered_map>
+#include <mutex>
 
 #include <corjit.h>
 
@@ -69,13 +70,21 @@ public:
 class BaseModule {
     unordered_map<void*, int> existingSlots;
     int slotCursor = 0;
+protected:
+    // Methods are added while emitting IL with the GIL held, and resolved by compiles running without it
+    mutex m_lock;
 public:
     unordered_map<int32_t, BaseMethod*> m_methods;
     SymbolTable symbolTable;
     BaseModule() = default;
 
     virtual BaseMethod* ResolveMethod(int32_t tokenId) {
-        return m_methods[tokenId];
+        // Don't insert into the shared table on a miss
+        lock_guard<mutex> lock(m_lock);
+        auto res = m_methods.find(tokenId);
+        if (res == m_methods.end())
+            return nullptr;
+        return res->second;
     }
 
     virtual int AddMethod(CorInfoType returnType, std::vector<Parameter> params, void* addr);
@@ -86,22 +95,38 @@ public:
 
 class UserModule : public BaseModule {
     BaseModule& m_parent;
+    // Objects the code compares against by address, released with the compiled code
+    vector<PyObject*> m_references;
 public:
     explicit UserModule(BaseModule& parent) : m_parent(parent) {
 
     }
 
+    ~UserModule() {
+        for (auto reference: m_references)
+            Py_DECREF(reference);
+    }
+
+    void AddReference(PyObject* object) {
+        Py_INCREF(object);
+        m_references.push_back(object);
+    }
+
     BaseMethod* ResolveMethod(int32_t tokenId) override {
-        auto res = m_methods.find(tokenId);
-        if (res == m_methods.end()) {
-            return m_parent.ResolveMethod(tokenId);
+        {
+            lock_guard<mutex> lock(m_lock);
+            auto res = m_methods.find(tokenId);
+            if (res != m_methods.end())
+                return res->second;
         }
-
-        return res->second;
+        return m_parent.ResolveMethod(tokenId);
     }
 
     SymbolTable GetSymbolTable() override {
-        return m_parent.GetSymbolTable();
+        auto symbols = m_parent.GetSymbolTable();
+        lock_guard<mutex> lock(m_lock);
+        symbols.insert(symbolTable.begin(), symbolTable.end());
+        return symbols;
     }
 };
 
@@ -0,0 +1,161 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <algorithm>
+
+#include "compilequeue.h"
+#include "pyjit.h"
+
+static mutex g_compileQueueLock;
+static condition_variable g_compileQueueReady;
+static deque<PyjionCompileJob*> g_compileQueue;
+static bool g_compileQueueStopping = false;
+static bool g_compileWorkerRunning = false;
+static PyjionCompileQueueStats g_compileQueueStats = {0, 0, 0, 0};
+
+// Releases the references held by a job, must be called with the GIL held.
+static void freeCompileJob(PyjionCompileJob* job) {
+    job->jitted->j_compile_queued = false;
+    for (auto & arg : job->args) {
+        Py_XDECREF(arg);
+    }
+    Py_DECREF(job->globals);
+    Py_DECREF(job->builtins);
+    Py_DECREF(job->code);
+    delete job;
+}
+
+static void backgroundCompileWorker() {
+    while (true) {
+        PyjionCompileJob* job;
+        {
+            unique_lock<mutex> lock(g_compileQueueLock);
+            g_compileQueueReady.wait(lock, [] { return g_compileQueueStopping || !g_compileQueue.empty(); });
+            if (g_compileQueueStopping || _Py_IsFinalizing()) {
+                // Don't try and take the GIL once the interpreter is shutting down, it will never be released.
+                g_compileWorkerRunning = false;
+                return;
+            }
+            job = g_compileQueue.front();
+            g_compileQueue.pop_front();
+            g_compileQueueStats.depth = g_compileQueue.size();
+        }
+
+        // The abstract interpreter and IL emission read the globals, builtins, names and the
+        // profile so they run with the GIL, the same as a compile in the frame. Only the CLR JIT
+        // (emit_compile) releases it while it generates native code, then the result is published
+        // with the GIL held again. PyGILState uses the main interpreter, see PyJit_QueueCompile.
+        PyGILState_STATE gstate = PyGILState_Ensure();
+        auto jitted = job->jitted;
+        // The frame evaluator may have compiled it in the meantime if background compilation was switched off
+        bool ready = jitted->j_addr != nullptr && (!PyJit_Settings().pgc || jitted->j_pgc_status == Optimized);
+        if (!jitted->failed() && !ready) {
+            PyJit_CompileCode(jitted, job->builtins, job->globals, job->args.data(), job->args.size(), jitted->j_profile);
+            PyErr_Clear();
+        }
+        freeCompileJob(job);
+        PyGILState_Release(gstate);
+
+        {
+            lock_guard<mutex> lock(g_compileQueueLock);
+            g_compileQueueStats.completed++;
+        }
+    }
+}
+
+bool PyJit_QueueCompile(PyjionJittedCode* jitted, PyFrameObject* frame) {
+    if (jitted->j_compile_queued)
+        return true;
+    // The worker takes the GIL with the main interpreter's thread state, subinterpreters compile in the frame
+    if (PyThreadState_GetInterpreter(PyThreadState_Get()) != PyInterpreterState_Main())
+        return false;
+
+    auto job = new PyjionCompileJob();
+    job->jitted = jitted;
+    job->code = jitted->j_code;
+    Py_INCREF(job->code);
+    job->builtins = frame->f_builtins;
+    Py_INCREF(job->builtins);
+    job->globals = frame->f_globals;
+    Py_INCREF(job->globals);
+    int argCount = frame->f_code->co_argcount + frame->f_code->co_kwonlyargcount;
+    for (int i = 0; i < argCount; i++) {
+        Py_XINCREF(frame->f_localsplus[i]);
+        job->args.push_back(frame->f_localsplus[i]);
+    }
+    jitted->j_compile_queued = true;
+
+    {
+        lock_guard<mutex> lock(g_compileQueueLock);
+        if (g_compileWorkerRunning && !g_compileQueueStopping) {
+            g_compileQueue.push_back(job);
+            g_compileQueueStats.queued++;
+            g_compileQueueStats.depth = g_compileQueue.size();
+            g_compileQueueStats.maxDepth = max(g_compileQueueStats.maxDepth, g_compileQueueStats.depth);
+            job = nullptr;
+        }
+    }
+
+    if (job != nullptr) {
+        freeCompileJob(job);
+        return false;
+    }
+    g_compileQueueReady.notify_one();
+    return true;
+}
+
+void PyJit_StartCompileQueue() {
+    lock_guard<mutex> lock(g_compileQueueLock);
+    g_compileQueueStopping = false;
+    if (!g_compileWorkerRunning) {
+        g_compileWorkerRunning = true;
+        // Detached, the worker can be blocked waiting for the GIL held by whoever stops the queue
+        thread(backgroundCompileWorker).detach();
+    }
+}
+
+void PyJit_StopCompileQueue() {
+    deque<PyjionCompileJob*> pending;
+    {
+        lock_guard<mutex> lock(g_compileQueueLock);
+        g_compileQueueStopping = true;
+        pending.swap(g_compileQueue);
+        g_compileQueueStats.depth = 0;
+    }
+    g_compileQueueReady.notify_all();
+
+    for (auto & job : pending) {
+        freeCompileJob(job);
+    }
+}
+
+PyjionCompileQueueStats PyJit_GetCompileQueueStats() {
+    lock_guard<mutex> lock(g_compileQueueLock);
+    return g_compileQueueStats;
+}
@@ -0,0 +1,61 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#ifndef PYJION_COMPILEQUEUE_H
+#define PYJION_COMPILEQUEUE_H
+
+#include <Python.h>
+#include <frameobject.h>
+#include <vector>
+
+using namespace std;
+
+class PyjionJittedCode;
+
+/* A compile request captured from the frame which triggered it. The references keep the code
+ * object (and so its PyjionJittedCode), the globals and the arguments used for specialization
+ * alive until the worker has finished with them. */
+struct PyjionCompileJob {
+    PyjionJittedCode* jitted;
+    PyObject* code;
+    PyObject* builtins;
+    PyObject* globals;
+    vector<PyObject*> args;
+};
+
+struct PyjionCompileQueueStats {
+    size_t depth;
+    size_t maxDepth;
+    size_t queued;
+    size_t completed;
+};
+
+// Queue a code object to be compiled on the background thread, returns false if it couldn't be queued.
+bool PyJit_QueueCompile(PyjionJittedCode* jitted, PyFrameObject* frame);
+void PyJit_StartCompileQueue();
+void PyJit_StopCompileQueue();
+PyjionCompileQueueStats PyJit_GetCompileQueueStats();
+
+#endif //PYJION_COMPILEQUEUE_H
@@ -1,5 +1,5 @@
 from dis import get_instructions
-from pyjion import dump_il, dump_native, get_offsets, symbols
+from pyjion import dump_il, dump_native, get_offsets, symbols, info
 from collections import namedtuple
 from warnings import warn
 import struct
@@ -371,7 +371,13 @@ for opcode in opcodes:
         opcode_map[opcode.first_byte + opcode.second_byte] = opcode
 
 
-def print_il(il: bytearray, symbols, offsets=None, bytecodes=None, print_pc=True) -> None:
+def _execution_count(counts, offset) -> str:
+    if not counts:
+        return ""
+    return f" [{counts.get(offset, 0)}x]"
+
+
+def print_il(il: bytearray, symbols, offsets=None, bytecodes=None, print_pc=True, counts=None) -> None:
     """
     Print the CIL sequence
 
@@ -379,6 +385,7 @@ def print_il(il: bytearray, symbols, offsets=None, bytecodes=None, print_pc=True
     :param offsets: A dictionary of Python bytecode offsets
     :param bytecodes: The dictionary of Python bytecode instructions
     :param print_pc: Flag to include the PC offsets in the print
+    :param counts: A dictionary of execution counts by Python bytecode offset
     """
     i = iter(il)
     try:
@@ -390,7 +397,7 @@ def print_il(il: bytearray, symbols, offsets=None, bytecodes=None, print_pc=True
                     if il_offset == pc and offset_type == 'instruction':
                         try:
                             instruction = bytecodes[py_offset]
-                            print(f'// {instruction.offset} {instruction.opname} - {instruction.arg} ({instruction.argval})', )
+                            print(f'// {instruction.offset} {instruction.opname} - {instruction.arg} ({instruction.argval}){_execution_count(counts, py_offset)}', )
                         except KeyError:
                             warn("Invalid offset {0}".format(offsets))
             first = next(i)
@@ -486,7 +493,8 @@ def dis(f, include_offsets=False, print_pc=True):
     Disassemble a code object into IL.
 
     :param f: The compiled function or code object
-    :param include_offsets: Flag to print python bytecode offsets as comments
+    :param include_offsets: Flag to print python bytecode offsets as comments, with the execution
+                            count of each instruction when it was compiled with opcode counts enabled
     :param print_pc: Flag to print the memory address of each instruction
     """
     il = dump_il(f)
@@ -496,7 +504,8 @@ def dis(f, include_offsets=False, print_pc=True):
     if include_offsets:
         python_instructions = {i.offset: i for i in get_instructions(f)}
         offsets = get_offsets(f)
-        print_il(il, offsets=offsets, bytecodes=python_instructions, print_pc=print_pc, symbols=symbols(f))
+        counts = info(f)["opcode_counts"]
+        print_il(il, offsets=offsets, bytecodes=python_instructions, print_pc=print_pc, symbols=symbols(f), counts=counts)
     else:
         print_il(il, print_pc=print_pc, symbols=symbols(f))
 
@@ -524,9 +533,11 @@ def dis_native(f, include_offsets=False, print_pc=True) -> None:
     if include_offsets:
         python_instructions = {i.offset: i for i in get_instructions(f)}
         jit_offsets = get_offsets(f)
+        counts = info(f)["opcode_counts"]
     else:
         python_instructions = {}
         jit_offsets = []
+        counts = None
 
     code, code_length, position = native
     iterable = distorm3.DecodeGenerator(position, bytes(code), distorm3.Decode64Bits)
@@ -547,7 +558,7 @@ def dis_native(f, include_offsets=False, print_pc=True) -> None:
                 if native_offset > 0 and (position + native_offset) == offset and offset_type == "instruction":
                     try:
                         instruction = python_instructions[py_offset]
-                        console.print(f'; {instruction.offset} {instruction.opname} - {instruction.arg} ({instruction.argval})', style="dim")
+                        console.print(f'; {instruction.offset} {instruction.opname} - {instruction.arg} ({instruction.argval}){_execution_count(counts, py_offset)}', style="dim")
                     except KeyError:
                         warn("Invalid offset {0}".format(offsets))
         if print_pc:
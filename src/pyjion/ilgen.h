@@ -451,6 +451,26 @@ public:
         m_il.push_back(CEE_AND); //  Pop1+Pop1, Push1
     }
 
+    void bitwise_xor() {
+        m_il.push_back(CEE_XOR); //  Pop1+Pop1, Push1
+    }
+
+    void bitwise_or() {
+        m_il.push_back(CEE_OR); //  Pop1+Pop1, Push1
+    }
+
+    void bitwise_not() {
+        m_il.push_back(CEE_NOT); //  Pop1, Push1
+    }
+
+    void shl() {
+        m_il.push_back(CEE_SHL); //  Pop1+Pop1, Push1
+    }
+
+    void shr() {
+        m_il.push_back(CEE_SHR); //  Pop1+Pop1, Push1
+    }
+
     void pop() {
         m_il.push_back(CEE_POP); //  Pop1, Push0
     }
@@ -508,6 +528,14 @@ public:
         m_il.push_back(CEE_CONV_R8);
     }
 
+    void conv_i8(){
+        m_il.push_back(CEE_CONV_I8);
+    }
+
+    void conv_i(){
+        m_il.push_back(CEE_CONV_I);
+    }
+
     void ld_i(int32_t i) {
         m_il.push_back(CEE_LDC_I4);
         emit_int(i);
@@ -707,6 +735,7 @@ public:
                 &nativeEntry,
                 &nativeSizeOfCode
         );
+        jitInfo->endCodeWrite();
         jitInfo->setNativeSize(nativeSizeOfCode);
         switch (result){
             case CORJIT_OK:
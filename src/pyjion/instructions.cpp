@@ -28,8 +28,9 @@
 #include "unboxing.h"
 
 
-InstructionGraph::InstructionGraph(PyCodeObject *code, unordered_map<py_opindex , const InterpreterStack*> stacks) {
+InstructionGraph::InstructionGraph(PyCodeObject *code, unordered_map<py_opindex , const InterpreterStack*> stacks, bool canDeoptimize) {
     this->code = code;
+    this->canDeoptimize = canDeoptimize;
     auto mByteCode = (_Py_CODEUNIT *)PyBytes_AS_STRING(code->co_code);
     auto size = PyBytes_Size(code->co_code);
     for (py_opindex curByte = 0; curByte < size; curByte += SIZEOF_CODEUNIT) {
@@ -84,6 +85,21 @@ InstructionGraph::InstructionGraph(PyCodeObject *code, unordered_map<py_opindex
 
 void InstructionGraph::fixEdges(){
     for (auto & edge: this->edges){
+        if (this->instructions[edge.to].opcode == FOR_ITER) {
+            // The iterator is always an object, only the value it produces is unboxed
+            edge.escaped = NoEscape;
+            continue;
+        }
+        if ((this->instructions[edge.to].opcode == CALL_FUNCTION || this->instructions[edge.to].opcode == CALL_METHOD) && edge.position > 0) {
+            // The function being called (and self) are always objects, only the argument is unboxed
+            edge.escaped = NoEscape;
+            continue;
+        }
+        if (this->instructions[edge.from].opcode == CALL_METHOD) {
+            // A math method call boxes its result, a replaced function can return anything
+            edge.escaped = this->instructions[edge.to].escape ? Unbox : NoEscape;
+            continue;
+        }
         if (!this->instructions[edge.from].escape) {
             // From non-escaped operation
             if (this->instructions[edge.to].escape){
@@ -109,15 +125,71 @@ void InstructionGraph::fixInstructions(){
         if (instruction.second.opcode == LOAD_FAST || instruction.second.opcode == STORE_FAST || instruction.second.opcode == DELETE_FAST )
             continue; // handled in fixLocals();
 
+        if (instruction.second.opcode == FOR_ITER) {
+            // Range iterators are stepped natively, the iterator itself stays boxed
+            auto edgesIn = getEdges(instruction.first);
+            auto edgesOut = getEdgesFrom(instruction.first);
+            instruction.second.escape = edgesIn.size() == 1 && edgesOut.size() == 1 &&
+                    isRangeIterator(AbstractValueWithSources(edgesIn[0].value, edgesIn[0].source)) &&
+                    supportsEscaping(edgesOut[0].kind);
+            continue;
+        }
+
+        if (instruction.second.opcode == CALL_FUNCTION || instruction.second.opcode == CALL_METHOD) {
+            // Only calls to known math functions with a single unboxed argument, the callee stays boxed
+            instruction.second.escape = false;
+            if (instruction.second.oparg != 1)
+                continue;
+            auto edgesIn = getEdges(instruction.first);
+            auto edgesOut = getEdgesFrom(instruction.first);
+            if (edgesIn.size() != (instruction.second.opcode == CALL_METHOD ? 3 : 2) || edgesOut.size() != 1)
+                continue;
+            Edge* argument = nullptr;
+            Edge* callee = nullptr;
+            for (auto & edgeIn: edgesIn){
+                if (edgeIn.position == 0)
+                    argument = &edgeIn;
+                else if (edgeIn.position == 1)
+                    callee = &edgeIn;
+            }
+            if (argument == nullptr || callee == nullptr)
+                continue;
+            auto function = knownMathFunction(AbstractValueWithSources(callee->value, callee->source));
+            if (function == MathNone || (argument->kind != AVK_Float && argument->kind != AVK_Integer))
+                continue;
+            if (instruction.second.opcode == CALL_METHOD) {
+                // The result is boxed again, see fixEdges()
+                instruction.second.escape = true;
+            } else {
+                // A function call deoptimizes when the result isn't the unboxed kind
+                instruction.second.escape = canDeoptimize &&
+                        mathFunctionReturnType(function, argument->kind) == edgesOut[0].kind &&
+                        supportsEscaping(edgesOut[0].kind);
+            }
+            continue;
+        }
+
         // Check that all inbound edges can be escaped.
         bool allEdgesEscapable = true;
+        bool allEdgesIntegers = true;
         for (auto & edgeIn: getEdges(instruction.first)){
             if (!supportsEscaping(edgeIn.kind))
                 allEdgesEscapable = false;
+            if (edgeIn.kind != AVK_Integer && edgeIn.kind != AVK_Bool)
+                allEdgesIntegers = false;
         }
         if (!allEdgesEscapable)
             continue;
 
+        // Integer operations that overflow int64 (including shifts and negation) are redone by the interpreter
+        // after a deoptimization
+        if (!canDeoptimize && allEdgesIntegers && canOverflow(instruction.second.opcode))
+            continue;
+
+        // ~ is only defined for ints and bools, a float raises TypeError
+        if (instruction.second.opcode == UNARY_INVERT && !allEdgesIntegers)
+            continue;
+
         // Check that all inbound edges can be escaped.
         bool allOutputsEscapable = true;
         for (auto & edgeOut: getEdgesFrom(instruction.first)){
@@ -138,6 +210,8 @@ void InstructionGraph::deoptimizeInstructions() {
             continue;
         if (instruction.second.opcode == LOAD_FAST || instruction.second.opcode == STORE_FAST || instruction.second.opcode == DELETE_FAST )
             continue; // handled in fixLocals();
+        if (instruction.second.opcode == FOR_ITER)
+            continue; // the value is boxed by its consumer if that isn't unboxed, which is still cheaper than tp_iternext
 
         auto edgesIn = getEdges(instruction.first);
         auto edgesOut = getEdgesFrom(instruction.first);
@@ -74,6 +74,7 @@ typedef unordered_map<py_opindex, Edge> EdgeMap;
 class InstructionGraph {
 private:
     PyCodeObject * code;
+    bool canDeoptimize;
     bool invalid = false;
     unordered_map<py_opindex, Instruction> instructions;
     unordered_map<py_oparg, AbstractValueKind> unboxedFastLocals ;
@@ -83,7 +84,7 @@ private:
     void deoptimizeInstructions();
     void fixLocals(py_oparg startIdx, py_oparg endIdx);
 public:
-    InstructionGraph(PyCodeObject* code, unordered_map<py_opindex, const InterpreterStack*> stacks) ;
+    InstructionGraph(PyCodeObject* code, unordered_map<py_opindex, const InterpreterStack*> stacks, bool canDeoptimize) ;
     Instruction & operator [](py_opindex i) {return instructions[i];}
     size_t size() {return instructions.size();}
     PyObject* makeGraph(const char* name) ;
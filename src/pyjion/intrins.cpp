@@ -26,6 +26,7 @@
 */
 #include "intrins.h"
 #include "pyjit.h"
+#include "jitstats.h"
 
 #ifdef _MSC_VER
 
@@ -38,6 +39,7 @@ PyObject* g_emptyTuple;
 
 #include <dictobject.h>
 #include <vector>
+#include <chrono>
 
 #define NAME_ERROR_MSG \
     "name '%.200s' is not defined"
@@ -1525,7 +1527,7 @@ PyObject* PyJit_CallN(PyObject *target, PyObject* args) {
         PyGILState_STATE gstate;
         gstate = PyGILState_Ensure();
 #endif
-        if (tstate->use_tracing && tstate->c_profileobj && g_pyjionSettings.profiling) {
+        if (tstate->use_tracing && tstate->c_profileobj && PyJit_Settings().profiling) {
             // Call the function with profiling hooks
             trace(tstate, tstate->frame, PyTrace_C_CALL, target, tstate->c_profilefunc, tstate->c_profileobj);
             res = PyObject_Vectorcall(target, args_vec, args_vec_size | PY_VECTORCALL_ARGUMENTS_OFFSET, nullptr);
@@ -1977,7 +1979,7 @@ inline PyObject* VectorCall(PyObject* target, Args...args){
     PyGILState_STATE gstate;
     gstate = PyGILState_Ensure();
 #endif
-    if (tstate->use_tracing && tstate->c_profileobj && g_pyjionSettings.profiling) {
+    if (tstate->use_tracing && tstate->c_profileobj && PyJit_Settings().profiling) {
         // Call the function with profiling hooks
         trace(tstate, tstate->frame, PyTrace_C_CALL, target, tstate->c_profilefunc, tstate->c_profileobj);
         res = _PyObject_VectorcallTstate(tstate, target, _args, sizeof...(args) | PY_VECTORCALL_ARGUMENTS_OFFSET, nullptr);
@@ -2003,7 +2005,7 @@ inline PyObject* VectorCall0(PyObject* target){
     PyGILState_STATE gstate;
     gstate = PyGILState_Ensure();
 #endif
-    if (tstate->use_tracing && tstate->c_profileobj && g_pyjionSettings.profiling) {
+    if (tstate->use_tracing && tstate->c_profileobj && PyJit_Settings().profiling) {
         // Call the function with profiling hooks
         trace(tstate, tstate->frame, PyTrace_C_CALL, target, tstate->c_profilefunc, tstate->c_profileobj);
         res = _PyObject_VectorcallTstate(tstate, target, nullptr, 0 | PY_VECTORCALL_ARGUMENTS_OFFSET, nullptr);
@@ -2561,6 +2563,21 @@ void PyJit_ProfileFrameExit(PyFrameObject* f){
     }
 }
 
+// IL has no instruction for the cycle counter, so this leaf is the only call timed code makes
+uint64_t PyJit_ReadTimestamp() {
+#if defined(_MSC_VER)
+    return __rdtsc();
+#elif defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
 void PyJit_TraceFrameException(PyFrameObject* f){
     auto tstate = PyThreadState_GET();
     if (tstate->c_tracefunc != nullptr) {
@@ -2779,6 +2796,7 @@ long long PyJit_LongAsLongLong(PyObject* vv){
 }
 
 void PyJit_PgcGuardException(PyObject* obj, const char* expected) {
+    PyJit_RecordGuardFailure();
     PyErr_Format(PyExc_ValueError,
                  "Pyjion PGC expected %s, but %s is a %s.",
                  expected,
@@ -274,6 +274,7 @@ void PyJit_TraceFrameEntry(PyFrameObject* f);
 void PyJit_TraceFrameExit(PyFrameObject* f);
 void PyJit_ProfileFrameEntry(PyFrameObject* f);
 void PyJit_ProfileFrameExit(PyFrameObject* f);
+uint64_t PyJit_ReadTimestamp();
 void PyJit_TraceFrameException(PyFrameObject* f);
 
 PyObject* Call0(PyObject *target);
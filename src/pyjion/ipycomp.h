@@ -107,6 +107,8 @@ public:
     virtual size_t get_call_points_length() = 0;
 };
 
+struct PyjionProfileSlot;
+
 // Defines the interface between the abstract compiler and code generator
 //
 // The compiler is stack based, various operations can push and pop values from the stack.
@@ -361,6 +363,10 @@ public:
     virtual void emit_getiter() = 0;
     virtual void emit_for_next() = 0;
     virtual void emit_for_next(AbstractValueWithSources) = 0;
+    // Pushes the next value of a range iterator as an int64, leaving the iterator on the stack.
+    // Branches to exhausted at the end of the range, or to generic if the iterator isn't a range
+    // iterator, with just the iterator on the stack.
+    virtual void emit_for_next_unboxed(Label exhausted, Label generic) = 0;
 
     /*****************************************************
      * Operators */
@@ -377,6 +383,16 @@ public:
     // Performans a binary operation for values on the stack which are unboxed floating points
     virtual LocalKind emit_binary_float(uint16_t opcode) = 0;
     virtual LocalKind emit_binary_int(uint16_t opcode) = 0;
+    // Performs an arithmetic, bitwise or shift operation on two unboxed integers or bools, branching to
+    // overflow with nothing pushed if the result doesn't fit in 64 bits or the shift count is out of range
+    virtual LocalKind emit_binary_int_checked(uint16_t opcode, Local left, AbstractValueKind leftKind, Local right, AbstractValueKind rightKind, Label overflow) = 0;
+    // Performs a unary -, ~ or not on an unboxed integer, bool or float, branching to overflow with nothing
+    // pushed if negating the integer overflows
+    virtual LocalKind emit_unary_unboxed(uint16_t opcode, Local value, AbstractValueKind kind, Label overflow) = 0;
+    // Calls a math function natively on an unboxed argument, with the callee (and self for CALL_METHOD) on the stack.
+    // Branches to generic with the stack unchanged if the callee isn't target, or if the result needs the error
+    // handling of the real function (it isn't finite, or floor() doesn't fit in 64 bits)
+    virtual void emit_math_function_call(MathFunction function, PyObject* target, bool isMethod, Local argument, AbstractValueKind argKind, Label generic) = 0;
     // Performs a binary operation for values on the stack which are boxed objects
     virtual void emit_binary_object(uint16_t opcode) = 0;
     virtual void emit_binary_object(uint16_t opcode, AbstractValueWithSources left, AbstractValueWithSources right) = 0;
@@ -443,10 +459,18 @@ public:
     virtual void emit_trace_exception() = 0;
     virtual void emit_profile_frame_entry() = 0;
     virtual void emit_profile_frame_exit() = 0;
-    virtual void emit_pgc_profile_capture(Local value, size_t ipos, size_t istack) = 0;
+    // Reads the cycle counter into start on entry, and adds the cycles since then to the function's counters on exit
+    virtual void emit_timing_entry(Local start) = 0;
+    virtual void emit_timing_exit(Local start) = 0;
+    virtual void emit_pgc_profile_capture(Local value, PyjionProfileSlot* slot) = 0;
+    virtual void emit_count_backedge() = 0;
+    // Increments the function's execution counter for the instruction at idx
+    virtual void emit_count_opcode(py_opindex idx) = 0;
 
     /* Compiles the generated code */
     virtual JittedCode* emit_compile() = 0;
+    /* Nanoseconds the CLR JIT spent in the last emit_compile */
+    virtual uint64_t get_compile_method_time() = 0;
 
     virtual void lift_n_to_top(uint16_t pos) = 0;
     virtual void lift_n_to_second(uint16_t pos) = 0;
@@ -468,6 +492,8 @@ public:
     virtual void emit_infinity_long() = 0;
     virtual void emit_nan_long() = 0;
     virtual void emit_guard_exception(const char* expected) = 0;
+    virtual void emit_unbox_guard(Local value, AbstractValueKind kind, Label failed) = 0;
+    virtual void emit_pgc_deoptimize(py_opindex index) = 0;
     virtual void emit_store_in_frame_value_stack(size_t index) = 0;
     virtual void emit_load_from_frame_value_stack(size_t index) = 0;
     virtual void emit_set_stacktop(size_t height) = 0;
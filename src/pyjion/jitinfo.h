@@ -34,6 +34,7 @@
 #include <intrin.h>
 
 #include <vector>
+#include <string>
 #include <unordered_map>
 #include <cmath>
 #include <corjit.h>
@@ -44,6 +45,8 @@
 #include "cee.h"
 #include "ipycomp.h"
 #include "exceptions.h"
+#include "codeheap.h"
+#include "unwind.h"
 
 #ifndef WINDOWS
 #include <sys/mman.h>
@@ -63,6 +66,7 @@ const CORINFO_CLASS_HANDLE PYOBJECT_PTR_TYPE = (CORINFO_CLASS_HANDLE)0x11;
 
 class CorJitInfo : public ICorJitInfo, public JittedCode {
     void* m_codeAddr;
+    size_t m_codeSize;
     void* m_dataAddr;
     const char* m_moduleName;
     const char* m_methodName;
@@ -72,40 +76,44 @@ class CorJitInfo : public ICorJitInfo, public JittedCode {
     vector<SequencePoint> m_sequencePoints;
     vector<CallPoint> m_callPoints;
     bool m_compileDebug;
+    bool m_debugInfo;
+    vector<void*> m_unwindInfo;
+    void* m_debuggerEntry;
 
     volatile const GSCookie s_gsCookie = 0x1234;
 
 #ifdef WINDOWS
-    HANDLE m_winHeap;
     SYSTEM_INFO systemInfo;
 #endif
 
 public:
 
-    CorJitInfo(const char * moduleName, const char * methodName, UserModule* module, bool compileDebug) {
+    CorJitInfo(const char * moduleName, const char * methodName, UserModule* module, bool compileDebug, bool debugInfo = false) {
         m_codeAddr = m_dataAddr = nullptr;
+        m_codeSize = 0;
         m_methodName = methodName;
         m_moduleName = moduleName;
         m_module = module;
         m_il = vector<uint8_t>(0);
         m_nativeSize = 0;
         m_compileDebug = compileDebug;
+        m_debugInfo = debugInfo;
+        m_debuggerEntry = nullptr;
 #ifdef WINDOWS
-        m_winHeap = HeapCreate(HEAP_CREATE_ENABLE_EXECUTE, 0, 0);
         GetSystemInfo(&systemInfo);
 #endif
     }
 
     ~CorJitInfo() override {
+        PyJit_DeregisterDebuggerCode(m_debuggerEntry);
+        for (auto unwind: m_unwindInfo)
+            PyJit_DeregisterUnwindInfo(unwind);
         if (m_codeAddr != nullptr) {
-            freeMem(m_codeAddr);
+            PyJit_FreeCode(m_codeAddr);
         }
         if (m_dataAddr != nullptr) {
             free(m_dataAddr);
         }
-#ifdef WINDOWS
-        HeapDestroy(m_winHeap);
-#endif
         delete m_module;
     }
 
@@ -209,45 +217,49 @@ public:
         return m_module->GetSymbolTable();
     }
 
-    void freeMem(PVOID code) {
-        // TODO: Validate memory free for CorJitInfo
-        PyMem_Free(code);
-    }
-
+    /// Hot code, cold code and read only data are allocated as one block from the shared code heap.
+    /// The JIT writes through the RW addresses, the code runs from the RX ones.
     void allocMem(
         AllocMemArgs *pArgs
         ) override {
-        // NB: Not honouring flag alignment requested in <flag>, but it is "optional"
-#ifdef WINDOWS
-        pArgs->hotCodeBlock = m_codeAddr = HeapAlloc(m_winHeap, 0 , pArgs->hotCodeSize);
-#else
-#if defined(__APPLE__) && defined(MAP_JIT)
-        const int mode = MAP_PRIVATE | MAP_ANONYMOUS | MAP_JIT;
-#elif defined(MAP_ANONYMOUS)
-        const int mode = MAP_PRIVATE | MAP_ANONYMOUS;
-#elif defined(MAP_ANON)
-		const int mode = MAP_PRIVATE | MAP_ANON;
-#else
-		#error "not supported"
-#endif
-        pArgs->hotCodeBlock = m_codeAddr = mmap(
-                nullptr,
-                pArgs->hotCodeSize,
-                PROT_READ | PROT_WRITE | PROT_EXEC,
-                mode,
-                -1,
-                0);
-        assert (pArgs->hotCodeBlock != MAP_FAILED);
-#endif
-
-        if (pArgs->coldCodeSize>0) // PyMem_Malloc passes with 0 but it confuses the JIT
-            pArgs->coldCodeBlock = PyMem_Malloc(pArgs->coldCodeSize);
-        if (pArgs->roDataSize>0) // Same as above
-            pArgs->roDataBlock = PyMem_Malloc(pArgs->roDataSize);
-
-        pArgs->hotCodeBlockRW = pArgs->hotCodeBlock;
-        pArgs->coldCodeBlockRW = pArgs->coldCodeBlock;
-        pArgs->roDataBlockRW = pArgs->roDataBlock;
+        size_t hotAlign = (pArgs->flag & CORJIT_ALLOCMEM_FLG_32BYTE_ALIGN) ? 32 : 16;
+        size_t roAlign = (pArgs->flag & CORJIT_ALLOCMEM_FLG_RODATA_32BYTE_ALIGN) ? 32 :
+                         (pArgs->flag & CORJIT_ALLOCMEM_FLG_RODATA_16BYTE_ALIGN) ? 16 : sizeof(void*);
+        size_t coldOffset = (pArgs->hotCodeSize + 15) & ~(size_t)15;
+        size_t roOffset = (coldOffset + pArgs->coldCodeSize + roAlign - 1) & ~(roAlign - 1);
+
+        if (m_codeAddr != nullptr)
+            PyJit_FreeCode(m_codeAddr);
+        for (auto unwind: m_unwindInfo)
+            PyJit_DeregisterUnwindInfo(unwind);
+        m_unwindInfo.clear();
+        m_codeSize = roOffset + pArgs->roDataSize;
+        auto block = PyJit_AllocCode(m_codeSize, hotAlign > roAlign ? hotAlign : roAlign);
+        assert(block.rx != nullptr);
+        m_codeAddr = block.rx;
+
+        pArgs->hotCodeBlock = block.rx;
+        pArgs->hotCodeBlockRW = block.rw;
+        // Leave the blocks null when they aren't used, an empty block confuses the JIT
+        pArgs->coldCodeBlock = pArgs->coldCodeSize > 0 ? (uint8_t*)block.rx + coldOffset : nullptr;
+        pArgs->coldCodeBlockRW = pArgs->coldCodeSize > 0 ? (uint8_t*)block.rw + coldOffset : nullptr;
+        pArgs->roDataBlock = pArgs->roDataSize > 0 ? (uint8_t*)block.rx + roOffset : nullptr;
+        pArgs->roDataBlockRW = pArgs->roDataSize > 0 ? (uint8_t*)block.rw + roOffset : nullptr;
+        PyJit_BeginCodeWrite();
+    }
+
+    /// Called once the JIT has returned, the code can't be written to after this.
+    void endCodeWrite() {
+        if (m_codeAddr != nullptr)
+            PyJit_EndCodeWrite(m_codeAddr, m_codeSize);
+    }
+
+    /// Called once the code has compiled successfully, describes it to an attached debugger.
+    /// The block covers the hot code, the cold code and the read-only data.
+    void registerWithDebugger() {
+        string name = string("py::") + m_methodName + ":" + m_moduleName;
+        m_debuggerEntry = PyJit_RegisterDebuggerCode(name.c_str(), m_codeAddr, m_codeSize,
+                                                     m_unwindInfo.data(), m_unwindInfo.size());
     }
 
     bool logMsg(unsigned level, const char* fmt, va_list args) override {
@@ -283,7 +295,7 @@ public:
         ) override {
         switch (fRelocType) {
             case IMAGE_REL_BASED_DIR64:
-                *((uint64_t *)((uint8_t *)location + slotNum)) = (uint64_t)target;
+                *((uint64_t *)((uint8_t *)locationRW + slotNum)) = (uint64_t)target;
                 break;
 #ifdef _TARGET_AMD64_
             case IMAGE_REL_BASED_REL32:
@@ -295,8 +307,8 @@ public:
 
                 auto delta = (int64_t)((uint8_t *)target - baseAddr);
 
-                // Write the 32-bits pc-relative delta into location
-                *fixupLocation = (int32_t)delta;
+                // Write the 32-bits pc-relative delta into location, through the writable mapping
+                *(int32_t *)((uint8_t *)locationRW + slotNum) = (int32_t)delta;
             }
             break;
 #endif // _TARGET_AMD64_
@@ -1546,6 +1558,9 @@ public:
             flags->Add(flags->CORJIT_FLAG_MIN_OPT);
         } else {
             flags->Add(flags->CORJIT_FLAG_SPEED_OPT);
+            // Sequence points for optimized code, without the debuggable codegen
+            if (m_debugInfo)
+                flags->Add(flags->CORJIT_FLAG_DEBUG_INFO);
         }
 
 #ifdef DOTNET_PGO
@@ -1825,12 +1840,16 @@ public:
             uint8_t *              pUnwindBlock,          /* IN */
             CorJitFuncKind      funcKind               /* IN */
     ) override {
-        // Only used in .NET 5 for FEATURE_EH_FUNCLETS.
-        // No requirement to have an implementation in Pyjion.
+        // Offsets are relative to the cold code when the fragment is in it
+        uint8_t* base = pColdCode != nullptr ? pColdCode : pHotCode;
+        auto unwind = PyJit_RegisterUnwindInfo(base + startOffset, endOffset - startOffset, pUnwindBlock, unwindSize);
+        if (unwind != nullptr)
+            m_unwindInfo.push_back(unwind);
     }
 
     void *allocGCInfo(size_t size) override {
-        return PyMem_Malloc(size);
+        // Called without the GIL held
+        return PyMem_RawMalloc(size);
     }
 
     void setEHcount(unsigned int cEH) override {
@@ -0,0 +1,184 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+
+#include <map>
+#include <vector>
+#include <algorithm>
+
+#include "jitstats.h"
+
+static map<AbstractInterpreterResult, size_t> g_compileResults;
+static AbstractInterpreterCompileTimings g_compileTime;
+static vector<AbstractInterpreterCompileTimings> g_compileTimeSamples; // Ring of the most recent compiles
+static size_t g_nextCompileTimeSample = 0;
+static size_t g_pgcRecompiles = 0;
+static size_t g_guardFailures = 0;
+static size_t g_osrDeclines = 0;
+// Moving average of the compile time per byte of bytecode, not cleared by PyJit_ResetCompileStats
+static double g_compileTimePerByte = 0;
+static size_t g_compileTimePerByteSamples = 0;
+
+static const char* resultName(AbstractInterpreterResult result) {
+    switch (result) {
+        case NoResult: return "NoResult";
+        case Success: return "Success";
+        case CompilationException: return "CompilationException";
+        case CompilationJitFailure: return "CompilationJitFailure";
+        case CompilationTimeBudget: return "CompilationTimeBudget";
+        case IncompatibleCompilerFlags: return "IncompatibleCompilerFlags";
+        case IncompatibleSize: return "IncompatibleSize";
+        case IncompatibleOpcode_Yield: return "IncompatibleOpcode_Yield";
+        case IncompatibleOpcode_WithExcept: return "IncompatibleOpcode_WithExcept";
+        case IncompatibleOpcode_With: return "IncompatibleOpcode_With";
+        case IncompatibleOpcode_Unknown: return "IncompatibleOpcode_Unknown";
+        case IncompatibleFrameGlobal: return "IncompatibleFrameGlobal";
+    }
+    return "Unknown";
+}
+
+void PyJit_RecordCompile(AbstractInterpreterResult result, const AbstractInterpreterCompileTimings& timings, size_t bytecodeSize) {
+    g_compileResults[result]++;
+    if (result == Success && bytecodeSize != 0) {
+        g_compileTimePerByteSamples++;
+        auto weight = (double)min(g_compileTimePerByteSamples, (size_t)COMPILE_TIME_PREDICTION_SAMPLES);
+        g_compileTimePerByte += ((double)timings.total() / (double)bytecodeSize - g_compileTimePerByte) / weight;
+    }
+    g_compileTime.interpret += timings.interpret;
+    g_compileTime.compileWorker += timings.compileWorker;
+    g_compileTime.compileMethod += timings.compileMethod;
+    if (g_compileTimeSamples.size() < COMPILE_TIME_SAMPLES) {
+        g_compileTimeSamples.push_back(timings);
+    } else {
+        g_compileTimeSamples[g_nextCompileTimeSample] = timings;
+        g_nextCompileTimeSample = (g_nextCompileTimeSample + 1) % COMPILE_TIME_SAMPLES;
+    }
+}
+
+uint64_t PyJit_PredictCompileTime(size_t bytecodeSize) {
+    if (g_compileTimePerByteSamples < COMPILE_TIME_PREDICTION_SAMPLES)
+        return 0;
+    return (uint64_t)(g_compileTimePerByte * (double)bytecodeSize);
+}
+
+void PyJit_RecordPgcRecompile() {
+    g_pgcRecompiles++;
+}
+
+void PyJit_RecordGuardFailure() {
+    g_guardFailures++;
+}
+
+void PyJit_RecordOsrDecline() {
+    g_osrDeclines++;
+}
+
+static PyObject* phaseStats(uint64_t total, vector<uint64_t>& samples) {
+    uint64_t p99 = 0;
+    if (!samples.empty()) {
+        auto index = (samples.size() * 99) / 100;
+        nth_element(samples.begin(), samples.begin() + index, samples.end());
+        p99 = samples[index];
+    }
+    auto res = PyDict_New();
+    if (res == nullptr)
+        return nullptr;
+    PyDict_SetItemString(res, "total_ns", PyLong_FromUnsignedLongLong(total));
+    PyDict_SetItemString(res, "p99_ns", PyLong_FromUnsignedLongLong(p99));
+    return res;
+}
+
+static bool addPhaseStats(PyObject* compileTime, const char* name, uint64_t total, uint64_t (*phase)(const AbstractInterpreterCompileTimings&)) {
+    vector<uint64_t> samples;
+    samples.reserve(g_compileTimeSamples.size());
+    for (auto & timings : g_compileTimeSamples) {
+        samples.push_back(phase(timings));
+    }
+    auto stats = phaseStats(total, samples);
+    if (stats == nullptr)
+        return false;
+    PyDict_SetItemString(compileTime, name, stats);
+    Py_DECREF(stats);
+    return true;
+}
+
+PyObject* PyJit_GetCompileStats() {
+    auto res = PyDict_New();
+    auto compilations = PyDict_New();
+    auto results = PyDict_New();
+    auto compileTime = PyDict_New();
+    if (res == nullptr || compilations == nullptr || results == nullptr || compileTime == nullptr)
+        goto error;
+
+    {
+        size_t attempted = 0;
+        for (auto & result : g_compileResults) {
+            attempted += result.second;
+            PyDict_SetItemString(results, resultName(result.first), PyLong_FromSize_t(result.second));
+        }
+        auto succeeded = g_compileResults.find(Success) == g_compileResults.end() ? 0 : g_compileResults[Success];
+        PyDict_SetItemString(compilations, "attempted", PyLong_FromSize_t(attempted));
+        PyDict_SetItemString(compilations, "succeeded", PyLong_FromSize_t(succeeded));
+        PyDict_SetItemString(compilations, "failed", PyLong_FromSize_t(attempted - succeeded));
+        PyDict_SetItemString(compilations, "results", results);
+        PyDict_SetItemString(res, "compilations", compilations);
+    }
+
+    if (!addPhaseStats(compileTime, "interpret", g_compileTime.interpret,
+                       [](const AbstractInterpreterCompileTimings& t) { return t.interpret; }) ||
+        !addPhaseStats(compileTime, "compile_worker", g_compileTime.compileWorker,
+                       [](const AbstractInterpreterCompileTimings& t) { return t.compileWorker; }) ||
+        !addPhaseStats(compileTime, "compile_method", g_compileTime.compileMethod,
+                       [](const AbstractInterpreterCompileTimings& t) { return t.compileMethod; }) ||
+        !addPhaseStats(compileTime, "total", g_compileTime.total(),
+                       [](const AbstractInterpreterCompileTimings& t) { return t.total(); }))
+        goto error;
+    PyDict_SetItemString(res, "compile_time", compileTime);
+    PyDict_SetItemString(res, "pgc_recompiles", PyLong_FromSize_t(g_pgcRecompiles));
+    PyDict_SetItemString(res, "guard_failures", PyLong_FromSize_t(g_guardFailures));
+    PyDict_SetItemString(res, "osr_declines", PyLong_FromSize_t(g_osrDeclines));
+
+    Py_DECREF(compilations);
+    Py_DECREF(results);
+    Py_DECREF(compileTime);
+    return res;
+
+error:
+    Py_XDECREF(res);
+    Py_XDECREF(compilations);
+    Py_XDECREF(results);
+    Py_XDECREF(compileTime);
+    return nullptr;
+}
+
+void PyJit_ResetCompileStats() {
+    g_compileResults.clear();
+    g_compileTime = AbstractInterpreterCompileTimings();
+    g_compileTimeSamples.clear();
+    g_nextCompileTimeSample = 0;
+    g_pgcRecompiles = 0;
+    g_guardFailures = 0;
+    g_osrDeclines = 0;
+}
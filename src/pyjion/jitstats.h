@@ -0,0 +1,52 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+
+#ifndef PYJION_JITSTATS_H
+#define PYJION_JITSTATS_H
+
+#include <Python.h>
+#include "absint.h"
+
+/* Process-wide counters for pyjion.stats(). They are only updated with the GIL held. */
+
+// Number of recent compiles kept to work out the 99th percentile compile times
+#define COMPILE_TIME_SAMPLES 1024
+// Successful compiles needed before compile times are predicted from the bytecode size
+#define COMPILE_TIME_PREDICTION_SAMPLES 16
+
+void PyJit_RecordCompile(AbstractInterpreterResult result, const AbstractInterpreterCompileTimings& timings, size_t bytecodeSize);
+// Predicted nanoseconds to compile bytecodeSize bytes of bytecode, 0 if there haven't been enough compiles to tell
+uint64_t PyJit_PredictCompileTime(size_t bytecodeSize);
+void PyJit_RecordPgcRecompile();
+// Called by every failed PGC guard, whether it deoptimizes or raises
+void PyJit_RecordGuardFailure();
+// Called when an OSR entry doesn't accept the state of the interpreted frame
+void PyJit_RecordOsrDecline();
+// Returns a new dictionary of the counters
+PyObject* PyJit_GetCompileStats();
+void PyJit_ResetCompileStats();
+
+#endif //PYJION_JITSTATS_H
@@ -248,4 +248,12 @@ unordered_map<const char*, AbstractValueKind> intMethodReturnTypes = {
         {"as_integer_ratio", AVK_Tuple},
 };
 
+unordered_map<const char*, MathFunction> mathFunctions = {
+        {"sqrt",  MathSqrt},
+        {"sin",   MathSin},
+        {"cos",   MathCos},
+        {"exp",   MathExp},
+        {"floor", MathFloor},
+};
+
 #endif // PYJION_KNOWNMETHODS_H
@@ -0,0 +1,245 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <fcntl.h>
+#include <elf.h>
+#include <ctime>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "perfmap.h"
+#include "pyjit.h"
+#include "ipycomp.h"
+
+using namespace std;
+
+static FILE* g_perfMap = nullptr;
+
+static void writePerfMap(void* addr, size_t size, const char* name) {
+#ifndef WINDOWS
+    if (g_perfMap == nullptr) {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/perf-%d.map", getpid());
+        g_perfMap = fopen(path, "a");
+        if (g_perfMap == nullptr)
+            return;
+    }
+    fprintf(g_perfMap, "%llx %zx %s\n", (unsigned long long)addr, size, name);
+    // perf may read the map while the process is still running
+    fflush(g_perfMap);
+#endif
+}
+
+#ifdef __linux__
+
+// Record layouts from tools/perf/Documentation/jitdump-specification.txt
+#define JITDUMP_MAGIC 0x4A695444
+#define JITDUMP_VERSION 1
+
+enum JitDumpRecordType {
+    JIT_CODE_LOAD = 0,
+    JIT_CODE_DEBUG_INFO = 2,
+    JIT_CODE_CLOSE = 3,
+};
+
+struct JitDumpHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t totalSize;
+    uint32_t elfMach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+struct JitDumpRecordHeader {
+    uint32_t id;
+    uint32_t totalSize;
+    uint64_t timestamp;
+};
+
+struct JitDumpCodeLoad {
+    JitDumpRecordHeader header;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t codeAddr;
+    uint64_t codeSize;
+    uint64_t codeIndex;
+    // Followed by the null terminated name and the code
+};
+
+struct JitDumpDebugInfo {
+    JitDumpRecordHeader header;
+    uint64_t codeAddr;
+    uint64_t entryCount;
+    // Followed by the entries
+};
+
+struct JitDumpDebugEntry {
+    uint64_t addr;
+    uint32_t line;
+    uint32_t discriminator;
+    // Followed by the null terminated file name
+};
+
+static FILE* g_jitDump = nullptr;
+static void* g_jitDumpMarker = nullptr;
+static uint64_t g_jitDumpCodeIndex = 0;
+
+// perf matches records to samples with the monotonic clock (perf record -k 1)
+static uint64_t jitDumpTimestamp() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static bool openJitDump() {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/jit-%d.dump", getpid());
+    int fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd == -1)
+        return false;
+    // perf record finds the file through this executable mapping of it
+    g_jitDumpMarker = mmap(nullptr, (size_t)sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0);
+    if (g_jitDumpMarker == MAP_FAILED) {
+        g_jitDumpMarker = nullptr;
+        close(fd);
+        return false;
+    }
+    g_jitDump = fdopen(fd, "wb");
+    if (g_jitDump == nullptr) {
+        munmap(g_jitDumpMarker, (size_t)sysconf(_SC_PAGESIZE));
+        g_jitDumpMarker = nullptr;
+        close(fd);
+        return false;
+    }
+
+    JitDumpHeader header = {JITDUMP_MAGIC, JITDUMP_VERSION, sizeof(JitDumpHeader), 0, 0, (uint32_t)getpid(), jitDumpTimestamp(), 0};
+#if defined(_TARGET_AMD64_)
+    header.elfMach = EM_X86_64;
+#elif defined(_TARGET_X86_)
+    header.elfMach = EM_386;
+#elif defined(_TARGET_ARM64_)
+    header.elfMach = EM_AARCH64;
+#elif defined(_TARGET_ARM_)
+    header.elfMach = EM_ARM;
+#endif
+    fwrite(&header, sizeof(header), 1, g_jitDump);
+    return true;
+}
+
+static void writeJitDump(PyCodeObject* code, JittedCode* compiled, const char* name) {
+    if (g_jitDump == nullptr && !openJitDump())
+        return;
+    auto addr = (uint64_t)compiled->get_code_addr();
+    auto size = compiled->get_native_size();
+    auto fileName = PyUnicode_AsUTF8(code->co_filename);
+    if (fileName == nullptr) {
+        PyErr_Clear();
+        fileName = "<unknown>";
+    }
+
+    // Line entries have to be in native offset order and come before the code they describe
+    vector<pair<uint32_t, int>> lines;
+    auto sequencePoints = compiled->get_sequence_points();
+    for (size_t i = 0; i < compiled->get_sequence_points_length(); i++) {
+        lines.emplace_back(sequencePoints[i].nativeOffset, PyCode_Addr2Line(code, (int)sequencePoints[i].pythonOpcodeIndex));
+    }
+    sort(lines.begin(), lines.end());
+    if (!lines.empty()) {
+        JitDumpDebugInfo debugInfo = {{JIT_CODE_DEBUG_INFO, 0, jitDumpTimestamp()}, addr, lines.size()};
+        debugInfo.header.totalSize = sizeof(JitDumpDebugInfo) + lines.size() * (sizeof(JitDumpDebugEntry) + strlen(fileName) + 1);
+        fwrite(&debugInfo, sizeof(debugInfo), 1, g_jitDump);
+        for (auto & line : lines) {
+            JitDumpDebugEntry entry = {addr + line.first, (uint32_t)line.second, 0};
+            fwrite(&entry, sizeof(entry), 1, g_jitDump);
+            fwrite(fileName, strlen(fileName) + 1, 1, g_jitDump);
+        }
+    }
+
+    JitDumpCodeLoad load = {{JIT_CODE_LOAD, 0, jitDumpTimestamp()}, (uint32_t)getpid(), (uint32_t)syscall(SYS_gettid),
+                            addr, addr, size, g_jitDumpCodeIndex++};
+    load.header.totalSize = sizeof(JitDumpCodeLoad) + strlen(name) + 1 + size;
+    fwrite(&load, sizeof(load), 1, g_jitDump);
+    fwrite(name, strlen(name) + 1, 1, g_jitDump);
+    fwrite((void*)addr, size, 1, g_jitDump);
+    fflush(g_jitDump);
+}
+
+void PyJit_CloseJitDump() {
+    if (g_jitDump == nullptr)
+        return;
+    JitDumpRecordHeader closeRecord = {JIT_CODE_CLOSE, sizeof(JitDumpRecordHeader), jitDumpTimestamp()};
+    fwrite(&closeRecord, sizeof(closeRecord), 1, g_jitDump);
+    fclose(g_jitDump);
+    munmap(g_jitDumpMarker, (size_t)sysconf(_SC_PAGESIZE));
+    g_jitDump = nullptr;
+    g_jitDumpMarker = nullptr;
+}
+
+#else
+
+void PyJit_CloseJitDump() {
+}
+
+#endif
+
+void PyJit_PerfCodeLoaded(PyCodeObject* code, JittedCode* compiled) {
+    if (!PyJit_Settings().perfMap && !PyJit_Settings().jitdump)
+        return;
+    // Code objects don't have a qualified name before 3.11
+    auto name = PyUnicode_FromFormat("py::%U:%U:%d", code->co_name, code->co_filename, code->co_firstlineno);
+    if (name == nullptr) {
+        PyErr_Clear();
+        return;
+    }
+    auto utf8Name = PyUnicode_AsUTF8(name);
+    if (utf8Name == nullptr) {
+        PyErr_Clear();
+        Py_DECREF(name);
+        return;
+    }
+    if (PyJit_Settings().perfMap)
+        writePerfMap(compiled->get_code_addr(), compiled->get_native_size(), utf8Name);
+#ifdef __linux__
+    if (PyJit_Settings().jitdump)
+        writeJitDump(code, compiled, utf8Name);
+#endif
+    Py_DECREF(name);
+}
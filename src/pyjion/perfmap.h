@@ -0,0 +1,44 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+
+#ifndef PYJION_PERFMAP_H
+#define PYJION_PERFMAP_H
+
+#include <Python.h>
+
+class JittedCode;
+
+/* Describes compiled code to Linux perf. The perf map (/tmp/perf-<pid>.map) names each
+ * function, the jitdump file (/tmp/jit-<pid>.dump) also has a copy of the code and the
+ * native offset of each Python line so "perf inject --jit" can attribute samples to source.
+ * Enabled with PyJit_Settings().perfMap and PyJit_Settings().jitdump. */
+
+// Called for every successful compile
+void PyJit_PerfCodeLoaded(PyCodeObject* code, JittedCode* compiled);
+// Finishes and closes the jitdump file, a new one is started if jitdump is enabled again
+void PyJit_CloseJitDump();
+
+#endif //PYJION_PERFMAP_H
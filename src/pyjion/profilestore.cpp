@@ -0,0 +1,346 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+
+#include <marshal.h>
+#include <cstdio>
+#include "profilestore.h"
+#include "pyjit.h"
+
+#define PROFILE_STORE_VERSION 1
+
+// Profiles read by PyJit_LoadProfiles, {(name, filename, firstlineno, hash): (sites, deoptimized)}
+static PyObject* g_storedProfiles = nullptr;
+
+// FNV-1a of the bytecode, unlike hash() this is the same in every process
+static unsigned long long bytecodeHash(PyCodeObject* code) {
+    auto bytes = (unsigned char*)PyBytes_AS_STRING(code->co_code);
+    auto size = PyBytes_GET_SIZE(code->co_code);
+    unsigned long long hash = 14695981039346656037ULL;
+    for (Py_ssize_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Code objects don't have a qualified name in 3.9, the name and first line number are used instead
+static PyObject* codeIdentity(PyCodeObject* code) {
+    return Py_BuildValue("(OOiK)", code->co_name, code->co_filename, code->co_firstlineno, bytecodeHash(code));
+}
+
+static PyObject* typeIdentity(PyTypeObject* type) {
+    PyObject* module = PyObject_GetAttrString((PyObject*)type, "__module__");
+    PyObject* qualname = PyObject_GetAttrString((PyObject*)type, "__qualname__");
+    PyObject* res = nullptr;
+    if (module != nullptr && qualname != nullptr && PyUnicode_Check(module) && PyUnicode_Check(qualname))
+        res = PyTuple_Pack(2, module, qualname);
+    Py_XDECREF(module);
+    Py_XDECREF(qualname);
+    PyErr_Clear();
+    return res;
+}
+
+// Finds a type by module and qualified name. Only modules that are already imported are
+// searched, loading a profile never imports anything. Returns a new reference or nullptr.
+static PyTypeObject* resolveType(PyObject* moduleName, PyObject* qualname) {
+    PyObject* obj = PyImport_GetModule(moduleName);
+    if (obj == nullptr) {
+        PyErr_Clear();
+        return nullptr;
+    }
+    PyObject* parts = PyObject_CallMethod(qualname, "split", "s", ".");
+    if (parts == nullptr) {
+        Py_DECREF(obj);
+        PyErr_Clear();
+        return nullptr;
+    }
+    for (Py_ssize_t i = 0; i < PyList_GET_SIZE(parts) && obj != nullptr; i++) {
+        auto next = PyObject_GetAttr(obj, PyList_GET_ITEM(parts, i));
+        Py_DECREF(obj);
+        obj = next;
+    }
+    Py_DECREF(parts);
+    if (obj == nullptr || !PyType_Check(obj)) {
+        Py_XDECREF(obj);
+        PyErr_Clear();
+        return nullptr;
+    }
+    return (PyTypeObject*)obj;
+}
+
+// (sites, deoptimized) where sites is [(opcode position, [([(module, qualname, count)], megamorphic, big integer)])]
+static PyObject* profileToObject(PyjionCodeProfile* profile) {
+    PyObject* sites = PyList_New(0);
+    if (sites == nullptr)
+        return nullptr;
+    for (auto &site: profile->getSites()) {
+        PyObject* slots = PyList_New(0);
+        if (slots == nullptr)
+            goto error;
+        for (size_t i = 0; i < site.second; i++) {
+            auto slot = profile->getSlot(site.first, i);
+            size_t megamorphic = slot->megamorphic;
+            PyObject* types = PyList_New(0);
+            if (types == nullptr) {
+                Py_DECREF(slots);
+                goto error;
+            }
+            for (size_t t = 0; t < PGC_HISTOGRAM_SIZE; t++) {
+                if (slot->types[t] == nullptr)
+                    continue;
+                PyObject* identity = typeIdentity(slot->types[t]);
+                if (identity == nullptr) {
+                    // Can't be found again in another process, keep the count so the site's shape is the same
+                    megamorphic += slot->counts[t];
+                    continue;
+                }
+                PyObject* entry = Py_BuildValue("(OOn)", PyTuple_GET_ITEM(identity, 0), PyTuple_GET_ITEM(identity, 1), (Py_ssize_t)slot->counts[t]);
+                Py_DECREF(identity);
+                if (entry == nullptr || PyList_Append(types, entry) == -1) {
+                    Py_XDECREF(entry);
+                    Py_DECREF(types);
+                    Py_DECREF(slots);
+                    goto error;
+                }
+                Py_DECREF(entry);
+            }
+            PyObject* slotObj = Py_BuildValue("(Nnn)", types, (Py_ssize_t)megamorphic, (Py_ssize_t)slot->bigInteger);
+            if (slotObj == nullptr || PyList_Append(slots, slotObj) == -1) {
+                Py_XDECREF(slotObj);
+                Py_DECREF(slots);
+                goto error;
+            }
+            Py_DECREF(slotObj);
+        }
+        PyObject* siteObj = Py_BuildValue("(nN)", (Py_ssize_t)site.first, slots);
+        if (siteObj == nullptr || PyList_Append(sites, siteObj) == -1) {
+            Py_XDECREF(siteObj);
+            goto error;
+        }
+        Py_DECREF(siteObj);
+    }
+    {
+        PyObject* deoptimized = PyList_New(0);
+        if (deoptimized == nullptr)
+            goto error;
+        for (auto &site: profile->getDeoptimizedSites()) {
+            PyObject* position = PyLong_FromSize_t(site);
+            if (position == nullptr || PyList_Append(deoptimized, position) == -1) {
+                Py_XDECREF(position);
+                Py_DECREF(deoptimized);
+                goto error;
+            }
+            Py_DECREF(position);
+        }
+        return Py_BuildValue("(NN)", sites, deoptimized);
+    }
+error:
+    Py_DECREF(sites);
+    return nullptr;
+}
+
+bool PyJit_SaveProfiles(PyObject* path) {
+    PyObject* profiles = PyDict_New();
+    if (profiles == nullptr)
+        return false;
+    for (auto jitted: PyJit_GetJittedCode()) {
+        if (jitted->j_pgc_status == Uncompiled || jitted->j_profile == nullptr || jitted->j_profile->getSites().empty())
+            continue;
+        PyObject* key = codeIdentity((PyCodeObject*)jitted->j_code);
+        PyObject* value = profileToObject(jitted->j_profile);
+        if (key == nullptr || value == nullptr || PyDict_SetItem(profiles, key, value) == -1) {
+            Py_XDECREF(key);
+            Py_XDECREF(value);
+            Py_DECREF(profiles);
+            return false;
+        }
+        Py_DECREF(key);
+        Py_DECREF(value);
+    }
+    // Keep profiles that were loaded but haven't been used by this process
+    if (g_storedProfiles != nullptr && PyDict_Merge(profiles, g_storedProfiles, 0) == -1) {
+        Py_DECREF(profiles);
+        return false;
+    }
+
+    PyObject* data = Py_BuildValue("(iN)", PROFILE_STORE_VERSION, profiles);
+    if (data == nullptr)
+        return false;
+    PyObject* bytes = PyMarshal_WriteObjectToString(data, Py_MARSHAL_VERSION);
+    Py_DECREF(data);
+    if (bytes == nullptr)
+        return false;
+
+    PyObject* fsPath = nullptr;
+    if (!PyUnicode_FSConverter(path, &fsPath)) {
+        Py_DECREF(bytes);
+        return false;
+    }
+    FILE* file = fopen(PyBytes_AS_STRING(fsPath), "wb");
+    bool written = file != nullptr &&
+            fwrite(PyBytes_AS_STRING(bytes), 1, PyBytes_GET_SIZE(bytes), file) == (size_t)PyBytes_GET_SIZE(bytes);
+    if (file != nullptr && fclose(file) != 0)
+        written = false;
+    if (!written)
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+    Py_DECREF(fsPath);
+    Py_DECREF(bytes);
+    return written;
+}
+
+Py_ssize_t PyJit_LoadProfiles(PyObject* path) {
+    PyObject* fsPath = nullptr;
+    if (!PyUnicode_FSConverter(path, &fsPath))
+        return -1;
+    FILE* file = fopen(PyBytes_AS_STRING(fsPath), "rb");
+    Py_DECREF(fsPath);
+    if (file == nullptr) {
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+        return -1;
+    }
+    PyObject* data = PyMarshal_ReadObjectFromFile(file);
+    fclose(file);
+    if (data == nullptr)
+        return -1;
+
+    long version;
+    PyObject* profiles;
+    if (!PyTuple_Check(data) || !PyArg_ParseTuple(data, "lO!", &version, &PyDict_Type, &profiles)) {
+        Py_DECREF(data);
+        PyErr_SetString(PyExc_ValueError, "Not a Pyjion profile file");
+        return -1;
+    }
+    if (version != PROFILE_STORE_VERSION) {
+        Py_DECREF(data);
+        PyErr_Format(PyExc_ValueError, "Unsupported profile file version %ld", version);
+        return -1;
+    }
+    if (g_storedProfiles == nullptr)
+        g_storedProfiles = PyDict_New();
+    if (g_storedProfiles == nullptr || PyDict_Update(g_storedProfiles, profiles) == -1) {
+        Py_DECREF(data);
+        return -1;
+    }
+    Py_ssize_t loaded = PyDict_Size(profiles);
+    Py_DECREF(data);
+
+    for (auto jitted: PyJit_GetJittedCode()) {
+        PyJit_ApplyStoredProfile(jitted);
+    }
+    return loaded;
+}
+
+static void freeSlots(vector<pair<size_t, vector<PyjionProfileSlot>>>& sites) {
+    for (auto &site: sites) {
+        for (auto &slot: site.second) {
+            for (auto type: slot.types)
+                Py_XDECREF(type);
+        }
+    }
+}
+
+// Reads the slots of a stored profile, resolving the types. Returns false if it's malformed.
+static bool readSites(PyObject* sitesObj, vector<pair<size_t, vector<PyjionProfileSlot>>>& sites) {
+    if (!PyList_Check(sitesObj))
+        return false;
+    for (Py_ssize_t i = 0; i < PyList_GET_SIZE(sitesObj); i++) {
+        Py_ssize_t position;
+        PyObject* slotsObj;
+        if (!PyArg_ParseTuple(PyList_GET_ITEM(sitesObj, i), "nO!", &position, &PyList_Type, &slotsObj))
+            return false;
+        sites.emplace_back((size_t)position, vector<PyjionProfileSlot>(PyList_GET_SIZE(slotsObj)));
+        auto &slots = sites.back().second;
+        for (Py_ssize_t s = 0; s < PyList_GET_SIZE(slotsObj); s++) {
+            PyObject* typesObj;
+            Py_ssize_t megamorphic, bigInteger;
+            if (!PyArg_ParseTuple(PyList_GET_ITEM(slotsObj, s), "O!nn", &PyList_Type, &typesObj, &megamorphic, &bigInteger))
+                return false;
+            auto &slot = slots[s];
+            slot.megamorphic = megamorphic;
+            slot.bigInteger = bigInteger;
+            size_t next = 0;
+            for (Py_ssize_t t = 0; t < PyList_GET_SIZE(typesObj); t++) {
+                PyObject *module, *qualname;
+                Py_ssize_t count;
+                if (!PyArg_ParseTuple(PyList_GET_ITEM(typesObj, t), "UUn", &module, &qualname, &count))
+                    return false;
+                auto type = next < PGC_HISTOGRAM_SIZE ? resolveType(module, qualname) : nullptr;
+                if (type == nullptr) {
+                    slot.megamorphic += count;
+                } else {
+                    slot.types[next] = type;
+                    slot.counts[next++] = count;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void PyJit_ApplyStoredProfile(PyjionJittedCode* jitted) {
+    if (g_storedProfiles == nullptr || jitted->j_pgc_status != Uncompiled || jitted->j_profile == nullptr ||
+        !jitted->j_profile->getSites().empty() || jitted->j_addr.load() != nullptr)
+        return;
+    PyObject* key = codeIdentity((PyCodeObject*)jitted->j_code);
+    if (key == nullptr) {
+        PyErr_Clear();
+        return;
+    }
+    PyObject* stored = PyDict_GetItemWithError(g_storedProfiles, key);
+    Py_DECREF(key);
+    PyObject *sitesObj, *deoptimizedObj;
+    if (stored == nullptr || !PyArg_ParseTuple(stored, "O!O!", &PyList_Type, &sitesObj, &PyList_Type, &deoptimizedObj)) {
+        PyErr_Clear();
+        return;
+    }
+
+    vector<pair<size_t, vector<PyjionProfileSlot>>> sites;
+    if (!readSites(sitesObj, sites)) {
+        PyErr_Clear();
+        freeSlots(sites);
+        return;
+    }
+    vector<pair<size_t, size_t>> sizes;
+    for (auto &site: sites) {
+        sizes.emplace_back(site.first, site.second.size());
+    }
+    jitted->j_profile->allocateSlots(sizes);
+    for (auto &site: sites) {
+        for (size_t i = 0; i < site.second.size(); i++) {
+            *jitted->j_profile->getSlot(site.first, i) = site.second[i]; // takes the type references
+        }
+    }
+    for (Py_ssize_t i = 0; i < PyList_GET_SIZE(deoptimizedObj); i++) {
+        auto position = PyLong_AsSize_t(PyList_GET_ITEM(deoptimizedObj, i));
+        if (position == (size_t)-1 && PyErr_Occurred()) {
+            PyErr_Clear();
+            continue;
+        }
+        jitted->j_profile->deoptimize(position);
+    }
+    // The probe tier has already been run by the process that saved the profile
+    jitted->j_pgc_status = CompiledWithProbes;
+}
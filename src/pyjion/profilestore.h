@@ -0,0 +1,48 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+
+#ifndef PYJION_PROFILESTORE_H
+#define PYJION_PROFILESTORE_H
+
+#include <Python.h>
+
+class PyjionJittedCode;
+
+/* PGC profiles can be written to a file and loaded into another process so that functions
+ * skip the probe tier. Profiles are matched to code objects by name, filename, first line
+ * number and a hash of the bytecode, observed types by their module and qualified name. */
+
+// Writes the profile of every code object that has been through the probe tier to path.
+bool PyJit_SaveProfiles(PyObject* path);
+
+// Reads profiles from path, returning the number loaded or -1 on error. Profiles are applied
+// to matching code objects now and to any created later.
+Py_ssize_t PyJit_LoadProfiles(PyObject* path);
+
+// Fills the profile of jitted from a loaded profile for the same code, if there is one.
+void PyJit_ApplyStoredProfile(PyjionJittedCode* jitted);
+
+#endif //PYJION_PROFILESTORE_H
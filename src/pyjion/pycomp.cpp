@@ -28,6 +28,7 @@
 #include <corjit.h>
 
 #include <Python.h>
+#include <chrono>
 #include "pycomp.h"
 #include "pyjit.h"
 #include "unboxing.h"
@@ -40,7 +41,7 @@ BaseModule g_module;
 ICorJitCompiler* g_jit;
 
 PythonCompiler::PythonCompiler(PyCodeObject *code) :
-    m_il(m_module = new UserModule(g_module),
+    m_il(m_module = new UserModule(*PyJit_CurrentInterpreterState()->module),
         CORINFO_TYPE_NATIVEINT,
         std::vector < Parameter > {
         Parameter(CORINFO_TYPE_NATIVEINT), // PyjionJittedCode*
@@ -51,9 +52,11 @@ PythonCompiler::PythonCompiler(PyCodeObject *code) :
         })
 {
     this->m_code = code;
+    m_methodModule = PyJit_CurrentInterpreterState()->module;
     m_lasti = m_il.define_local(Parameter(CORINFO_TYPE_NATIVEINT));
     m_stacktop = m_il.define_local(Parameter(CORINFO_TYPE_NATIVEINT));
-    m_compileDebug = g_pyjionSettings.debug;
+    m_compileDebug = PyJit_Settings().debug;
+    m_compileMethodTime = 0;
 }
 
 void PythonCompiler::load_frame() {
@@ -153,6 +156,34 @@ void PythonCompiler::emit_profile_frame_exit() {
     m_il.emit_call(METHOD_PROFILE_FRAME_EXIT);
 }
 
+void PythonCompiler::emit_timing_entry(Local start) {
+    m_il.emit_call(METHOD_READ_TIMESTAMP);
+    emit_store_local(start);
+}
+
+void PythonCompiler::emit_timing_exit(Local start) {
+    // jitted->j_timingCycles += now - start, the jitted code object is arg 0
+    m_il.ld_arg(0);
+    m_il.ld_i(offsetof(PyjionJittedCode, j_timingCycles));
+    m_il.add();
+    m_il.dup();
+    m_il.ld_ind_i8();
+    m_il.emit_call(METHOD_READ_TIMESTAMP);
+    emit_load_local(start);
+    m_il.sub();
+    m_il.add();
+    m_il.st_ind_i8();
+    // jitted->j_timingCalls++
+    m_il.ld_arg(0);
+    m_il.ld_i(offsetof(PyjionJittedCode, j_timingCalls));
+    m_il.add();
+    m_il.dup();
+    m_il.ld_ind_i8();
+    m_il.ld_i8(1);
+    m_il.add();
+    m_il.st_ind_i8();
+}
+
 void PythonCompiler::emit_trace_exception() {
     load_frame();
     m_il.emit_call(METHOD_TRACE_EXCEPTION);
@@ -929,11 +960,11 @@ void PythonCompiler::emit_load_attr(PyObject* name, AbstractValueWithSources obj
             emit_load_local(objLocal);
             decref();
         } else {
-            auto getattro_token = g_module.AddMethod(CORINFO_TYPE_NATIVEINT,
-                                                     vector<Parameter>{
-                                                             Parameter(CORINFO_TYPE_NATIVEINT),
-                                                             Parameter(CORINFO_TYPE_NATIVEINT)},
-                                                     (void *) obj.Value->pythonType()->tp_getattro);
+            auto getattro_token = m_methodModule->AddMethod(CORINFO_TYPE_NATIVEINT,
+                                                            vector<Parameter>{
+                                                                    Parameter(CORINFO_TYPE_NATIVEINT),
+                                                                    Parameter(CORINFO_TYPE_NATIVEINT)},
+                                                            (void *) obj.Value->pythonType()->tp_getattro);
             emit_load_local(objLocal);
             m_il.ld_i(name);
             m_il.emit_call(getattro_token);
@@ -941,11 +972,11 @@ void PythonCompiler::emit_load_attr(PyObject* name, AbstractValueWithSources obj
             decref();
         }
     } else if (obj.Value->pythonType() != nullptr && obj.Value->pythonType()->tp_getattr) {
-        auto getattr_token = g_module.AddMethod(CORINFO_TYPE_NATIVEINT,
-                                                 vector<Parameter>{
-                                                         Parameter(CORINFO_TYPE_NATIVEINT),
-                                                         Parameter(CORINFO_TYPE_NATIVEINT)},
-                                                 (void *) obj.Value->pythonType()->tp_getattr);
+        auto getattr_token = m_methodModule->AddMethod(CORINFO_TYPE_NATIVEINT,
+                                                        vector<Parameter>{
+                                                                Parameter(CORINFO_TYPE_NATIVEINT),
+                                                                Parameter(CORINFO_TYPE_NATIVEINT)},
+                                                        (void *) obj.Value->pythonType()->tp_getattr);
         emit_load_local(objLocal);
         m_il.ld_i((void*)PyUnicode_AsUTF8((PyObject*)name));
         m_il.emit_call(getattr_token);
@@ -1745,8 +1776,146 @@ void PythonCompiler::emit_for_next(AbstractValueWithSources iterator) {
      *  - 0xff (StopIter/ iterator exhausted)
      *  - PyObject* (next item in iteration)
      */
-    // TODO : Implement a guard-safe iterator
-    return emit_for_next();
+    auto kind = iterableKind(iterator);
+    if (kind != AVK_RangeIterator && kind != AVK_List && kind != AVK_Tuple)
+        return emit_for_next();
+
+    Local iter = emit_define_local(LK_Pointer);
+    Label generic = emit_define_label();
+    Label done = emit_define_label();
+    emit_store_local(iter);
+
+    if (kind == AVK_RangeIterator) {
+        Label exhausted = emit_define_label();
+        emit_range_iterator_next(iter, generic, exhausted);
+        emit_box(AVK_Integer);
+        emit_branch(BranchAlways, done);
+
+        emit_mark_label(exhausted);
+        emit_ptr((void*)0xff);
+        emit_branch(BranchAlways, done);
+    } else {
+        emit_sequence_iterator_next(iter, kind, generic);
+        emit_branch(BranchAlways, done);
+    }
+
+    emit_mark_label(generic);
+    emit_load_local(iter);
+    emit_for_next();
+
+    emit_mark_label(done);
+    emit_free_local(iter);
+}
+
+void PythonCompiler::emit_for_next_unboxed(Label exhausted, Label generic) {
+    Local iter = emit_define_local(LK_Pointer);
+    emit_dup();
+    emit_store_local(iter);
+    emit_range_iterator_next(iter, generic, exhausted);
+    emit_free_local(iter);
+}
+
+// The inline equivalent of listiter_next and tupleiter_next, leaves a new reference to the next item
+// on the stack. The size is read on every step as the loop body can change the list. An exhausted
+// iterator goes to generic, which clears it_seq and reports StopIteration like the interpreter.
+void PythonCompiler::emit_sequence_iterator_next(Local iterator, AbstractValueKind kind, Label generic) {
+    Local seq = emit_define_local(LK_Pointer);
+    Local index = emit_define_local(LK_NativeInt);
+
+    emit_load_local(iterator);
+    LD_FIELDI(PyObject, ob_type);
+    emit_ptr(kind == AVK_List ? &PyListIter_Type : &PyTupleIter_Type);
+    emit_branch(BranchNotEqual, generic);
+
+    emit_load_local(iterator);
+    LD_FIELDI(PyjionSequenceIterator, it_seq);
+    emit_store_local(seq);
+    emit_load_local(seq);
+    emit_branch(BranchFalse, generic);
+
+    emit_load_local(iterator);
+    LD_FIELDI(PyjionSequenceIterator, it_index);
+    emit_store_local(index);
+    emit_load_local(index);
+    emit_load_local(seq);
+    LD_FIELDI(PyVarObject, ob_size);
+    emit_branch(BranchGreaterThanEqual, generic);
+
+    // ob_item[index]
+    emit_load_local(seq);
+    if (kind == AVK_List) {
+        LD_FIELDI(PyListObject, ob_item);
+    } else {
+        LD_FIELDA(PyTupleObject, ob_item);
+    }
+    emit_load_local(index);
+    emit_sizet(sizeof(PyObject*));
+    m_il.mul();
+    m_il.add();
+    m_il.ld_ind_i();
+    emit_dup();
+    emit_incref();
+
+    // it_index++
+    emit_load_local(iterator);
+    LD_FIELDA(PyjionSequenceIterator, it_index);
+    emit_load_local(index);
+    emit_sizet(1);
+    m_il.add();
+    m_il.st_ind_i();
+
+    emit_free_local(seq);
+    emit_free_local(index);
+}
+
+// Loads a long field of a range iterator as an int64
+void PythonCompiler::load_range_iterator_field(Local iterator, size_t offset) {
+    emit_load_local(iterator);
+    m_il.ld_i((int32_t)offset);
+    m_il.add();
+#if SIZEOF_LONG == 8
+    m_il.ld_ind_i8();
+#else
+    m_il.ld_ind_i4();
+    m_il.conv_i8();
+#endif
+}
+
+// The inline equivalent of rangeiter_next, leaves the next value on the stack as an int64. Branches
+// to generic if the iterator isn't a range iterator and to exhausted at the end of the range.
+void PythonCompiler::emit_range_iterator_next(Local iterator, Label generic, Label exhausted) {
+    emit_load_local(iterator);
+    LD_FIELDI(PyObject, ob_type);
+    emit_ptr(&PyRangeIter_Type);
+    emit_branch(BranchNotEqual, generic);
+
+    load_range_iterator_field(iterator, offsetof(PyjionRangeIterator, index));
+    load_range_iterator_field(iterator, offsetof(PyjionRangeIterator, len));
+    emit_branch(BranchGreaterThanEqual, exhausted);
+
+    // start + index * step
+    load_range_iterator_field(iterator, offsetof(PyjionRangeIterator, start));
+    load_range_iterator_field(iterator, offsetof(PyjionRangeIterator, index));
+    load_range_iterator_field(iterator, offsetof(PyjionRangeIterator, step));
+    m_il.mul();
+    m_il.add();
+
+    // index++
+    emit_load_local(iterator);
+    LD_FIELDA(PyjionRangeIterator, index);
+    emit_load_local(iterator);
+    LD_FIELDA(PyjionRangeIterator, index);
+#if SIZEOF_LONG == 8
+    m_il.ld_ind_i8();
+    m_il.ld_i8(1);
+    m_il.add();
+    m_il.st_ind_i8();
+#else
+    m_il.ld_ind_i4();
+    m_il.ld_i4(1);
+    m_il.add();
+    m_il.st_ind_i4();
+#endif
 }
 
 void PythonCompiler::emit_debug_msg(const char* msg) {
@@ -1832,6 +2001,308 @@ LocalKind PythonCompiler::emit_binary_int(uint16_t opcode) {
     return LK_Int;
 }
 
+LocalKind PythonCompiler::emit_binary_int_checked(uint16_t opcode, Local left, AbstractValueKind leftKind, Local right, AbstractValueKind rightKind, Label overflow) {
+    // bool & bool, bool | bool and bool ^ bool are bools
+    if (leftKind == AVK_Bool && rightKind == AVK_Bool) {
+        switch (opcode) {
+            case BINARY_AND:
+            case INPLACE_AND:
+            case BINARY_OR:
+            case INPLACE_OR:
+            case BINARY_XOR:
+            case INPLACE_XOR:
+                emit_load_local(left);
+                emit_load_local(right);
+                emit_bitwise_int(opcode);
+                return LK_Bool;
+        }
+    }
+
+    // Widen bools to int64, the checks below reload the operands
+    if (leftKind == AVK_Bool) {
+        Local wide = emit_define_local(LK_Int);
+        emit_load_local(left);
+        m_il.conv_i8();
+        emit_store_local(wide);
+        left = wide;
+    }
+    if (rightKind == AVK_Bool) {
+        Local wide = emit_define_local(LK_Int);
+        emit_load_local(right);
+        m_il.conv_i8();
+        emit_store_local(wide);
+        right = wide;
+    }
+
+    // Negative and 64+ bit shift counts are left to PyLong (ValueError, 0 or -1, or a big integer)
+    switch (opcode) { // NOLINT(hicpp-multiway-paths-covered)
+        case BINARY_LSHIFT:
+        case INPLACE_LSHIFT:
+        case BINARY_RSHIFT:
+        case INPLACE_RSHIFT:
+            emit_load_local(right);
+            m_il.ld_i8(63);
+            emit_branch(BranchGreaterThanUnsigned, overflow);
+            break;
+    }
+
+    Local result = emit_define_local(LK_Int);
+    emit_load_local(left);
+    emit_load_local(right);
+    switch (opcode) {
+        case BINARY_ADD:
+        case INPLACE_ADD:
+            m_il.add();
+            emit_store_local(result);
+            // Overflowed if the sign of the result differs from both operands
+            emit_load_local(left);
+            emit_load_local(result);
+            m_il.bitwise_xor();
+            emit_load_local(right);
+            emit_load_local(result);
+            m_il.bitwise_xor();
+            m_il.bitwise_and();
+            m_il.ld_i8(0);
+            emit_branch(BranchLessThan, overflow);
+            break;
+        case BINARY_SUBTRACT:
+        case INPLACE_SUBTRACT:
+            m_il.sub();
+            emit_store_local(result);
+            // Overflowed if the operands have different signs and the result's sign differs from left
+            emit_load_local(left);
+            emit_load_local(right);
+            m_il.bitwise_xor();
+            emit_load_local(left);
+            emit_load_local(result);
+            m_il.bitwise_xor();
+            m_il.bitwise_and();
+            m_il.ld_i8(0);
+            emit_branch(BranchLessThan, overflow);
+            break;
+        case BINARY_MULTIPLY:
+        case INPLACE_MULTIPLY: {
+            Label slowCheck = emit_define_label();
+            Label notNegativeOne = emit_define_label();
+            Label checked = emit_define_label();
+            m_il.mul();
+            emit_store_local(result);
+            // Both operands fit in 32 bits, so the product can't overflow
+            emit_load_local(left);
+            m_il.ld_i8(0x80000000LL);
+            m_il.add();
+            m_il.ld_i8(0xFFFFFFFFLL);
+            emit_branch(BranchGreaterThanUnsigned, slowCheck);
+            emit_load_local(right);
+            m_il.ld_i8(0x80000000LL);
+            m_il.add();
+            m_il.ld_i8(0xFFFFFFFFLL);
+            emit_branch(BranchLessThanEqualUnsigned, checked);
+
+            emit_mark_label(slowCheck);
+            emit_load_local(right);
+            emit_branch(BranchFalse, checked);
+            // result / -1 traps for INT64_MIN, which is also the only overflowing case for -1
+            emit_load_local(right);
+            m_il.ld_i8(-1);
+            emit_branch(BranchNotEqual, notNegativeOne);
+            emit_load_local(left);
+            m_il.ld_i8(INT64_MIN);
+            emit_branch(BranchEqual, overflow);
+            emit_branch(BranchAlways, checked);
+
+            emit_mark_label(notNegativeOne);
+            emit_load_local(result);
+            emit_load_local(right);
+            m_il.div();
+            emit_load_local(left);
+            emit_branch(BranchNotEqual, overflow);
+            emit_mark_label(checked);
+            break;
+        }
+        case BINARY_AND:
+        case INPLACE_AND:
+        case BINARY_OR:
+        case INPLACE_OR:
+        case BINARY_XOR:
+        case INPLACE_XOR:
+            emit_bitwise_int(opcode);
+            emit_store_local(result);
+            break;
+        case BINARY_LSHIFT:
+        case INPLACE_LSHIFT:
+            m_il.conv_i();
+            m_il.shl();
+            emit_store_local(result);
+            // Overflowed if shifting back doesn't give the original value
+            emit_load_local(result);
+            emit_load_local(right);
+            m_il.conv_i();
+            m_il.shr();
+            emit_load_local(left);
+            emit_branch(BranchNotEqual, overflow);
+            break;
+        case BINARY_RSHIFT:
+        case INPLACE_RSHIFT:
+            m_il.conv_i();
+            m_il.shr();
+            emit_store_local(result);
+            break;
+        default:
+            throw UnexpectedValueException();
+    }
+    emit_load_and_free_local(result);
+    if (leftKind == AVK_Bool)
+        emit_free_local(left);
+    if (rightKind == AVK_Bool)
+        emit_free_local(right);
+    return LK_Int;
+}
+
+void PythonCompiler::emit_math_function_call(MathFunction function, PyObject* target, bool isMethod, Local argument, AbstractValueKind argKind, Label generic) {
+    // The compiled code keeps the function it guards on alive
+    m_module->AddReference(target);
+    Local callee = emit_define_local(LK_Pointer);
+    Local result = emit_define_local(function == MathFloor ? LK_Int : LK_Float);
+    emit_dup();
+    emit_store_local(callee);
+
+    emit_load_local(callee);
+    if (isMethod) {
+        LD_FIELDI(PyJitMethodLocation, method);
+        emit_ptr(target);
+        emit_branch(BranchNotEqual, generic);
+        emit_load_local(callee);
+        LD_FIELDI(PyJitMethodLocation, object);
+        emit_branch(BranchTrue, generic);
+    } else {
+        emit_ptr(target);
+        emit_branch(BranchNotEqual, generic);
+    }
+
+    if (function == MathFloor && argKind == AVK_Integer) {
+        emit_load_local(argument);
+        emit_store_local(result);
+    } else {
+        emit_load_local(argument);
+        if (argKind == AVK_Integer)
+            m_il.conv_r8();
+        switch (function) {
+            case MathSqrt: m_il.emit_call(METHOD_FLOAT_SQRT_TOKEN); break;
+            case MathSin: m_il.emit_call(METHOD_FLOAT_SIN_TOKEN); break;
+            case MathCos: m_il.emit_call(METHOD_FLOAT_COS_TOKEN); break;
+            case MathExp: m_il.emit_call(METHOD_FLOAT_EXP_TOKEN); break;
+            case MathFloor: m_il.emit_call(METHOD_FLOAT_FLOOR_TOKEN); break;
+            default:
+                throw UnexpectedValueException();
+        }
+        Local value = emit_define_local(LK_Float);
+        emit_store_local(value);
+        if (function == MathFloor) {
+            // NaN, infinities and anything outside of int64 go to int(), unordered compares are true for NaN
+            emit_load_local(value);
+            m_il.ld_r8(-9223372036854775808.0);
+            emit_branch(BranchLessThanUnsigned, generic);
+            emit_load_local(value);
+            m_il.ld_r8(9223372036854775808.0);
+            emit_branch(BranchGreaterThanEqualUnsigned, generic);
+            emit_load_local(value);
+            m_il.conv_i8();
+        } else {
+            // value - value is NaN if value is NaN or infinite, which could be a domain or range error
+            Label finite = emit_define_label();
+            emit_load_local(value);
+            emit_load_local(value);
+            m_il.sub();
+            emit_load_local(value);
+            emit_load_local(value);
+            m_il.sub();
+            emit_branch(BranchEqual, finite);
+            emit_branch(BranchAlways, generic);
+            emit_mark_label(finite);
+            emit_load_local(value);
+        }
+        emit_store_local(result);
+        emit_free_local(value);
+    }
+
+    // Release the callee the same way the call helpers do
+    if (isMethod) {
+        emit_load_local(callee);
+        LD_FIELDI(PyJitMethodLocation, method);
+        decref();
+        emit_load_local(callee);
+        decref();
+        emit_pop(); // method location
+        emit_pop(); // self
+    } else {
+        emit_load_local(callee);
+        decref();
+        emit_pop();
+    }
+    emit_load_and_free_local(result);
+    emit_free_local(callee);
+}
+
+void PythonCompiler::emit_bitwise_int(uint16_t opcode) {
+    switch (opcode) {
+        case BINARY_AND:
+        case INPLACE_AND:
+            m_il.bitwise_and();
+            break;
+        case BINARY_OR:
+        case INPLACE_OR:
+            m_il.bitwise_or();
+            break;
+        case BINARY_XOR:
+        case INPLACE_XOR:
+            m_il.bitwise_xor();
+            break;
+        default:
+            throw UnexpectedValueException();
+    }
+}
+
+LocalKind PythonCompiler::emit_unary_unboxed(uint16_t opcode, Local value, AbstractValueKind kind, Label overflow) {
+    switch (opcode) {
+        case UNARY_NOT:
+            emit_load_local(value);
+            if (kind == AVK_Float)
+                m_il.ld_r8(0.0);
+            else if (kind == AVK_Integer)
+                m_il.ld_i8(0);
+            else
+                m_il.ld_i4(0);
+            m_il.compare_eq();
+            return LK_Bool;
+        case UNARY_NEGATIVE:
+            if (kind == AVK_Float) {
+                emit_load_local(value);
+                m_il.neg();
+                return LK_Float;
+            }
+            if (kind == AVK_Integer) {
+                // -INT64_MIN doesn't fit
+                emit_load_local(value);
+                m_il.ld_i8(INT64_MIN);
+                emit_branch(BranchEqual, overflow);
+            }
+            emit_load_local(value);
+            if (kind == AVK_Bool)
+                m_il.conv_i8();
+            m_il.neg();
+            return LK_Int;
+        case UNARY_INVERT:
+            emit_load_local(value);
+            if (kind == AVK_Bool)
+                m_il.conv_i8();
+            m_il.bitwise_not();
+            return LK_Int;
+        default:
+            throw UnexpectedValueException();
+    }
+}
+
 void PythonCompiler::emit_binary_subscr(uint16_t opcode, AbstractValueWithSources left, AbstractValueWithSources right) {
     if (OPT_ENABLED(knownBinarySubscr)){
         emit_binary_subscr(left, right);
@@ -2096,18 +2567,18 @@ void PythonCompiler::emit_call_function_inline(py_oparg n_args, AbstractValueWit
             int builtinToken;
             if (flags & METH_KEYWORDS) {
                 emit_null();
-                builtinToken = g_module.AddMethod(CORINFO_TYPE_NATIVEINT,
-                                                  vector<Parameter>{
-                                                          Parameter(CORINFO_TYPE_NATIVEINT), // Self
-                                                          Parameter(CORINFO_TYPE_NATIVEINT), // Args-tuple
-                                                          Parameter(CORINFO_TYPE_NATIVEINT)}, // kwargs
-                                                  (void *) meth);
+                builtinToken = m_methodModule->AddMethod(CORINFO_TYPE_NATIVEINT,
+                                                         vector<Parameter>{
+                                                                 Parameter(CORINFO_TYPE_NATIVEINT), // Self
+                                                                 Parameter(CORINFO_TYPE_NATIVEINT), // Args-tuple
+                                                                 Parameter(CORINFO_TYPE_NATIVEINT)}, // kwargs
+                                                         (void *) meth);
             } else {
-                builtinToken = g_module.AddMethod(CORINFO_TYPE_NATIVEINT,
-                                                  vector<Parameter>{
-                                                          Parameter(CORINFO_TYPE_NATIVEINT), // Self
-                                                          Parameter(CORINFO_TYPE_NATIVEINT)}, // Args-tuple
-                                                  (void *) meth);
+                builtinToken = m_methodModule->AddMethod(CORINFO_TYPE_NATIVEINT,
+                                                         vector<Parameter>{
+                                                                 Parameter(CORINFO_TYPE_NATIVEINT), // Self
+                                                                 Parameter(CORINFO_TYPE_NATIVEINT)}, // Args-tuple
+                                                         (void *) meth);
             }
             m_il.emit_call(builtinToken);
 
@@ -2132,8 +2603,17 @@ void PythonCompiler::emit_call_function_inline(py_oparg n_args, AbstractValueWit
 }
 
 JittedCode* PythonCompiler::emit_compile() {
-    auto* jitInfo = new CorJitInfo(PyUnicode_AsUTF8(m_code->co_filename), PyUnicode_AsUTF8(m_code->co_name), m_module, m_compileDebug);
+    auto* jitInfo = new CorJitInfo(PyUnicode_AsUTF8(m_code->co_filename), PyUnicode_AsUTF8(m_code->co_name), m_module, m_compileDebug, PyJit_Settings().jitdump);
+    auto start = chrono::steady_clock::now();
+    // The CLR JIT only works on the IL and Pyjion's own structures, so let other threads run while it generates
+    // native code. Keep the GIL during finalization, a thread that releases it then won't get it back.
+    PyThreadState* threadState = _Py_IsFinalizing() ? nullptr : PyEval_SaveThread();
     auto addr = m_il.compile(jitInfo, g_jit, m_code->co_stacksize + 100).m_addr;
+    if (threadState != nullptr)
+        PyEval_RestoreThread(threadState);
+    if (addr != nullptr && PyJit_Settings().gdbJit)
+        jitInfo->registerWithDebugger();
+    m_compileMethodTime = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
     if (addr == nullptr) {
 #ifdef DEBUG
         printf("Compiling failed %s from %s line %d\r\n",
@@ -2157,16 +2637,116 @@ JittedCode* PythonCompiler::emit_compile() {
     return jitInfo;
 }
 
+uint64_t PythonCompiler::get_compile_method_time() {
+    return m_compileMethodTime;
+}
+
 void PythonCompiler::mark_sequence_point(size_t idx) {
     m_il.mark_sequence_point(idx);
 }
 
-void PythonCompiler::emit_pgc_profile_capture(Local value, size_t ipos, size_t istack) {
-    m_il.ld_arg(3);
+void PythonCompiler::emit_pgc_profile_capture(Local value, PyjionProfileSlot* slot) {
+    Label done = emit_define_label();
+    Label recorded = emit_define_label();
+
+    // Generators and coroutines aren't profiled
+    emit_load_local(value);
+    emit_branch(BranchFalse, done);
+    emit_load_local(value);
+    LD_FIELDI(PyObject, ob_type);
+    emit_ptr(&PyGen_Type);
+    emit_branch(BranchEqual, done);
     emit_load_local(value);
-    emit_sizet(ipos);
-    emit_sizet(istack);
-    m_il.emit_call(METHOD_PGC_PROBE);
+    LD_FIELDI(PyObject, ob_type);
+    emit_ptr(&PyCoro_Type);
+    emit_branch(BranchEqual, done);
+
+    // Count the type in the histogram, claiming the first free entry for a new type.
+    // Once the histogram is full any other type is counted as megamorphic.
+    Local type = emit_define_local(LK_Pointer);
+    emit_load_local(value);
+    LD_FIELDI(PyObject, ob_type);
+    emit_store_local(type);
+    for (size_t i = 0; i < PGC_HISTOGRAM_SIZE; i++) {
+        Label notThisType = emit_define_label();
+        Label notFree = emit_define_label();
+
+        emit_ptr(&slot->types[i]);
+        m_il.ld_ind_i();
+        emit_load_local(type);
+        emit_branch(BranchNotEqual, notThisType);
+        increment_counter(&slot->counts[i]);
+        emit_branch(BranchAlways, recorded);
+        emit_mark_label(notThisType);
+
+        emit_ptr(&slot->types[i]);
+        m_il.ld_ind_i();
+        emit_branch(BranchTrue, notFree);
+        emit_ptr(&slot->types[i]);
+        emit_load_local(type);
+        m_il.st_ind_i();
+        emit_load_local(type);
+        emit_incref();
+        increment_counter(&slot->counts[i]);
+        emit_branch(BranchAlways, recorded);
+        emit_mark_label(notFree);
+    }
+    increment_counter(&slot->megamorphic);
+    emit_mark_label(recorded);
+    emit_free_local(type);
+
+    // Flag ints of more than two digits as big integers, two digits always fit in an int64
+    emit_load_local(value);
+    LD_FIELDI(PyObject, ob_type);
+    emit_ptr(&PyLong_Type);
+    emit_branch(BranchNotEqual, done);
+    emit_load_local(value);
+    LD_FIELDI(PyVarObject, ob_size);
+    m_il.ld_i(2);
+    m_il.add();
+    m_il.ld_i(4);
+    emit_branch(BranchLessThanEqualUnsigned, done);
+    emit_ptr(&slot->bigInteger);
+    m_il.ld_i(1);
+    m_il.st_ind_i();
+
+    emit_mark_label(done);
+}
+
+void PythonCompiler::increment_counter(size_t* counter) {
+    emit_ptr(counter);
+    m_il.dup();
+    m_il.ld_ind_i();
+    m_il.ld_i(1);
+    m_il.add();
+    m_il.st_ind_i();
+}
+
+void PythonCompiler::emit_count_backedge() {
+    // jitted->j_backedge_count++, the jitted code object is arg 0
+    m_il.ld_arg(0);
+    m_il.ld_i(offsetof(PyjionJittedCode, j_backedge_count));
+    m_il.add();
+    m_il.dup();
+    m_il.ld_ind_i8();
+    m_il.ld_i8(1);
+    m_il.add();
+    m_il.st_ind_i8();
+}
+
+void PythonCompiler::emit_count_opcode(py_opindex idx) {
+    // jitted->j_opcodeCounts[idx / sizeof(_Py_CODEUNIT)]++, the jitted code object is arg 0
+    m_il.ld_arg(0);
+    m_il.ld_i(offsetof(PyjionJittedCode, j_opcodeCounts));
+    m_il.add();
+    m_il.ld_ind_i();
+    m_il.ld_i(idx / sizeof(_Py_CODEUNIT) * sizeof(PY_UINT64_T));
+    m_il.add();
+    m_il.dup();
+    m_il.ld_ind_i8();
+    m_il.ld_i8(1);
+    m_il.add();
+    m_il.st_ind_i8();
 }
 
 void PythonCompiler::emit_box(AbstractValueKind kind) {
@@ -2218,6 +2798,32 @@ void PythonCompiler::emit_guard_exception(const char* expected){
     m_il.emit_call(METHOD_PGC_GUARD_EXCEPTION);
 }
 
+void PythonCompiler::emit_unbox_guard(Local value, AbstractValueKind kind, Label failed) {
+    // Same type checks as the guards in emit_unbox, but leaves the value untouched
+    emit_load_local(value);
+    LD_FIELDI(PyObject, ob_type);
+    switch (kind) {
+        case AVK_Float:
+            emit_ptr(&PyFloat_Type);
+            break;
+        case AVK_Integer:
+            emit_ptr(&PyLong_Type);
+            break;
+        case AVK_Bool:
+            emit_ptr(&PyBool_Type);
+            break;
+        default:
+            throw UnexpectedValueException();
+    }
+    emit_branch(BranchNotEqual, failed);
+}
+
+void PythonCompiler::emit_pgc_deoptimize(py_opindex index) {
+    m_il.ld_arg(3);
+    emit_sizet(index);
+    m_il.emit_call(METHOD_PGC_DEOPTIMIZE);
+}
+
 void PythonCompiler::emit_unbox(AbstractValueKind kind, bool guard, Local success) {
 #ifdef DEBUG
     assert(supportsEscaping(kind));
@@ -2584,6 +3190,10 @@ GLOBAL_METHOD(METHOD_ISNOT_BOOL, &PyJit_IsNot_Bool, CORINFO_TYPE_INT, Parameter(
 
 GLOBAL_METHOD(METHOD_FLOAT_POWER_TOKEN, &PyJit_DoublePow, CORINFO_TYPE_DOUBLE, Parameter(CORINFO_TYPE_DOUBLE), Parameter(CORINFO_TYPE_DOUBLE));
 GLOBAL_METHOD(METHOD_FLOAT_FLOOR_TOKEN, static_cast<double(*)(double)>(floor), CORINFO_TYPE_DOUBLE, Parameter(CORINFO_TYPE_DOUBLE));
+GLOBAL_METHOD(METHOD_FLOAT_SQRT_TOKEN, static_cast<double(*)(double)>(sqrt), CORINFO_TYPE_DOUBLE, Parameter(CORINFO_TYPE_DOUBLE));
+GLOBAL_METHOD(METHOD_FLOAT_SIN_TOKEN, static_cast<double(*)(double)>(sin), CORINFO_TYPE_DOUBLE, Parameter(CORINFO_TYPE_DOUBLE));
+GLOBAL_METHOD(METHOD_FLOAT_COS_TOKEN, static_cast<double(*)(double)>(cos), CORINFO_TYPE_DOUBLE, Parameter(CORINFO_TYPE_DOUBLE));
+GLOBAL_METHOD(METHOD_FLOAT_EXP_TOKEN, static_cast<double(*)(double)>(exp), CORINFO_TYPE_DOUBLE, Parameter(CORINFO_TYPE_DOUBLE));
 GLOBAL_METHOD(METHOD_INT_POWER, PyJit_LongPow, CORINFO_TYPE_LONG, Parameter(CORINFO_TYPE_LONG), Parameter(CORINFO_TYPE_LONG));
 GLOBAL_METHOD(METHOD_INT_FLOOR_DIVIDE, PyJit_LongFloorDivide, CORINFO_TYPE_LONG, Parameter(CORINFO_TYPE_LONG), Parameter(CORINFO_TYPE_LONG));
 GLOBAL_METHOD(METHOD_INT_TRUE_DIVIDE, PyJit_LongTrueDivide, CORINFO_TYPE_DOUBLE, Parameter(CORINFO_TYPE_LONG), Parameter(CORINFO_TYPE_LONG));
@@ -2630,13 +3240,14 @@ GLOBAL_METHOD(METHOD_TRACE_FRAME_EXIT, &PyJit_TraceFrameExit, CORINFO_TYPE_VOID,
 GLOBAL_METHOD(METHOD_TRACE_EXCEPTION, &PyJit_TraceFrameException, CORINFO_TYPE_VOID, Parameter(CORINFO_TYPE_NATIVEINT), );
 GLOBAL_METHOD(METHOD_PROFILE_FRAME_ENTRY, &PyJit_ProfileFrameEntry, CORINFO_TYPE_VOID, Parameter(CORINFO_TYPE_NATIVEINT), );
 GLOBAL_METHOD(METHOD_PROFILE_FRAME_EXIT, &PyJit_ProfileFrameExit, CORINFO_TYPE_VOID, Parameter(CORINFO_TYPE_NATIVEINT), );
+GLOBAL_METHOD(METHOD_READ_TIMESTAMP, &PyJit_ReadTimestamp, CORINFO_TYPE_LONG);
 
 GLOBAL_METHOD(METHOD_LOAD_CLOSURE, &PyJit_LoadClosure, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_INT));
 
 GLOBAL_METHOD(METHOD_PENDING_CALLS, &Py_MakePendingCalls, CORINFO_TYPE_INT, );
 
-GLOBAL_METHOD(METHOD_PGC_PROBE, &capturePgcStackValue, CORINFO_TYPE_VOID, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
 GLOBAL_METHOD(METHOD_PGC_GUARD_EXCEPTION, &PyJit_PgcGuardException, CORINFO_TYPE_VOID, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_PGC_DEOPTIMIZE, &deoptimizePgcSite, CORINFO_TYPE_VOID, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
 GLOBAL_METHOD(METHOD_SEQUENCE_AS_LIST, &PySequence_List, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT));
 GLOBAL_METHOD(METHOD_LIST_ITEM_FROM_BACK, &PyJit_GetListItemReversed, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
 
@@ -215,8 +215,9 @@
 #define METHOD_TRACE_EXCEPTION       0x00030013
 #define METHOD_PROFILE_FRAME_ENTRY   0x00030014
 #define METHOD_PROFILE_FRAME_EXIT    0x00030015
-#define METHOD_PGC_PROBE             0x00030016
 #define METHOD_PGC_GUARD_EXCEPTION   0x00030017
+#define METHOD_PGC_DEOPTIMIZE        0x00030018
+#define METHOD_READ_TIMESTAMP        0x00030019
 
 #define METHOD_ITERNEXT_TOKEN        0x00040000
 
@@ -227,6 +228,10 @@
 #define METHOD_INT_FLOOR_DIVIDE     0x00050004
 #define METHOD_INT_TRUE_DIVIDE      0x00050005
 #define METHOD_INT_MOD              0x00050006
+#define METHOD_FLOAT_SQRT_TOKEN     0x00050007
+#define METHOD_FLOAT_SIN_TOKEN      0x00050008
+#define METHOD_FLOAT_COS_TOKEN      0x00050009
+#define METHOD_FLOAT_EXP_TOKEN      0x0005000A
 
 #define METHOD_STORE_SUBSCR_OBJ       0x00060000
 #define METHOD_STORE_SUBSCR_OBJ_I     0x00060001
@@ -253,6 +258,22 @@
 #define LD_FIELDI(type, field) if(offsetof(type, field)>0) {m_il.ld_i((int32_t)offsetof(type, field)); m_il.add();} m_il.ld_ind_i();
 #define LD_FIELDR8(type, field) if(offsetof(type, field)>0) {m_il.ld_i((int32_t)offsetof(type, field)); m_il.add();} m_il.ld_ind_r8();
 
+// Layout of CPython's rangeiterobject (Objects/rangeobject.c), which isn't exported
+struct PyjionRangeIterator {
+    PyObject_HEAD
+    long index;
+    long start;
+    long step;
+    long len;
+};
+
+// Layout of CPython's listiterobject and tupleiterobject, which aren't exported
+struct PyjionSequenceIterator {
+    PyObject_HEAD
+    Py_ssize_t it_index;
+    PyObject* it_seq;
+};
+
 extern CCorJitHost g_jitHost;
 extern ICorJitCompiler* g_jit;
 class PythonCompiler : public IPythonCompiler {
@@ -260,11 +281,14 @@ class PythonCompiler : public IPythonCompiler {
     // pre-calculate some information...
     ILGenerator m_il;
     UserModule* m_module;
+    // Type slots and builtin methods called by the code are added to the interpreter's module
+    UserModule* m_methodModule;
     // This is the ADDRESS of the int f_lasti inside the PyFrameObject
     Local m_lasti;
     Local m_instrCount;
     Local m_stacktop;
     bool m_compileDebug;
+    uint64_t m_compileMethodTime;
 
 public:
     explicit PythonCompiler(PyCodeObject *code);
@@ -405,9 +429,13 @@ public:
     void emit_getiter() override;
     void emit_for_next() override;
     void emit_for_next(AbstractValueWithSources) override;
+    void emit_for_next_unboxed(Label exhausted, Label generic) override;
 
     LocalKind emit_binary_float(uint16_t opcode) override;
     LocalKind emit_binary_int(uint16_t opcode) override;
+    LocalKind emit_binary_int_checked(uint16_t opcode, Local left, AbstractValueKind leftKind, Local right, AbstractValueKind rightKind, Label overflow) override;
+    LocalKind emit_unary_unboxed(uint16_t opcode, Local value, AbstractValueKind kind, Label overflow) override;
+    void emit_math_function_call(MathFunction function, PyObject* target, bool isMethod, Local argument, AbstractValueKind argKind, Label generic) override;
     void emit_binary_object(uint16_t opcode) override;
     void emit_binary_object(uint16_t opcode, AbstractValueWithSources left, AbstractValueWithSources right) override;
     LocalKind emit_unboxed_binary_object(uint16_t opcode, AbstractValueWithSources left, AbstractValueWithSources right) override;
@@ -485,8 +513,13 @@ public:
     void emit_trace_exception() override;
     void emit_profile_frame_entry() override;
     void emit_profile_frame_exit() override;
-    void emit_pgc_profile_capture(Local value, size_t ipos, size_t istack) override;
+    void emit_timing_entry(Local start) override;
+    void emit_timing_exit(Local start) override;
+    void emit_pgc_profile_capture(Local value, PyjionProfileSlot* slot) override;
+    void emit_count_backedge() override;
+    void emit_count_opcode(py_opindex idx) override;
     JittedCode* emit_compile() override;
+    uint64_t get_compile_method_time() override;
     void lift_n_to_top(uint16_t pos) override;
     void lift_n_to_second(uint16_t pos) override;
     void lift_n_to_third(uint16_t pos) override;
@@ -500,6 +533,8 @@ public:
     void emit_infinity_long() override;
     void emit_nan_long() override;
     void emit_guard_exception(const char* expected) override;
+    void emit_unbox_guard(Local value, AbstractValueKind kind, Label failed) override;
+    void emit_pgc_deoptimize(py_opindex index) override;
     void emit_store_in_frame_value_stack(size_t index) override;
     void emit_load_from_frame_value_stack(size_t index) override;
     void emit_set_stacktop(size_t height) override;
@@ -509,6 +544,7 @@ public:
 private:
     void load_frame();
     void load_tstate();
+    void increment_counter(size_t* counter);
     void load_local(py_oparg oparg);
     void decref(bool noopt = false);
     CorInfoType to_clr_type(LocalKind kind);
@@ -524,6 +560,10 @@ private:
     void emit_known_binary_op_multiply(AbstractValueWithSources &left, AbstractValueWithSources &right, Local leftLocal, Local rightLocal, int nb_slot,
                               int sq_slot, int fallback_token);
     void fill_local_vector(vector<Local> & vec, size_t len);
+    void load_range_iterator_field(Local iterator, size_t offset);
+    void emit_range_iterator_next(Local iterator, Label generic, Label exhausted);
+    void emit_sequence_iterator_next(Local iterator, AbstractValueKind kind, Label generic);
+    void emit_bitwise_int(uint16_t opcode);
 
 };
 
@@ -24,8 +24,15 @@
 */
 
 #include <Python.h>
+#include <algorithm>
 #include "pyjit.h"
 #include "pycomp.h"
+#include "compilequeue.h"
+#include "codeheap.h"
+#include "profilestore.h"
+#include "jitstats.h"
+#include "perfmap.h"
+#include "sampler.h"
 
 #ifdef WINDOWS
 #define BUFSIZE 65535
@@ -35,13 +42,81 @@ typedef ICorJitCompiler* (__cdecl* GETJIT)();
 typedef void(__cdecl* JITSTARTUP)(ICorJitHost*);
 #endif
 
-PyjionSettings g_pyjionSettings;
 extern BaseModule g_module;
+
+// Keyed by interpreter ID, the PyInterpreterState of a finalized subinterpreter can be reused.
+static unordered_map<int64_t, PyjionInterpreterState*> g_interpreterStates;
+// Used by interpreters that haven't initialized Pyjion, and by threads without a thread state
+static PyjionInterpreterState g_defaultInterpreterState;
+// Changed whenever a state is added or removed so the per-thread lookups are refreshed
+static atomic<size_t> g_interpreterStatesVersion{0};
+
+struct InterpreterStateCache {
+    PyInterpreterState* interp = nullptr;
+    size_t version = 0;
+    PyjionInterpreterState* state = nullptr;
+};
+static thread_local InterpreterStateCache t_interpreterState;
+
+PyjionInterpreterState* PyJit_GetInterpreterState(PyInterpreterState* interp) {
+    auto& cache = t_interpreterState;
+    auto version = g_interpreterStatesVersion.load(memory_order_acquire);
+    if (cache.interp == interp && cache.version == version && cache.state != nullptr)
+        return cache.state;
+    auto state = g_interpreterStates.find(PyInterpreterState_GetID(interp));
+    cache.interp = interp;
+    cache.version = version;
+    cache.state = state == g_interpreterStates.end() ? &g_defaultInterpreterState : state->second;
+    return cache.state;
+}
+
+PyjionInterpreterState* PyJit_CurrentInterpreterState() {
+    auto tstate = _PyThreadState_UncheckedGet();
+    if (tstate == nullptr)
+        return &g_defaultInterpreterState;
+    return PyJit_GetInterpreterState(PyThreadState_GetInterpreter(tstate));
+}
+
+PyjionSettings& PyJit_Settings() {
+    return PyJit_CurrentInterpreterState()->settings;
+}
+
+static PyjionInterpreterState* PyJit_CreateInterpreterState(PyInterpreterState* interp) {
+    auto id = PyInterpreterState_GetID(interp);
+    auto existing = g_interpreterStates.find(id);
+    if (existing != g_interpreterStates.end())
+        return existing->second;
+    auto state = new PyjionInterpreterState();
+    state->module = new UserModule(g_module);
+    g_interpreterStates[id] = state;
+    g_interpreterStatesVersion++;
+    return state;
+}
+
+// Called when the _pyjion module of an interpreter is freed, normally as the interpreter is finalized.
+static void PyJit_FreeInterpreterState(int64_t id) {
+    auto state = g_interpreterStates.find(id);
+    if (state == g_interpreterStates.end())
+        return;
+    g_interpreterStatesVersion++;
+    // Code objects that outlive the module are counted against the default state until they're freed
+    for (auto jitted : state->second->jittedCode) {
+        jitted->j_interpreter = &g_defaultInterpreterState;
+        g_defaultInterpreterState.jittedCode.insert(jitted);
+    }
+    g_defaultInterpreterState.jittedCodeBytes += state->second->jittedCodeBytes;
+    g_defaultInterpreterState.jittedILBytes += state->second->jittedILBytes;
+    // Methods of compiled code that is still alive keep their addresses, only the lookup table is freed
+    delete state->second->module;
+    delete state->second;
+    g_interpreterStates.erase(state);
+}
+
 #define SET_OPT(opt, actualLevel, minLevel) \
-    g_pyjionSettings.opt_ ## opt = (actualLevel) >= (minLevel) ? true : false;
+    PyJit_Settings().opt_ ## opt = (actualLevel) >= (minLevel) ? true : false;
 
 void setOptimizationLevel(unsigned short level){
-    g_pyjionSettings.optimizationLevel = level;
+    PyJit_Settings().optimizationLevel = level;
     SET_OPT(inlineIs, level, 1);
     SET_OPT(inlineDecref, level, 1);
     SET_OPT(internRichCompare, level, 1);
@@ -68,45 +143,167 @@ PgcStatus nextPgcStatus(PgcStatus status){
 }
 
 PyjionJittedCode::~PyjionJittedCode() {
+    freeCompiledCode();
 	delete j_profile;
+	// Compiled code increments these, so they go after it
+	delete[] j_opcodeCounts;
 }
 
-PyjionCodeProfile::~PyjionCodeProfile() {
-    for (auto &pos: this->stackTypes) {
-        for(auto &observed: pos.second){
-            Py_XDECREF(observed.second);
+void PyjionJittedCode::addCompiledCode(JittedCode* code, bool main) {
+    j_compiledSize += code->get_native_size();
+    j_interpreter->jittedCodeBytes += code->get_native_size();
+    j_interpreter->jittedILBytes += code->get_il_len();
+    if (main) {
+        if (j_mainCode != nullptr)
+            j_retiredCode.push_back(j_mainCode);
+        j_mainCode = code;
+    }
+}
+
+void PyjionJittedCode::freeRetiredCode() {
+    for (auto code : j_retiredCode) {
+        j_compiledSize -= code->get_native_size();
+        j_interpreter->jittedCodeBytes -= code->get_native_size();
+        j_interpreter->jittedILBytes -= code->get_il_len();
+        PyJit_SamplerCodeUnloaded(code);
+        delete code;
+    }
+    j_retiredCode.clear();
+}
+
+void PyjionJittedCode::freeCompiledCode() {
+    j_addr.store(nullptr, memory_order_release);
+    if (j_mainCode != nullptr)
+        j_retiredCode.push_back(j_mainCode);
+    j_mainCode = nullptr;
+    for (size_t i = 0; i < j_specializationCount; i++) {
+        if (j_specializations[i].code != nullptr)
+            j_retiredCode.push_back(j_specializations[i].code);
+        j_specializations[i] = PyjionSpecialization();
+    }
+    j_specializationCount = 0;
+    if (j_genericCode != nullptr)
+        j_retiredCode.push_back(j_genericCode);
+    j_genericCode = nullptr;
+    j_genericAddr = nullptr;
+    j_genericFailed = false;
+
+    // Everything below points into the compiled versions
+    j_il = nullptr;
+    j_ilLen = 0;
+    j_nativeSize = 0;
+    j_sequencePoints = nullptr;
+    j_sequencePointsLen = 0;
+    j_callPoints = nullptr;
+    j_callPointsLen = 0;
+    j_symbols.clear();
+    j_osrEntries.clear();
+    freeRetiredCode();
+}
+
+bool PyjionJittedCode::scanLoops() {
+    if (j_loopsScanned)
+        return j_osrReturn != -1 && !j_loopHeaders.empty();
+    j_loopsScanned = true;
+
+    auto code = (PyCodeObject*)j_code;
+    if (code->co_flags & (CO_GENERATOR | CO_COROUTINE | CO_ASYNC_GENERATOR | CO_ITERABLE_COROUTINE))
+        return false;
+    auto byteCode = (_Py_CODEUNIT *)PyBytes_AS_STRING(code->co_code);
+    auto size = PyBytes_Size(code->co_code) / sizeof(_Py_CODEUNIT);
+    int oparg = 0;
+    for (Py_ssize_t i = 0; i < size; i++) {
+        auto offset = (py_opindex)(i * sizeof(_Py_CODEUNIT));
+        oparg = (oparg << 8) | _Py_OPARG(byteCode[i]);
+        switch (_Py_OPCODE(byteCode[i])) {
+            case EXTENDED_ARG:
+                continue;
+            case JUMP_ABSOLUTE:
+            case POP_JUMP_IF_FALSE:
+            case POP_JUMP_IF_TRUE:
+                if ((py_opindex)oparg <= offset)
+                    j_loopHeaders.insert(oparg);
+                break;
+            case RETURN_VALUE:
+                j_osrReturn = (int)offset;
+                break;
+            case SETUP_FINALLY:
+            case SETUP_WITH:
+            case SETUP_ASYNC_WITH:
+                // The interpreter's block stack can't be handed over to jitted code
+                j_loopHeaders.clear();
+                return false;
         }
+        oparg = 0;
+    }
+    return j_osrReturn != -1 && !j_loopHeaders.empty();
+}
+
+PyjionCodeProfile::~PyjionCodeProfile() {
+    for (auto &slot: this->slots) {
+        for (auto type: slot.types)
+            Py_XDECREF(type);
     }
 }
 
-void PyjionCodeProfile::record(size_t opcodePosition, size_t stackPosition, PyObject* value){
-    if (PyGen_CheckExact(value) || PyCoro_CheckExact(value))
+// Sites are (opcode position, number of stack positions probed). Only the first probe
+// compile allocates, the slots can't move once compiled code points at them.
+void PyjionCodeProfile::allocateSlots(const vector<pair<size_t, size_t>>& sites) {
+    if (!this->slots.empty())
         return;
-    if (this->stackTypes[opcodePosition][stackPosition] == nullptr) {
-        this->stackTypes[opcodePosition][stackPosition] = Py_TYPE(value);
-        Py_INCREF(Py_TYPE(value));
+    size_t count = 0;
+    for (auto &site: sites) {
+        this->slotIndex[site.first] = count;
+        count += site.second;
     }
-    this->stackKinds[opcodePosition][stackPosition] = GetAbstractType(Py_TYPE(value), value);
+    this->sites = sites;
+    this->slots.resize(count);
+}
+
+PyjionProfileSlot* PyjionCodeProfile::getSlot(size_t opcodePosition, size_t stackPosition) {
+    auto index = this->slotIndex.find(opcodePosition);
+    if (index == this->slotIndex.end())
+        return nullptr;
+    return &this->slots[index->second + stackPosition];
 }
 
+// The most frequently seen type
 PyTypeObject* PyjionCodeProfile::getType(size_t opcodePosition, size_t stackPosition) {
-    return this->stackTypes[opcodePosition][stackPosition];
+    auto slot = getSlot(opcodePosition, stackPosition);
+    if (slot == nullptr)
+        return nullptr;
+    auto dominant = slot->dominant();
+    return dominant == -1 ? nullptr : slot->types[dominant];
 }
 
 AbstractValueKind PyjionCodeProfile::getKind(size_t opcodePosition, size_t stackPosition){
-    return this->stackKinds[opcodePosition][stackPosition];
+    auto type = getType(opcodePosition, stackPosition);
+    if (type == nullptr)
+        return AVK_Any;
+    if (type == &PyLong_Type)
+        return getSlot(opcodePosition, stackPosition)->bigInteger ? AVK_BigInteger : AVK_Integer;
+    return GetAbstractType(type);
+}
+
+void PyjionCodeProfile::deoptimize(size_t opcodePosition){
+    this->deoptimizedSites.insert(opcodePosition);
+}
+
+bool PyjionCodeProfile::isDeoptimized(size_t opcodePosition){
+    return this->deoptimizedSites.find(opcodePosition) != this->deoptimizedSites.end();
 }
 
-void capturePgcStackValue(PyjionCodeProfile* profile, PyObject* value, size_t opcodePosition, size_t stackPosition){
-    if (value != nullptr && profile != nullptr){
-        profile->record(opcodePosition, stackPosition, value);
+void deoptimizePgcSite(PyjionCodeProfile* profile, size_t opcodePosition){
+    PyJit_RecordGuardFailure();
+    if (profile != nullptr){
+        profile->deoptimize(opcodePosition);
     }
 }
 
 int
 Pyjit_CheckRecursiveCall(PyThreadState *tstate, const char *where)
 {
-    int recursion_limit = g_pyjionSettings.recursionLimit;
+    int recursion_limit = PyJit_Settings().recursionLimit;
 
     if (tstate->recursion_critical)
         /* Somebody asked that we don't check for recursion. */
@@ -131,7 +328,7 @@ Pyjit_CheckRecursiveCall(PyThreadState *tstate, const char *where)
 
 static inline int Pyjit_EnterRecursiveCall(const char *where) {
     PyThreadState *tstate = PyThreadState_GET();
-    return ((++tstate->recursion_depth > g_pyjionSettings.recursionLimit)
+    return ((++tstate->recursion_depth > PyJit_Settings().recursionLimit)
             && Pyjit_CheckRecursiveCall(tstate, where));
 }
 
@@ -140,7 +337,161 @@ static inline void Pyjit_LeaveRecursiveCall() {
     tstate->recursion_depth--;
 }
 
-static inline PyObject* PyJit_ExecuteJittedFrame(void* state, PyFrameObject*frame, PyThreadState* tstate, PyjionCodeProfile* profile) {
+// Sends a function back through the profiling tier after it deoptimized, the failed
+// site has been marked in the profile so the next compile won't speculate on it. Code
+// that keeps deoptimizing is blacklisted and left in the interpreter.
+static void PyJit_Deoptimize(PyjionJittedCode* jitted, void* state) {
+    jitted->j_deoptimizations++;
+    if (jitted->j_blacklisted)
+        return;
+    if (jitted->j_deoptimizations > PGC_DEOPTIMIZE_RECOMPILE_LIMIT) {
+        jitted->j_blacklisted = true;
+        jitted->j_addr.store(nullptr, memory_order_release);
+        return;
+    }
+    auto expected = (Py_EvalFunc)state;
+    if (!jitted->j_addr.compare_exchange_strong(expected, nullptr))
+        return; // Already replaced by a newer compile
+    if (PyJit_Settings().pgc)
+        jitted->j_pgc_status = CompiledWithProbes;
+}
+
+// Retired versions of the code can only be freed once no frame is running them
+static inline void PyJit_LeaveJittedCode(PyjionJittedCode* jitted) {
+    if (--jitted->j_activeFrames == 0 && !jitted->j_retiredCode.empty())
+        jitted->freeRetiredCode();
+}
+
+// Number of interpreted frames on this thread being watched for OSR
+static thread_local size_t g_osrWatching = 0;
+
+// Continues an interpreted frame in jitted code from the loop header at f_lasti. Called from
+// the trace function, so on return the interpreter reloads f_lasti and f_stacktop: on success
+// the result is left on the value stack in front of a RETURN_VALUE so the interpreter finishes
+// the frame, if a guard failed the interpreter resumes where the jitted code stopped.
+static int PyJit_ExecuteOsrFrame(Py_EvalFunc addr, PyFrameObject* frame, PyThreadState* tstate, PyjionJittedCode* jitted) {
+    PyObject** stack_pointer = frame->f_stacktop;
+    assert(stack_pointer != nullptr);
+    frame->f_stacktop = nullptr;
+    PyObject* res;
+    jitted->j_activeFrames++;
+    try {
+        res = addr(jitted, frame, tstate, jitted->j_profile, stack_pointer);
+    } catch (const std::exception& e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        res = nullptr;
+    }
+    PyJit_LeaveJittedCode(jitted);
+    // The jitted code pops the frame on the way out, but the interpreter still owns it
+    tstate->frame = frame;
+
+    if (res == nullptr && !PyErr_Occurred()) {
+        // Deoptimized (f_stacktop is set) or the entry guards declined the frame (the
+        // stack wasn't touched). f_lasti is the instruction before the one to resume from
+        // but the interpreter jumps straight to f_lasti after tracing.
+        if (frame->f_stacktop == nullptr) {
+            frame->f_stacktop = stack_pointer;
+            PyJit_RecordOsrDecline();
+        } else
+            PyJit_Deoptimize(jitted, (void*)addr);
+        frame->f_lasti += sizeof(_Py_CODEUNIT);
+        return 0;
+    }
+    frame->f_iblock = 0;
+    if (res == nullptr) {
+        // The jitted code already added this frame to the traceback, the interpreter
+        // adds it again when the trace function fails.
+        PyObject *type, *value, *traceback;
+        PyErr_Fetch(&type, &value, &traceback);
+        if (traceback != nullptr && ((PyTracebackObject*)traceback)->tb_frame == frame) {
+            auto next = (PyObject*)((PyTracebackObject*)traceback)->tb_next;
+            Py_XINCREF(next);
+            Py_DECREF(traceback);
+            traceback = next;
+        }
+        PyErr_Restore(type, value, traceback);
+        frame->f_stacktop = frame->f_valuestack;
+        return -1;
+    }
+    frame->f_valuestack[0] = res;
+    frame->f_stacktop = frame->f_valuestack + 1;
+    frame->f_lasti = jitted->j_osrReturn;
+    return 0;
+}
+
+// Trace function installed while interpreted frames are being watched. Counts loop
+// back-edges towards the hotness of the code, compiles it once hot and moves the frame into
+// the jitted code at the loop header.
+static int PyJit_OsrTrace(PyObject* obj, PyFrameObject* frame, int what, PyObject* arg) {
+    if (what != PyTrace_LINE)
+        return 0;
+    auto jitted = PyJit_EnsureExtra((PyObject*)frame->f_code);
+    if (jitted == nullptr || jitted->failed() || !jitted->scanLoops() ||
+        jitted->j_loopHeaders.find(frame->f_lasti) == jitted->j_loopHeaders.end())
+        return 0;
+    jitted->j_backedge_count++;
+
+    auto addr = jitted->j_addr.load(memory_order_acquire);
+    if (addr == nullptr || (PyJit_Settings().pgc && jitted->j_pgc_status == CompiledWithProbes &&
+                            jitted->profiledHotness() >= PyJit_Settings().optimizeThreshold)) {
+        if (jitted->hotness() < PyJit_Settings().threshold)
+            return 0;
+        if (PyJit_Settings().background) {
+            PyJit_QueueCompile(jitted, frame);
+        } else {
+            int argCount = frame->f_code->co_argcount + frame->f_code->co_kwonlyargcount;
+            if (!PyJit_CompileCode(jitted, frame->f_builtins, frame->f_globals, frame->f_localsplus, argCount, jitted->j_profile)) {
+                PyErr_Clear();
+                return 0;
+            }
+        }
+        addr = jitted->j_addr.load(memory_order_acquire);
+        if (addr == nullptr)
+            return 0;
+    }
+    if (jitted->j_osrEntries.find(frame->f_lasti) == jitted->j_osrEntries.end() ||
+        jitted->j_deoptimizations > PGC_DEOPTIMIZE_RECOMPILE_LIMIT)
+        return 0;
+    jitted->j_osr_count++;
+    return PyJit_ExecuteOsrFrame(addr, frame, PyThreadState_GET(), jitted);
+}
+
+// Runs a frame in the interpreter. Frames with loops are watched with PyJit_OsrTrace so a
+// long-running loop can move into jitted code without waiting for the next call. OSR is
+// skipped while a debugger, tracer or profiler is installed, their hooks are never replaced.
+static PyObject* PyJit_EvalFrameInterpreted(PyjionJittedCode* jitted, PyThreadState* ts, PyFrameObject* f, int throwflag) {
+    if (!PyJit_Settings().osr || throwflag || jitted == nullptr || jitted->failed() || ts->tracing ||
+        (ts->c_tracefunc != nullptr && ts->c_tracefunc != PyJit_OsrTrace) || ts->c_profilefunc != nullptr ||
+        !jitted->scanLoops())
+        return _PyEval_EvalFrameDefault(ts, f, throwflag);
+
+    // The trace function is installed by the outermost watched frame, and the one it
+    // replaced (none, given the check above) is put back when that frame returns.
+    Py_tracefunc previousFunc = nullptr;
+    PyObject* previousObj = nullptr;
+    if (g_osrWatching++ == 0) {
+        if (ts->c_tracefunc != PyJit_OsrTrace) {
+            previousFunc = ts->c_tracefunc;
+            previousObj = ts->c_traceobj;
+            Py_XINCREF(previousObj);
+        }
+        PyEval_SetTrace(PyJit_OsrTrace, nullptr);
+    }
+    auto res = _PyEval_EvalFrameDefault(ts, f, throwflag);
+    if (--g_osrWatching == 0) {
+        // A tracer set by the frame itself (sys.settrace) is left installed
+        if (ts->c_tracefunc == PyJit_OsrTrace) {
+            PyObject *type, *value, *traceback;
+            PyErr_Fetch(&type, &value, &traceback);
+            PyEval_SetTrace(previousFunc, previousObj);
+            PyErr_Restore(type, value, traceback);
+        }
+        Py_XDECREF(previousObj);
+    }
+    return res;
+}
+
+static inline PyObject* PyJit_ExecuteJittedFrame(void* state, PyFrameObject*frame, PyThreadState* tstate, PyjionJittedCode* jitted) {
     if (Pyjit_EnterRecursiveCall("")) {
         return nullptr;
     }
@@ -148,33 +499,44 @@ static inline PyObject* PyJit_ExecuteJittedFrame(void* state, PyFrameObject*fram
     assert(stack_pointer != nullptr);
     frame->f_stacktop = nullptr;       /* remains NULL unless yield suspends frame */
 	frame->f_executing = 1;
+    jitted->j_activeFrames++;
     try {
-        auto res = ((Py_EvalFunc)state)(nullptr, frame, tstate, profile, stack_pointer);
+        auto res = ((Py_EvalFunc)state)(jitted, frame, tstate, jitted->j_profile, stack_pointer);
         Pyjit_LeaveRecursiveCall();
         frame->f_executing = 0;
+        PyJit_LeaveJittedCode(jitted);
+        if (res == nullptr && frame->f_stacktop != nullptr && !PyErr_Occurred()) {
+            // A guard failed, the jitted code has written the locals and value stack back
+            // to the frame and set f_lasti so the interpreter can carry on from that instruction.
+            PyJit_Deoptimize(jitted, state);
+            return PyJit_EvalFrameInterpreted(jitted, tstate, frame, 0);
+        }
         return res;
     } catch (const std::exception& e){
         PyErr_SetString(PyExc_RuntimeError, e.what());
         Pyjit_LeaveRecursiveCall();
         frame->f_executing = 0;
+        PyJit_LeaveJittedCode(jitted);
         return nullptr;
     }
 }
 
-static Py_tss_t* g_extraSlot;
-
 #ifdef WINDOWS
 HMODULE GetClrJit() {
-    return LoadLibrary(g_pyjionSettings.clrjitpath);
+    return LoadLibrary(PyJit_Settings().clrjitpath);
 }
 #endif
 
+static bool g_jitStarted = false;
+
 bool JitInit(const wchar_t * path) {
-    g_pyjionSettings = {false, false};
-    g_pyjionSettings.recursionLimit = Py_GetRecursionLimit();
-    g_pyjionSettings.clrjitpath = path;
-	g_extraSlot = PyThread_tss_alloc();
-	PyThread_tss_create(g_extraSlot);
+    // Settings are per interpreter, the CLR JIT is loaded once for the process
+    auto state = PyJit_CreateInterpreterState(PyThreadState_GetInterpreter(PyThreadState_Get()));
+    state->settings = {false, false};
+    state->settings.recursionLimit = Py_GetRecursionLimit();
+    state->settings.clrjitpath = path;
+    if (g_jitStarted)
+        return true;
 #ifdef WINDOWS
     auto clrJitHandle = GetClrJit();
 	if (clrJitHandle == nullptr) {
@@ -204,44 +566,152 @@ bool JitInit(const wchar_t * path) {
     if (PyType_Ready(&PyJitMethodLocation_Type) < 0)
         return false;
     g_emptyTuple = PyTuple_New(0);
+    g_jitStarted = true;
     return true;
 }
 
-PyObject* PyJit_ExecuteAndCompileFrame(PyjionJittedCode* state, PyFrameObject *frame, PyThreadState* tstate, PyjionCodeProfile* profile) {
-    // Compile and run the now compiled code...
-    PythonCompiler jitter((PyCodeObject*)state->j_code);
-    AbstractInterpreter interp((PyCodeObject*)state->j_code, &jitter);
-    int argCount = frame->f_code->co_argcount + frame->f_code->co_kwonlyargcount;
-
-    // provide the interpreter information about the specialized types
-    for (int i = 0; i < argCount; i++) {
-        interp.setLocalType(i, frame->f_localsplus[i]);
-    }
-
-    if (g_pyjionSettings.tracing){
+static void PyJit_ConfigureInterpreter(AbstractInterpreter& interp, PyjionJittedCode* jitted) {
+    if (PyJit_Settings().tracing){
         interp.enableTracing();
     } else {
         interp.disableTracing();
     }
-    if (g_pyjionSettings.profiling){
+    if (PyJit_Settings().profiling){
         interp.enableProfiling();
     } else {
         interp.disableProfiling();
     }
+    if (PyJit_Settings().timing){
+        interp.enableTiming();
+    } else {
+        interp.disableTiming();
+    }
+    if (PyJit_Settings().opcodeCounts){
+        // Kept for the life of the code object, code compiled earlier may still be incrementing it
+        if (jitted->j_opcodeCounts == nullptr) {
+            jitted->j_opcodeCountsLen = PyBytes_GET_SIZE(((PyCodeObject*)jitted->j_code)->co_code) / sizeof(_Py_CODEUNIT);
+            jitted->j_opcodeCounts = new PY_UINT64_T[jitted->j_opcodeCountsLen]();
+        }
+        interp.enableOpcodeCounts();
+    } else {
+        interp.disableOpcodeCounts();
+    }
+}
+
+// Sends the coldest functions back to the interpreter until the native code fits in the code
+// budget. Heat is halved on each pass before the hotness since the last pass is added, so code
+// that was hot a long time ago goes before code that is hot now. Code with a frame running it,
+// generators and coroutines (a suspended frame isn't counted as running) and the code that was
+// just compiled are never evicted. Only code of the interpreter that owns current is considered.
+static void PyJit_EnforceCodeBudget(PyjionJittedCode* current) {
+    auto interpreter = current->j_interpreter;
+    auto codeBudget = interpreter->settings.codeBudget;
+    if (codeBudget == 0 || interpreter->jittedCodeBytes <= codeBudget)
+        return;
+    vector<PyjionJittedCode*> candidates;
+    for (auto jitted : interpreter->jittedCode) {
+        auto hotness = jitted->hotness();
+        jitted->j_heat = jitted->j_heat / 2 + (hotness - jitted->j_heatHotness);
+        jitted->j_heatHotness = hotness;
+        if (jitted != current && jitted->j_activeFrames == 0 && jitted->j_compiledSize != 0 &&
+            jitted->j_compileState != CompileStateCompiling &&
+            !(((PyCodeObject*)jitted->j_code)->co_flags & (CO_GENERATOR | CO_COROUTINE | CO_ASYNC_GENERATOR)))
+            candidates.push_back(jitted);
+    }
+    sort(candidates.begin(), candidates.end(), [](PyjionJittedCode* a, PyjionJittedCode* b) {
+        return a->j_heat < b->j_heat;
+    });
+    for (auto jitted : candidates) {
+        if (interpreter->jittedCodeBytes <= codeBudget)
+            break;
+        jitted->freeCompiledCode();
+        if (!jitted->failed())
+            jitted->endCompile(CompileStateUncompiled);
+        jitted->j_evictions++;
+        // The profile is kept, so the recompile goes straight to the optimized code
+        if (PyJit_Settings().pgc && jitted->j_pgc_status == Optimized)
+            jitted->j_pgc_status = CompiledWithProbes;
+        // Only compile it again once it's hot again
+        jitted->j_run_count = 0;
+        jitted->j_backedge_count = 0;
+        jitted->j_heat = 0;
+        jitted->j_heatHotness = 0;
+        jitted->j_probedHotness = 0;
+    }
+}
+
+// Adds the time taken by a compile to the code's totals and blacklists it if the compile went
+// over the compile time budget.
+static void PyJit_RecordCompileTime(PyjionJittedCode* jitted, const AbstractInterpreterCompileTimings& timings) {
+    jitted->j_compileTime.interpret += timings.interpret;
+    jitted->j_compileTime.compileWorker += timings.compileWorker;
+    jitted->j_compileTime.compileMethod += timings.compileMethod;
+    jitted->j_compileCount++;
+    if (PyJit_Settings().compileTimeBudget != 0 && timings.total() > PyJit_Settings().compileTimeBudget)
+        jitted->j_blacklisted = true;
+}
 
-    auto res = interp.compile(frame->f_builtins, frame->f_globals, profile, state->j_pgc_status);
+bool PyJit_CompileCode(PyjionJittedCode* state, PyObject* builtins, PyObject* globals, PyObject** args, size_t argCount, PyjionCodeProfile* profile) {
+    auto bytecodeSize = (size_t)PyBytes_GET_SIZE(((PyCodeObject*)state->j_code)->co_code);
+    if (!state->beginCompile())
+        return false;
+    if (state->j_blacklisted) {
+        // Evicted or deoptimized since it was blacklisted, leave it in the interpreter
+        state->endCompile(CompileStateFailed);
+        return false;
+    }
+    if (PyJit_Settings().compileTimeBudget != 0 &&
+        PyJit_PredictCompileTime(bytecodeSize) > PyJit_Settings().compileTimeBudget) {
+        PyJit_RecordCompile(CompilationTimeBudget, AbstractInterpreterCompileTimings(), bytecodeSize);
+        state->j_compile_result = CompilationTimeBudget;
+        state->j_blacklisted = true;
+        state->endCompile(CompileStateFailed);
+        return false;
+    }
+
+    PythonCompiler jitter((PyCodeObject*)state->j_code);
+    AbstractInterpreter interp((PyCodeObject*)state->j_code, &jitter);
+
+    // provide the interpreter information about the specialized types
+    for (size_t i = 0; i < argCount; i++) {
+        interp.setLocalType(i, args[i]);
+    }
+    PyJit_ConfigureInterpreter(interp, state);
+
+    auto res = interp.compile(builtins, globals, profile, state->j_pgc_status);
+    PyJit_RecordCompile(res.result, res.timings, bytecodeSize);
+    PyJit_RecordCompileTime(state, res.timings);
+    if (state->j_pgc_status == CompiledWithProbes)
+        PyJit_RecordPgcRecompile();
     state->j_compile_result = res.result;
-    if (g_pyjionSettings.graph){
+    if (state->j_blacklisted && PyJit_Settings().pgc && state->j_pgc_status == Uncompiled) {
+        // Probe code would never be replaced by an optimized compile, leave it in the interpreter
+        delete res.compiledCode;
+        res.compiledCode = nullptr;
+        state->j_compile_result = CompilationTimeBudget;
+    } else {
+        state->j_pgc_status = nextPgcStatus(state->j_pgc_status);
+    }
+    if (PyJit_Settings().graph){
         state->j_graph = res.instructionGraph;
     }
     if (res.compiledCode == nullptr || res.result != Success) {
-        state->j_failed = true;
-        return _PyEval_EvalFrameDefault(tstate, frame, 0);
+        delete res.compiledCode;
+        state->endCompile(CompileStateFailed);
+        return false;
     }
 
     // Update the jitted information for this tree node
-    state->j_addr = (Py_EvalFunc)res.compiledCode->get_code_addr();
-    assert(state->j_addr != nullptr);
+    auto addr = (Py_EvalFunc)res.compiledCode->get_code_addr();
+    assert(addr != nullptr);
+    if (state->j_pgc_status == CompiledWithProbes) {
+        // The call or back-edge that triggered the compile runs in the profiling tier
+        auto hotness = state->hotness();
+        state->j_probedHotness = hotness > 0 ? hotness - 1 : 0;
+    }
+    state->addCompiledCode(res.compiledCode, true);
+    PyJit_PerfCodeLoaded((PyCodeObject*)state->j_code, res.compiledCode);
+    PyJit_SamplerCodeLoaded((PyCodeObject*)state->j_code, res.compiledCode);
     state->j_il = res.compiledCode->get_il();
     state->j_ilLen = res.compiledCode->get_il_len();
     state->j_nativeSize = res.compiledCode->get_native_size();
@@ -251,13 +721,19 @@ PyObject* PyJit_ExecuteAndCompileFrame(PyjionJittedCode* state, PyFrameObject *f
     state->j_sequencePointsLen = res.compiledCode->get_sequence_points_length();
     state->j_callPoints = res.compiledCode->get_call_points();
     state->j_callPointsLen = res.compiledCode->get_call_points_length();
+    state->j_osrEntries = res.osrEntries;
+    state->j_argTypes.resize(argCount);
+    for (size_t i = 0; i < argCount; i++) {
+        state->j_argTypes[i] = args[i] == nullptr ? nullptr : Py_TYPE(args[i]);
+    }
 
 #ifdef DUMP_SEQUENCE_POINTS
-    printf("Method disassembly for %s\n", PyUnicode_AsUTF8(frame->f_code->co_name));
-    auto code = (_Py_CODEUNIT *)PyBytes_AS_STRING(frame->f_code->co_code);
+    auto codeObject = (PyCodeObject*)state->j_code;
+    printf("Method disassembly for %s\n", PyUnicode_AsUTF8(codeObject->co_name));
+    auto code = (_Py_CODEUNIT *)PyBytes_AS_STRING(codeObject->co_code);
     for (size_t i = 0; i < state->j_sequencePointsLen; i ++){
         printf(" %016llX (IL_%04X): %d %s %d\n",
-            ((uint64_t)state->j_addr + (uint64_t)state->j_sequencePoints[i].nativeOffset),
+            ((uint64_t)addr + (uint64_t)state->j_sequencePoints[i].nativeOffset),
             state->j_sequencePoints[i].ilOffset,
             state->j_sequencePoints[i].pythonOpcodeIndex,
             opcodeName(_Py_OPCODE(code[(state->j_sequencePoints[i].pythonOpcodeIndex)/sizeof(_Py_CODEUNIT)])),
@@ -266,22 +742,126 @@ PyObject* PyJit_ExecuteAndCompileFrame(PyjionJittedCode* state, PyFrameObject *f
     }
 #endif
 
+    // Publish the address last, once everything else describing the code is in place
+    state->j_addr.store(addr, memory_order_release);
+    state->endCompile(CompileStateCompiled);
+    if (state->j_activeFrames == 0)
+        state->freeRetiredCode();
+    PyJit_EnforceCodeBudget(state);
+    return true;
+}
+
+// Argument types are only compared by identity, the compiled code still guards any value it specialized on.
+static bool PyJit_ArgTypesMatch(const vector<PyTypeObject*>& argTypes, PyFrameObject* frame) {
+    for (size_t i = 0; i < argTypes.size(); i++) {
+        auto arg = frame->f_localsplus[i];
+        if ((arg == nullptr ? nullptr : Py_TYPE(arg)) != argTypes[i])
+            return false;
+    }
+    return true;
+}
+
+// Compiles another entry point for the code, specialized on the argument types of frame or,
+// if generic is set, with no knowledge of the argument types. The PGC profile describes the
+// main entry point so it isn't applied here.
+static JittedCode* PyJit_CompileSpecialization(PyjionJittedCode* jitted, PyFrameObject* frame, bool generic) {
+    PythonCompiler jitter((PyCodeObject*)jitted->j_code);
+    AbstractInterpreter interp((PyCodeObject*)jitted->j_code, &jitter);
+    if (!generic) {
+        for (size_t i = 0; i < jitted->j_argTypes.size(); i++) {
+            interp.setLocalType(i, frame->f_localsplus[i]);
+        }
+    }
+    PyJit_ConfigureInterpreter(interp, jitted);
+
+    auto res = interp.compile(frame->f_builtins, frame->f_globals, jitted->j_profile, Optimized);
+    PyJit_RecordCompile(res.result, res.timings, (size_t)PyBytes_GET_SIZE(((PyCodeObject*)jitted->j_code)->co_code));
+    PyJit_RecordCompileTime(jitted, res.timings);
+    if (res.compiledCode == nullptr || res.result != Success) {
+        delete res.compiledCode;
+        PyErr_Clear();
+        return nullptr;
+    }
+    jitted->addCompiledCode(res.compiledCode, false);
+    PyJit_PerfCodeLoaded((PyCodeObject*)jitted->j_code, res.compiledCode);
+    PyJit_SamplerCodeLoaded((PyCodeObject*)jitted->j_code, res.compiledCode);
+    PyJit_EnforceCodeBudget(jitted);
+    return res.compiledCode;
+}
+
+// Picks the entry point for the argument types in frame. The main entry point is used when the
+// types match the ones it was compiled for, otherwise one of up to SPECIALIZATION_LIMIT entry
+// points specialized on other argument types, and then a generic version once those run out.
+static Py_EvalFunc PyJit_SelectEntryPoint(PyjionJittedCode* jitted, PyFrameObject* frame, Py_EvalFunc addr) {
+    if (PyJit_ArgTypesMatch(jitted->j_argTypes, frame))
+        return addr;
+
+    for (size_t i = 0; i < jitted->j_specializationCount; i++) {
+        auto& specialization = jitted->j_specializations[i];
+        if (PyJit_ArgTypesMatch(specialization.argTypes, frame))
+            return specialization.addr != nullptr ? specialization.addr : addr;
+    }
+
+    if (jitted->j_blacklisted)
+        return addr;
+
+    if (!jitted->beginCompile())
+        return addr;
+    Py_EvalFunc selected = addr;
+    if (jitted->j_specializationCount < SPECIALIZATION_LIMIT) {
+        auto& specialization = jitted->j_specializations[jitted->j_specializationCount++];
+        specialization.argTypes.resize(jitted->j_argTypes.size());
+        for (size_t i = 0; i < jitted->j_argTypes.size(); i++) {
+            auto arg = frame->f_localsplus[i];
+            specialization.argTypes[i] = arg == nullptr ? nullptr : Py_TYPE(arg);
+        }
+        specialization.code = PyJit_CompileSpecialization(jitted, frame, false);
+        if (specialization.code != nullptr)
+            specialization.addr = (Py_EvalFunc)specialization.code->get_code_addr();
+        if (specialization.addr != nullptr)
+            selected = specialization.addr;
+    } else {
+        if (jitted->j_genericAddr == nullptr && !jitted->j_genericFailed) {
+            jitted->j_genericCode = PyJit_CompileSpecialization(jitted, frame, true);
+            if (jitted->j_genericCode != nullptr)
+                jitted->j_genericAddr = (Py_EvalFunc)jitted->j_genericCode->get_code_addr();
+            jitted->j_genericFailed = jitted->j_genericCode == nullptr;
+        }
+        if (jitted->j_genericAddr != nullptr)
+            selected = jitted->j_genericAddr;
+    }
+    // A failed specialization falls back to the main entry point, it doesn't fail the code
+    jitted->endCompile(CompileStateCompiled);
+    return selected;
+}
+
+PyObject* PyJit_ExecuteAndCompileFrame(PyjionJittedCode* state, PyFrameObject *frame, PyThreadState* tstate, PyjionCodeProfile* profile) {
+    // Compile and run the now compiled code...
+    int argCount = frame->f_code->co_argcount + frame->f_code->co_kwonlyargcount;
+    if (!PyJit_CompileCode(state, frame->f_builtins, frame->f_globals, frame->f_localsplus, argCount, profile)) {
+        // Failed, or another thread is compiling it, keep running the tier it has
+        auto addr = state->j_addr.load(memory_order_acquire);
+        if (addr != nullptr)
+            return PyJit_ExecuteJittedFrame((void*)addr, frame, tstate, state);
+        return _PyEval_EvalFrameDefault(tstate, frame, 0);
+    }
+
     // Execute it now.
-    return PyJit_ExecuteJittedFrame((void*)state->j_addr, frame, tstate, state->j_profile);
+    return PyJit_ExecuteJittedFrame((void*)state->j_addr.load(), frame, tstate, state);
 }
 
 PyjionJittedCode* PyJit_EnsureExtra(PyObject* codeObject) {
-	auto index = (ssize_t)PyThread_tss_get(g_extraSlot);
-	if (index == 0) {
+	// Extra indices are allocated by each interpreter
+	auto state = PyJit_CurrentInterpreterState();
+	if (state == &g_defaultInterpreterState)
+		return nullptr;
+	auto index = state->codeExtraIndex;
+	if (index == -1) {
 		index = _PyEval_RequestCodeExtraIndex(PyjionJitFree);
 		if (index == -1) {
 			return nullptr;
 		}
-
-		PyThread_tss_set(g_extraSlot, (void*)((index << 1) | 0x01));
-	}
-	else {
-		index = index >> 1;
+		state->codeExtraIndex = index;
 	}
 
 	PyjionJittedCode *jitted = nullptr;
@@ -299,43 +879,61 @@ PyjionJittedCode* PyJit_EnsureExtra(PyObject* codeObject) {
 				delete jitted;
 				return nullptr;
 			}
+			jitted->j_interpreter = state;
+			state->jittedCode.insert(jitted);
+			PyJit_ApplyStoredProfile(jitted);
 		}
 	}
 	return jitted;
 }
 
+unordered_set<PyjionJittedCode*>& PyJit_GetJittedCode() {
+    return PyJit_CurrentInterpreterState()->jittedCode;
+}
+
 // This is our replacement evaluation function.  We lookup our corresponding jitted code
 // and dispatch to it if it's already compiled.  If it hasn't yet been compiled we'll
 // eventually compile it and invoke it.  If it's not time to compile it yet then we'll
 // invoke the default evaluation function.
 PyObject* PyJit_EvalFrame(PyThreadState *ts, PyFrameObject *f, int throwflag) {
+	PyJit_SamplerSafePoint();
 	auto jitted = PyJit_EnsureExtra((PyObject*)f->f_code);
 	if (jitted != nullptr && !throwflag) {
-		if (jitted->j_addr != nullptr && (!g_pyjionSettings.pgc || jitted->j_pgc_status == Optimized)) {
+		auto addr = jitted->j_addr.load(memory_order_acquire);
+		if (addr != nullptr && (!PyJit_Settings().pgc || jitted->j_pgc_status == Optimized)) {
             jitted->j_run_count++;
-			return PyJit_ExecuteJittedFrame((void*)jitted->j_addr, f, ts, jitted->j_profile);
+			return PyJit_ExecuteJittedFrame((void*)PyJit_SelectEntryPoint(jitted, f, addr), f, ts, jitted);
 		}
-		else if (!jitted->j_failed && jitted->j_run_count++ >= jitted->j_specialization_threshold) {
-			auto result = PyJit_ExecuteAndCompileFrame(jitted, f, ts, jitted->j_profile);
-            jitted->j_pgc_status = nextPgcStatus(jitted->j_pgc_status);
-			return result;
+		else if (addr != nullptr && jitted->profiledHotness() < PyJit_Settings().optimizeThreshold) {
+		    // Still in the profiling tier, keep collecting until it's hot enough to optimize
+		    jitted->j_run_count++;
+		    return PyJit_ExecuteJittedFrame((void*)addr, f, ts, jitted);
+		}
+		else if (!jitted->failed() && jitted->j_run_count++ + jitted->j_backedge_count >= PyJit_Settings().threshold) {
+		    if (PyJit_Settings().background && PyJit_QueueCompile(jitted, f)) {
+		        // Keep going while the compile is pending, running the profiling tier
+		        // if there is one so the optimized compile has a profile to work from.
+		        if (addr != nullptr)
+		            return PyJit_ExecuteJittedFrame((void*)addr, f, ts, jitted);
+		        return PyJit_EvalFrameInterpreted(jitted, ts, f, throwflag);
+		    }
+			return PyJit_ExecuteAndCompileFrame(jitted, f, ts, jitted->j_profile);
 		}
 	}
-	return _PyEval_EvalFrameDefault(ts, f, throwflag);
+	return PyJit_EvalFrameInterpreted(jitted, ts, f, throwflag);
 }
 
 void PyjionJitFree(void* obj) {
     if (obj == nullptr)
         return;
     auto* code_obj = static_cast<PyjionJittedCode *>(obj);
-    Py_XDECREF(code_obj->j_code);
-    free(code_obj->j_il);
-    code_obj->j_il = nullptr;
-    delete code_obj->j_profile;
+    code_obj->j_interpreter->jittedCode.erase(code_obj);
+    delete code_obj;
 }
 
+// The JIT is enabled on the interpreter of the calling thread, subinterpreters are enabled separately
 static PyInterpreterState* inter(){
-    return PyInterpreterState_Main();
+    return PyThreadState_GetInterpreter(PyThreadState_Get());
 }
 
 static PyObject *pyjion_enable(PyObject *self, PyObject* args) {
@@ -375,15 +973,83 @@ static PyObject *pyjion_info(PyObject *self, PyObject* func) {
 	}
 
 	PyjionJittedCode* jitted = PyJit_EnsureExtra(code);
+	if (jitted == nullptr) {
+		// No JIT state could be attached to the code object, so it only runs in the interpreter
+		PyDict_SetItemString(res, "failed", Py_False);
+		PyDict_SetItemString(res, "compiled", Py_False);
+		return res;
+	}
 
-	PyDict_SetItemString(res, "failed", jitted->j_failed ? Py_True : Py_False);
+	PyDict_SetItemString(res, "failed", jitted->failed() ? Py_True : Py_False);
+	PyDict_SetItemString(res, "compiling", jitted->j_compileState == CompileStateCompiling ? Py_True : Py_False);
     PyDict_SetItemString(res, "compile_result", PyLong_FromLong(jitted->j_compile_result));
     PyDict_SetItemString(res, "compiled", jitted->j_addr != nullptr ? Py_True : Py_False);
     PyDict_SetItemString(res, "pgc", PyLong_FromLong(jitted->j_pgc_status));
+    PyDict_SetItemString(res, "deoptimizations", PyLong_FromUnsignedLong(jitted->j_deoptimizations));
 
     auto runCount = PyLong_FromUnsignedLongLong(jitted->j_run_count);
 	PyDict_SetItemString(res, "run_count", runCount);
 	Py_DECREF(runCount);
+
+	auto backEdgeCount = PyLong_FromUnsignedLongLong(jitted->j_backedge_count);
+	PyDict_SetItemString(res, "backedge_count", backEdgeCount);
+	Py_DECREF(backEdgeCount);
+
+	auto hotness = PyLong_FromUnsignedLongLong(jitted->hotness());
+	PyDict_SetItemString(res, "hotness", hotness);
+	Py_DECREF(hotness);
+
+	auto osrCount = PyLong_FromUnsignedLongLong(jitted->j_osr_count);
+	PyDict_SetItemString(res, "osr_count", osrCount);
+	Py_DECREF(osrCount);
+
+	auto specializations = PyLong_FromSize_t(jitted->j_specializationCount);
+	PyDict_SetItemString(res, "specializations", specializations);
+	Py_DECREF(specializations);
+	PyDict_SetItemString(res, "generic", jitted->j_genericAddr != nullptr ? Py_True : Py_False);
+	PyDict_SetItemString(res, "evictions", PyLong_FromUnsignedLong(jitted->j_evictions));
+	PyDict_SetItemString(res, "blacklisted", jitted->j_blacklisted ? Py_True : Py_False);
+	PyDict_SetItemString(res, "compile_count", PyLong_FromUnsignedLong(jitted->j_compileCount));
+	PyDict_SetItemString(res, "il_size", PyLong_FromUnsignedLong(jitted->j_ilLen));
+	PyDict_SetItemString(res, "native_size", PyLong_FromUnsignedLong(jitted->j_nativeSize));
+
+	auto compileTime = PyDict_New();
+	if (compileTime == nullptr) {
+	    Py_DECREF(res);
+	    return nullptr;
+	}
+	PyDict_SetItemString(compileTime, "interpret", PyLong_FromUnsignedLongLong(jitted->j_compileTime.interpret));
+	PyDict_SetItemString(compileTime, "compile_worker", PyLong_FromUnsignedLongLong(jitted->j_compileTime.compileWorker));
+	PyDict_SetItemString(compileTime, "compile_method", PyLong_FromUnsignedLongLong(jitted->j_compileTime.compileMethod));
+	PyDict_SetItemString(compileTime, "total", PyLong_FromUnsignedLongLong(jitted->j_compileTime.total()));
+	PyDict_SetItemString(res, "compile_time", compileTime);
+	Py_DECREF(compileTime);
+	PyDict_SetItemString(res, "calls", PyLong_FromUnsignedLongLong(jitted->j_timingCalls));
+	PyDict_SetItemString(res, "cycles", PyLong_FromUnsignedLongLong(jitted->j_timingCycles));
+
+	// {bytecode offset: executions} for the instructions that have run
+	auto opcodeCounts = PyDict_New();
+	if (opcodeCounts == nullptr) {
+	    Py_DECREF(res);
+	    return nullptr;
+	}
+	for (size_t i = 0; i < jitted->j_opcodeCountsLen; i++) {
+	    if (jitted->j_opcodeCounts[i] == 0)
+	        continue;
+	    PyObject* offset = PyLong_FromSize_t(i * sizeof(_Py_CODEUNIT));
+	    PyObject* count = PyLong_FromUnsignedLongLong(jitted->j_opcodeCounts[i]);
+	    if (offset == nullptr || count == nullptr || PyDict_SetItem(opcodeCounts, offset, count) == -1) {
+	        Py_XDECREF(offset);
+	        Py_XDECREF(count);
+	        Py_DECREF(opcodeCounts);
+	        Py_DECREF(res);
+	        return nullptr;
+	    }
+	    Py_DECREF(offset);
+	    Py_DECREF(count);
+	}
+	PyDict_SetItemString(res, "opcode_counts", opcodeCounts);
+	Py_DECREF(opcodeCounts);
 	
 	return res;
 }
@@ -402,7 +1068,7 @@ static PyObject *pyjion_dump_il(PyObject *self, PyObject* func) {
     }
 
     PyjionJittedCode* jitted = PyJit_EnsureExtra(code);
-    if (jitted->j_failed || jitted->j_addr == nullptr)
+    if (jitted->failed() || jitted->j_addr == nullptr)
          Py_RETURN_NONE;
 
     auto res = PyByteArray_FromStringAndSize(reinterpret_cast<const char *>(jitted->j_il), jitted->j_ilLen);
@@ -426,14 +1092,14 @@ static PyObject* pyjion_dump_native(PyObject *self, PyObject* func) {
     }
 
     PyjionJittedCode* jitted = PyJit_EnsureExtra(code);
-    if (jitted->j_failed || jitted->j_addr == nullptr)
+    if (jitted->failed() || jitted->j_addr == nullptr)
         Py_RETURN_NONE;
 
     auto result_t = PyTuple_New(3);
     if (result_t == nullptr)
         return nullptr;
 
-    auto res = PyByteArray_FromStringAndSize(reinterpret_cast<const char *>(jitted->j_addr), jitted->j_nativeSize);
+    auto res = PyByteArray_FromStringAndSize(reinterpret_cast<const char *>(jitted->j_addr.load()), jitted->j_nativeSize);
     if (res == nullptr)
         return nullptr;
 
@@ -469,7 +1135,7 @@ static PyObject* pyjion_get_offsets(PyObject* self, PyObject* func ){
     }
 
     PyjionJittedCode* jitted = PyJit_EnsureExtra(code);
-    if (jitted->j_failed || jitted->j_addr == nullptr)
+    if (jitted->failed() || jitted->j_addr == nullptr)
         Py_RETURN_NONE;
 
     auto offsets = PyTuple_New(jitted->j_sequencePointsLen + jitted->j_callPointsLen);
@@ -511,62 +1177,82 @@ static PyObject* pyjion_set_threshold(PyObject *self, PyObject* args) {
 		return nullptr;
 	}
 
-	auto prev = PyLong_FromUnsignedLongLong(HOT_CODE);
-	HOT_CODE = PyLong_AsLongLong(args);
+	auto prev = PyLong_FromUnsignedLongLong(PyJit_Settings().threshold);
+	PyJit_Settings().threshold = PyLong_AsLongLong(args);
 	return prev;
 }
 
 static PyObject* pyjion_get_threshold(PyObject *self, PyObject* args) {
-	return PyLong_FromUnsignedLongLong(HOT_CODE);
+	return PyLong_FromUnsignedLongLong(PyJit_Settings().threshold);
 }
 
 static PyObject* pyjion_enable_tracing(PyObject *self, PyObject* args) {
-    g_pyjionSettings.tracing = true;
+    PyJit_Settings().tracing = true;
     Py_RETURN_NONE;
 }
 
 static PyObject* pyjion_disable_tracing(PyObject *self, PyObject* args) {
-    g_pyjionSettings.tracing = false;
+    PyJit_Settings().tracing = false;
     Py_RETURN_NONE;
 }
 
 static PyObject* pyjion_enable_debug(PyObject *self, PyObject* args) {
-    g_pyjionSettings.debug = true;
+    PyJit_Settings().debug = true;
     Py_RETURN_NONE;
 }
 
 static PyObject* pyjion_disable_debug(PyObject *self, PyObject* args) {
-    g_pyjionSettings.debug = false;
+    PyJit_Settings().debug = false;
     Py_RETURN_NONE;
 }
 
 static PyObject* pyjion_enable_profiling(PyObject *self, PyObject* args) {
-    g_pyjionSettings.profiling = true;
+    PyJit_Settings().profiling = true;
     Py_RETURN_NONE;
 }
 
 static PyObject* pyjion_disable_profiling(PyObject *self, PyObject* args) {
-    g_pyjionSettings.profiling = false;
+    PyJit_Settings().profiling = false;
+    Py_RETURN_NONE;
+}
+
+static PyObject* pyjion_enable_timing(PyObject *self, PyObject* args) {
+    PyJit_Settings().timing = true;
+    Py_RETURN_NONE;
+}
+
+static PyObject* pyjion_disable_timing(PyObject *self, PyObject* args) {
+    PyJit_Settings().timing = false;
+    Py_RETURN_NONE;
+}
+
+static PyObject* pyjion_enable_opcode_counts(PyObject *self, PyObject* args) {
+    PyJit_Settings().opcodeCounts = true;
+    Py_RETURN_NONE;
+}
+
+static PyObject* pyjion_disable_opcode_counts(PyObject *self, PyObject* args) {
+    PyJit_Settings().opcodeCounts = false;
     Py_RETURN_NONE;
 }
 
 static PyObject* pyjion_enable_pgc(PyObject *self, PyObject* args) {
-    g_pyjionSettings.pgc = true;
+    PyJit_Settings().pgc = true;
     Py_RETURN_NONE;
 }
 
 static PyObject* pyjion_disable_pgc(PyObject *self, PyObject* args) {
-    g_pyjionSettings.pgc = false;
+    PyJit_Settings().pgc = false;
     Py_RETURN_NONE;
 }
 
 static PyObject* pyjion_enable_graphs(PyObject *self, PyObject* args) {
-    g_pyjionSettings.graph = true;
+    PyJit_Settings().graph = true;
     Py_RETURN_NONE;
 }
 
 static PyObject* pyjion_disable_graphs(PyObject *self, PyObject* args) {
-    g_pyjionSettings.graph = false;
+    PyJit_Settings().graph = false;
     Py_RETURN_NONE;
 }
 
@@ -576,16 +1262,165 @@ static PyObject* pyjion_status(PyObject *self, PyObject* args) {
 		return nullptr;
 	}
 
-	PyDict_SetItemString(res, "clrjitpath", PyUnicode_FromWideChar(g_pyjionSettings.clrjitpath, -1));
-	PyDict_SetItemString(res, "tracing", g_pyjionSettings.tracing ? Py_True : Py_False);
-	PyDict_SetItemString(res, "profiling", g_pyjionSettings.profiling ? Py_True : Py_False);
-	PyDict_SetItemString(res, "pgc", g_pyjionSettings.pgc ? Py_True : Py_False);
-	PyDict_SetItemString(res, "graph", g_pyjionSettings.graph ? Py_True : Py_False);
- 	PyDict_SetItemString(res, "debug", g_pyjionSettings.debug ? Py_True : Py_False);
+	PyDict_SetItemString(res, "clrjitpath", PyUnicode_FromWideChar(PyJit_Settings().clrjitpath, -1));
+	PyDict_SetItemString(res, "tracing", PyJit_Settings().tracing ? Py_True : Py_False);
+	PyDict_SetItemString(res, "profiling", PyJit_Settings().profiling ? Py_True : Py_False);
+	PyDict_SetItemString(res, "timing", PyJit_Settings().timing ? Py_True : Py_False);
+	PyDict_SetItemString(res, "opcode_counts", PyJit_Settings().opcodeCounts ? Py_True : Py_False);
+	PyDict_SetItemString(res, "pgc", PyJit_Settings().pgc ? Py_True : Py_False);
+	PyDict_SetItemString(res, "graph", PyJit_Settings().graph ? Py_True : Py_False);
+ 	PyDict_SetItemString(res, "debug", PyJit_Settings().debug ? Py_True : Py_False);
+	PyDict_SetItemString(res, "background", PyJit_Settings().background ? Py_True : Py_False);
+	PyDict_SetItemString(res, "code_bytes", PyLong_FromSize_t(PyJit_CurrentInterpreterState()->jittedCodeBytes));
+
+	auto queueStats = PyJit_GetCompileQueueStats();
+	auto queue = PyDict_New();
+	if (queue == nullptr) {
+	    Py_DECREF(res);
+	    return nullptr;
+	}
+	PyDict_SetItemString(queue, "depth", PyLong_FromSize_t(queueStats.depth));
+	PyDict_SetItemString(queue, "max_depth", PyLong_FromSize_t(queueStats.maxDepth));
+	PyDict_SetItemString(queue, "queued", PyLong_FromSize_t(queueStats.queued));
+	PyDict_SetItemString(queue, "completed", PyLong_FromSize_t(queueStats.completed));
+	PyDict_SetItemString(res, "compile_queue", queue);
+	Py_DECREF(queue);
+
+	auto heapStats = PyJit_GetCodeHeapStats();
+	auto heap = PyDict_New();
+	if (heap == nullptr) {
+	    Py_DECREF(res);
+	    return nullptr;
+	}
+	PyDict_SetItemString(heap, "regions", PyLong_FromSize_t(heapStats.regions));
+	PyDict_SetItemString(heap, "reserved", PyLong_FromSize_t(heapStats.reserved));
+	PyDict_SetItemString(heap, "used", PyLong_FromSize_t(heapStats.used));
+	PyDict_SetItemString(heap, "free", PyLong_FromSize_t(heapStats.free));
+	PyDict_SetItemString(heap, "largest_free", PyLong_FromSize_t(heapStats.largestFree));
+	PyDict_SetItemString(heap, "allocations", PyLong_FromSize_t(heapStats.allocations));
+	// Share of the free space which can't be used for the largest allocation
+	PyDict_SetItemString(heap, "fragmentation", PyFloat_FromDouble(
+	        heapStats.free == 0 ? 0.0 : 1.0 - (double)heapStats.largestFree / (double)heapStats.free));
+	PyDict_SetItemString(heap, "double_mapped", heapStats.doubleMapped ? Py_True : Py_False);
+	PyDict_SetItemString(res, "code_heap", heap);
+	Py_DECREF(heap);
 
 	return res;
 }
 
+static PyObject* pyjion_stats(PyObject *self, PyObject* args) {
+    auto res = PyJit_GetCompileStats();
+    if (res == nullptr)
+        return nullptr;
+    PyDict_SetItemString(res, "native_bytes", PyLong_FromSize_t(PyJit_CurrentInterpreterState()->jittedCodeBytes));
+    PyDict_SetItemString(res, "il_bytes", PyLong_FromSize_t(PyJit_CurrentInterpreterState()->jittedILBytes));
+    return res;
+}
+
+static PyObject* pyjion_reset_stats(PyObject *self, PyObject* args) {
+    PyJit_ResetCompileStats();
+    Py_RETURN_NONE;
+}
+
+static PyObject* pyjion_start_sampling(PyObject *self, PyObject* args) {
+    int hz = 100;
+    if (!PyArg_ParseTuple(args, "|i", &hz))
+        return nullptr;
+    if (hz <= 0) {
+        PyErr_SetString(PyExc_ValueError, "Expected positive sample rate");
+        return nullptr;
+    }
+    if (!PyJit_StartSampler(hz))
+        return nullptr;
+    Py_RETURN_NONE;
+}
+
+static PyObject* pyjion_stop_sampling(PyObject *self, PyObject* args) {
+    PyJit_StopSampler();
+    Py_RETURN_NONE;
+}
+
+static PyObject* pyjion_get_samples(PyObject *self, PyObject* args) {
+    return PyJit_GetSamples();
+}
+
+static PyObject* pyjion_clear_samples(PyObject *self, PyObject* args) {
+    PyJit_ClearSamples();
+    Py_RETURN_NONE;
+}
+
+static PyObject* pyjion_save_profiles(PyObject *self, PyObject* path) {
+    if (!PyJit_SaveProfiles(path))
+        return nullptr;
+    Py_RETURN_NONE;
+}
+
+static PyObject* pyjion_load_profiles(PyObject *self, PyObject* path) {
+    auto loaded = PyJit_LoadProfiles(path);
+    if (loaded == -1)
+        return nullptr;
+    return PyLong_FromSsize_t(loaded);
+}
+
+static PyObject* pyjion_config(PyObject *self, PyObject* args, PyObject* kwargs) {
+    static const char *kwlist[] = {"background", "threshold", "optimize_threshold", "osr", "code_budget", "compile_time_budget", "perf_map", "jitdump", "gdb", nullptr};
+    int background = -1, osr = -1, perfMap = -1, jitdump = -1, gdb = -1;
+    long long threshold = -1, optimizeThreshold = -1, codeBudget = -1, compileTimeBudget = -1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|$pLLpLLppp", const_cast<char **>(kwlist), &background, &threshold, &optimizeThreshold, &osr, &codeBudget, &compileTimeBudget, &perfMap, &jitdump, &gdb))
+        return nullptr;
+
+    if (threshold < -1 || optimizeThreshold < -1) {
+        PyErr_SetString(PyExc_ValueError, "Expected positive threshold");
+        return nullptr;
+    }
+    if (codeBudget < -1 || compileTimeBudget < -1) {
+        PyErr_SetString(PyExc_ValueError, "Expected positive budget");
+        return nullptr;
+    }
+    if (compileTimeBudget != -1)
+        PyJit_Settings().compileTimeBudget = compileTimeBudget;
+    if (perfMap != -1)
+        PyJit_Settings().perfMap = perfMap;
+    if (jitdump != -1) {
+        PyJit_Settings().jitdump = jitdump;
+        if (!jitdump)
+            PyJit_CloseJitDump();
+    }
+    if (gdb != -1)
+        PyJit_Settings().gdbJit = gdb;
+    if (codeBudget != -1)
+        PyJit_Settings().codeBudget = codeBudget;
+    if (threshold != -1)
+        PyJit_Settings().threshold = threshold;
+    if (optimizeThreshold != -1)
+        PyJit_Settings().optimizeThreshold = optimizeThreshold;
+    if (osr != -1)
+        PyJit_Settings().osr = osr;
+
+    if (background != -1) {
+        PyJit_Settings().background = background;
+        if (background)
+            PyJit_StartCompileQueue();
+        else
+            PyJit_StopCompileQueue();
+    }
+
+    auto res = PyDict_New();
+    if (res == nullptr)
+        return nullptr;
+    PyDict_SetItemString(res, "background", PyJit_Settings().background ? Py_True : Py_False);
+    PyDict_SetItemString(res, "threshold", PyLong_FromUnsignedLongLong(PyJit_Settings().threshold));
+    PyDict_SetItemString(res, "optimize_threshold", PyLong_FromUnsignedLongLong(PyJit_Settings().optimizeThreshold));
+    PyDict_SetItemString(res, "osr", PyJit_Settings().osr ? Py_True : Py_False);
+    PyDict_SetItemString(res, "code_budget", PyLong_FromSize_t(PyJit_Settings().codeBudget));
+    PyDict_SetItemString(res, "compile_time_budget", PyLong_FromUnsignedLongLong(PyJit_Settings().compileTimeBudget));
+    PyDict_SetItemString(res, "perf_map", PyJit_Settings().perfMap ? Py_True : Py_False);
+    PyDict_SetItemString(res, "jitdump", PyJit_Settings().jitdump ? Py_True : Py_False);
+    PyDict_SetItemString(res, "gdb", PyJit_Settings().gdbJit ? Py_True : Py_False);
+    return res;
+}
+
 static PyObject *pyjion_get_graph(PyObject *self, PyObject* func) {
     PyObject* code;
     if (PyFunction_Check(func)) {
@@ -663,13 +1498,13 @@ static PyMethodDef PyjionMethods[] = {
 		"enable",  
 		pyjion_enable, 
 		METH_NOARGS, 
-		"Enable the JIT.  Returns True if the JIT was enabled, False if it was already enabled." 
+		"Enable the JIT for the current interpreter.  Returns True if the JIT was enabled, False if it was already enabled." 
 	},
 	{ 
 		"disable", 
 		pyjion_disable, 
 		METH_NOARGS, 
-		"Disable the JIT.  Returns True if the JIT was disabled, False if it was already disabled." 
+		"Disable the JIT for the current interpreter.  Returns True if the JIT was disabled, False if it was already disabled." 
 	},
 	{
 		"info",
@@ -699,7 +1534,7 @@ static PyMethodDef PyjionMethods[] = {
 		"set_threshold",
 		pyjion_set_threshold,
 		METH_O,
-		"Sets the number of times a method needs to be executed before the JIT is triggered."
+		"Sets the hotness (calls, plus loop back-edges when OSR is enabled) a function needs to reach before the JIT is triggered."
 	},
 	{
 		"get_threshold",
@@ -749,6 +1584,30 @@ static PyMethodDef PyjionMethods[] = {
         METH_NOARGS,
         "Disable Python profiling for generated code."
     },
+    {
+        "enable_timing",
+        pyjion_enable_timing,
+        METH_NOARGS,
+        "Count cycles and calls at the entry and exit of generated code."
+    },
+    {
+        "disable_timing",
+        pyjion_disable_timing,
+        METH_NOARGS,
+        "Stop counting cycles and calls in generated code."
+    },
+    {
+        "enable_opcode_counts",
+        pyjion_enable_opcode_counts,
+        METH_NOARGS,
+        "Count the executions of each bytecode instruction in generated code."
+    },
+    {
+        "disable_opcode_counts",
+        pyjion_disable_opcode_counts,
+        METH_NOARGS,
+        "Stop counting instruction executions in generated code."
+    },
     {
         "enable_pgc",
         pyjion_enable_pgc,
@@ -791,6 +1650,60 @@ static PyMethodDef PyjionMethods[] = {
         METH_NOARGS,
         "JIT Status."
       },
+    {
+        "config",
+        (PyCFunction)(void(*)(void))pyjion_config,
+        METH_VARARGS | METH_KEYWORDS,
+        "Change the JIT configuration, returns the current configuration."
+    },
+    {
+        "stats",
+        pyjion_stats,
+        METH_NOARGS,
+        "Return the process-wide JIT counters and the code size of the current interpreter."
+    },
+    {
+        "reset_stats",
+        pyjion_reset_stats,
+        METH_NOARGS,
+        "Reset the counters returned by stats()."
+    },
+    {
+        "save_profiles",
+        pyjion_save_profiles,
+        METH_O,
+        "Write the PGC profiles of profiled functions to a file."
+    },
+    {
+        "load_profiles",
+        pyjion_load_profiles,
+        METH_O,
+        "Load PGC profiles from a file, returns the number of profiles loaded."
+    },
+    {
+        "start_sampling",
+        pyjion_start_sampling,
+        METH_VARARGS,
+        "Start sampling the native PC hz times a second of CPU time."
+    },
+    {
+        "stop_sampling",
+        pyjion_stop_sampling,
+        METH_NOARGS,
+        "Stop the sampling profiler."
+    },
+    {
+        "get_samples",
+        pyjion_get_samples,
+        METH_NOARGS,
+        "Return the samples taken by the sampling profiler, by Python line."
+    },
+    {
+        "clear_samples",
+        pyjion_clear_samples,
+        METH_NOARGS,
+        "Reset the samples taken by the sampling profiler."
+    },
   {
         "symbols",
         pyjion_symbols,
@@ -801,17 +1714,37 @@ static PyMethodDef PyjionMethods[] = {
 	{nullptr, nullptr, 0, nullptr}        /* Sentinel */
 };
 
+// The module state is the ID of the interpreter that imported it
+static void pyjion_free(void* module) {
+    auto id = (int64_t*)PyModule_GetState((PyObject*)module);
+    if (id == nullptr)
+        return;
+    // Frames the interpreter still runs go back to CPython once the state is gone
+    auto interp = PyThreadState_GetInterpreter(PyThreadState_Get());
+    if (PyInterpreterState_GetID(interp) == *id && _PyInterpreterState_GetEvalFrameFunc(interp) == PyJit_EvalFrame)
+        _PyInterpreterState_SetEvalFrameFunc(interp, _PyEval_EvalFrameDefault);
+    PyJit_FreeInterpreterState(*id);
+}
+
 static struct PyModuleDef pyjionmodule = {
 	PyModuleDef_HEAD_INIT,
 	"_pyjion",   /* name of module */
 	"Pyjion - A Just-in-Time Compiler for CPython", /* module documentation, may be NULL */
-	-1,       /* size of per-interpreter state of the module,
+	sizeof(int64_t),       /* size of per-interpreter state of the module,
 			  or -1 if the module keeps state in global variables. */
-	PyjionMethods
-}; 
+	PyjionMethods,
+	nullptr,
+	nullptr,
+	nullptr,
+	pyjion_free
+};
 
 PyMODINIT_FUNC PyInit__pyjion(void)
 {
-	// Install our frame evaluation function
-	return PyModule_Create(&pyjionmodule);
+	// Called again by each interpreter that imports it
+	auto module = PyModule_Create(&pyjionmodule);
+	if (module == nullptr)
+		return nullptr;
+	*(int64_t*)PyModule_GetState(module) = PyInterpreterState_GetID(PyThreadState_GetInterpreter(PyThreadState_Get()));
+	return module;
 }
@@ -42,6 +42,8 @@
 
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
+#include <atomic>
 
 #include <frameobject.h>
 #include <Python.h>
@@ -50,35 +52,86 @@
 
 using namespace std;
 
+// Number of distinct types counted at each profiled stack position
+#define PGC_HISTOGRAM_SIZE 4
+
+// A profiled stack position, written by inline IL in the probe tier (see emit_pgc_profile_capture).
+struct PyjionProfileSlot {
+    PyTypeObject* types[PGC_HISTOGRAM_SIZE] = {}; // In the order first seen, the slot holds references
+    size_t counts[PGC_HISTOGRAM_SIZE] = {};
+    size_t megamorphic = 0; // Hits for types that didn't fit in the histogram
+    size_t bigInteger = 0; // Set once an int of more than two digits (which may not fit in an int64) is seen
+
+    size_t hits() const {
+        size_t total = megamorphic;
+        for (auto count : counts)
+            total += count;
+        return total;
+    }
+
+    // Index of the most frequently seen type, or -1 if nothing has been seen
+    int dominant() const {
+        int result = -1;
+        for (int i = 0; i < PGC_HISTOGRAM_SIZE; i++) {
+            if (types[i] != nullptr && (result == -1 || counts[i] > counts[result]))
+                result = i;
+        }
+        return result;
+    }
+};
+
 class PyjionCodeProfile{
-    unordered_map<size_t, unordered_map<size_t, PyTypeObject *>> stackTypes;
-    unordered_map<size_t, unordered_map<size_t, AbstractValueKind>> stackKinds;
+    // One slot per probed stack position, allocated once so the compiled probes can
+    // write straight into it.
+    vector<PyjionProfileSlot> slots;
+    unordered_map<size_t, size_t> slotIndex; // opcode position -> first slot
+    unordered_set<size_t> deoptimizedSites;
+    vector<pair<size_t, size_t>> sites; // (opcode position, number of slots)
 public:
-    void record(size_t opcodePosition, size_t stackPosition, PyObject* obj);
+    void allocateSlots(const vector<pair<size_t, size_t>>& sites);
+    const vector<pair<size_t, size_t>>& getSites() const { return sites; }
+    const unordered_set<size_t>& getDeoptimizedSites() const { return deoptimizedSites; }
+    PyjionProfileSlot* getSlot(size_t opcodePosition, size_t stackPosition);
     PyTypeObject* getType(size_t opcodePosition, size_t stackPosition);
     AbstractValueKind getKind(size_t opcodePosition, size_t stackPosition);
+    void deoptimize(size_t opcodePosition);
+    bool isDeoptimized(size_t opcodePosition);
     ~PyjionCodeProfile();
 };
 
-void capturePgcStackValue(PyjionCodeProfile* profile, PyObject* value, size_t opcodePosition, size_t stackPosition);
+void deoptimizePgcSite(PyjionCodeProfile* profile, size_t opcodePosition);
 class PyjionJittedCode;
 
 bool JitInit(const wchar_t * jitpath);
+bool PyJit_CompileCode(PyjionJittedCode* state, PyObject* builtins, PyObject* globals, PyObject** args, size_t argCount, PyjionCodeProfile* profile);
 PyObject* PyJit_ExecuteAndCompileFrame(PyjionJittedCode* state, PyFrameObject *frame, PyThreadState* tstate, PyjionCodeProfile* profile);
-static inline PyObject* PyJit_ExecuteJittedFrame(void* state, PyFrameObject*frame, PyThreadState* tstate, PyjionCodeProfile* profile);
+static inline PyObject* PyJit_ExecuteJittedFrame(void* state, PyFrameObject*frame, PyThreadState* tstate, PyjionJittedCode* jitted);
 PyObject* PyJit_EvalFrame(PyThreadState *, PyFrameObject *, int);
 PyjionJittedCode* PyJit_EnsureExtra(PyObject* codeObject);
+// JIT state of the code objects run by the current interpreter
+unordered_set<PyjionJittedCode*>& PyJit_GetJittedCode();
 
 typedef PyObject* (*Py_EvalFunc)(PyjionJittedCode*, struct _frame*, PyThreadState*, PyjionCodeProfile*, PyObject**);
 
 typedef struct PyjionSettings {
     bool tracing = false;
     bool profiling = false;
+    bool timing = false; // Count cycles and calls at the entry and exit of compiled code
+    bool opcodeCounts = false; // Count the executions of each instruction in compiled code
+    PY_UINT64_T threshold = 10; // Hotness before a function is compiled, interpreted loop back-edges only count with osr
     bool pgc = true; // Profile-guided-compilation
     bool graph = false; // Generate instruction graphs
+    bool background = false; // Compile on a background thread instead of in the calling frame
+    PY_UINT64_T optimizeThreshold = 1; // Hotness (calls + loop back-edges) gained in the profiling tier before the PGC profile is used to optimize
+    bool osr = false; // Move hot loops in interpreted frames into jitted code (on-stack replacement)
     unsigned short optimizationLevel = 1;
     int recursionLimit = DEFAULT_RECURSION_LIMIT;
     size_t codeObjectSizeLimit = DEFAULT_CODEOBJECT_SIZE_LIMIT;
+    size_t codeBudget = 0; // Bytes of native code kept before the coldest functions are evicted, 0 for no limit
+    bool perfMap = false; // Write /tmp/perf-<pid>.map for Linux perf
+    bool jitdump = false; // Write a jitdump file with code and line numbers for perf inject --jit
+    bool gdbJit = false; // Describe compiled code to GDB through its JIT interface
+    PY_UINT64_T compileTimeBudget = 0; // Nanoseconds a function may take to compile before it is blacklisted, 0 for no limit
 #ifdef DEBUG
     bool debug = true;
 #else
@@ -102,11 +155,31 @@ typedef struct PyjionSettings {
     bool opt_unboxing = OPTIMIZE_UNBOXING; // OPT-16
 } PyjionSettings;
 
-static PY_UINT64_T HOT_CODE = 0;
+// JIT state kept for each interpreter that has initialized Pyjion, so subinterpreters can
+// enable and configure the JIT independently of the main interpreter.
+struct PyjionInterpreterState {
+    PyjionSettings settings;
+    Py_ssize_t codeExtraIndex = -1; // Index of the PyjionJittedCode in the code objects' co_extra
+    UserModule* module = nullptr; // Methods added by this interpreter's compiles, over the global methods
+    unordered_set<PyjionJittedCode*> jittedCode; // JIT state of every code object run by this interpreter
+    size_t jittedCodeBytes = 0; // Native code bytes held by every compiled version, checked against the code budget
+    size_t jittedILBytes = 0;
+};
+
+// Number of times a function will be sent back through PGC after a failed guard
+// before it is blacklisted and left to run in the interpreter.
+#define PGC_DEOPTIMIZE_RECOMPILE_LIMIT 3
 
-extern PyjionSettings g_pyjionSettings;
+// Number of extra entry points compiled for other argument types before falling back
+// to a single generic version of the code.
+#define SPECIALIZATION_LIMIT 4
 
-#define OPT_ENABLED(opt) g_pyjionSettings.opt_ ## opt
+PyjionInterpreterState* PyJit_GetInterpreterState(PyInterpreterState* interp);
+PyjionInterpreterState* PyJit_CurrentInterpreterState();
+// Settings of the interpreter the calling thread is running, the GIL must be held
+PyjionSettings& PyJit_Settings();
+
+#define OPT_ENABLED(opt) PyJit_Settings().opt_ ## opt
 
 void PyjionJitFree(void* obj);
 
@@ -125,19 +198,82 @@ enum PgcStatus {
 
 PgcStatus nextPgcStatus(PgcStatus status);
 
+class JittedCode;
+
+// Nanoseconds spent in each phase of a compile
+struct AbstractInterpreterCompileTimings {
+    uint64_t interpret = 0; // Abstract interpretation of the bytecode
+    uint64_t compileWorker = 0; // Building the instruction graph and emitting the IL
+    uint64_t compileMethod = 0; // The CLR JIT compiling the IL
+
+    uint64_t total() const {
+        return interpret + compileWorker + compileMethod;
+    }
+};
+
+// An entry point compiled for one tuple of argument types. A null address means the
+// compile failed and the main entry point is used for these types.
+struct PyjionSpecialization {
+    vector<PyTypeObject*> argTypes;
+    Py_EvalFunc addr = nullptr;
+    JittedCode* code = nullptr;
+};
+
+// Compiles of a code object are claimed by moving it to CompileStateCompiling, so exactly one
+// thread compiles it. Threads that find it compiling keep running what they have (the
+// interpreter or the current tier) instead of waiting. The GIL can be released during a compile,
+// by a finalizer running Python code or while the CLR JIT runs, so the GIL alone isn't enough.
+enum PyjionCompileState {
+    CompileStateUncompiled,
+    CompileStateCompiling,
+    CompileStateCompiled,
+    CompileStateFailed,
+};
+
 class PyjionJittedCode {
 public:
 	PY_UINT64_T j_run_count;
-	bool j_failed;
+	PY_UINT64_T j_backedge_count;
+	atomic<PyjionCompileState> j_compileState;
 	short j_compile_result;
-	Py_EvalFunc j_addr;
-	PY_UINT64_T j_specialization_threshold;
-	PyObject* j_code;
+	atomic<Py_EvalFunc> j_addr;
+	PyObject* j_code; // Borrowed, this object is freed with the code object through co_extra
+	PyjionInterpreterState* j_interpreter; // The interpreter whose registry and code budget this code counts against
 	PyjionCodeProfile* j_profile;
     unsigned char* j_il;
     unsigned int j_ilLen;
     unsigned long j_nativeSize;
     PgcStatus j_pgc_status;
+    unsigned int j_deoptimizations;
+    bool j_compile_queued;
+    vector<PyTypeObject*> j_argTypes;
+    PyjionSpecialization j_specializations[SPECIALIZATION_LIMIT];
+    size_t j_specializationCount;
+    Py_EvalFunc j_genericAddr;
+    bool j_genericFailed;
+    JittedCode* j_genericCode;
+    // The compiled versions own the native code, IL, sequence points and call points. Versions
+    // replaced by a newer compile are retired and freed once no frame is running the code.
+    JittedCode* j_mainCode;
+    vector<JittedCode*> j_retiredCode;
+    size_t j_compiledSize;
+    size_t j_activeFrames;
+    PY_UINT64_T j_heat; // Decayed hotness, used to pick the functions evicted to stay within the code budget
+    PY_UINT64_T j_heatHotness;
+    PY_UINT64_T j_probedHotness; // Hotness when the profiling tier was compiled
+    unsigned int j_evictions;
+    PY_UINT64_T j_timingCycles; // Inclusive cycles spent in calls of code compiled with timing enabled
+    PY_UINT64_T j_timingCalls;
+    PY_UINT64_T* j_opcodeCounts; // Executions of each instruction by code compiled with opcode counts, indexed by offset / sizeof(_Py_CODEUNIT)
+    size_t j_opcodeCountsLen;
+    AbstractInterpreterCompileTimings j_compileTime; // Summed over every compile of this code
+    unsigned int j_compileCount;
+    bool j_blacklisted; // Went over the compile time budget (the code it has is kept) or kept deoptimizing (it runs interpreted), never recompiled
+    unordered_set<py_opindex> j_loopHeaders;
+    unordered_set<py_opindex> j_osrEntries;
+    int j_osrReturn;
+    bool j_loopsScanned;
+    PY_UINT64_T j_osr_count;
     SequencePoint* j_sequencePoints;
     unsigned int j_sequencePointsLen;
     CallPoint* j_callPoints;
@@ -148,22 +284,90 @@ public:
 	explicit PyjionJittedCode(PyObject* code) {
         j_compile_result = 0;
 		j_code = code;
+		j_interpreter = nullptr;
 		j_run_count = 0;
-		j_failed = false;
+		j_backedge_count = 0;
+		j_compileState = CompileStateUncompiled;
 		j_addr = nullptr;
-		j_specialization_threshold = HOT_CODE;
 		j_il = nullptr;
 		j_ilLen = 0;
 		j_nativeSize = 0;
 		j_profile = new PyjionCodeProfile();
 		j_graph = Py_None;
 		j_pgc_status = Uncompiled;
+		j_deoptimizations = 0;
+		j_compile_queued = false;
+		j_specializationCount = 0;
+		j_genericAddr = nullptr;
+		j_genericFailed = false;
+		j_genericCode = nullptr;
+		j_mainCode = nullptr;
+		j_compiledSize = 0;
+		j_activeFrames = 0;
+		j_heat = 0;
+		j_heatHotness = 0;
+		j_probedHotness = 0;
+		j_evictions = 0;
+		j_timingCycles = 0;
+		j_timingCalls = 0;
+		j_opcodeCounts = nullptr;
+		j_opcodeCountsLen = 0;
+		j_compileCount = 0;
+		j_blacklisted = false;
+		j_osrReturn = -1;
+		j_loopsScanned = false;
+		j_osr_count = 0;
 		j_sequencePoints = nullptr;
 		j_sequencePointsLen = 0;
-		Py_INCREF(code);
+		j_callPoints = nullptr;
+		j_callPointsLen = 0;
 	}
 
 	~PyjionJittedCode();
+
+	bool failed() const {
+	    return j_compileState.load(memory_order_acquire) == CompileStateFailed;
+	}
+
+	// Claims the code for a compile of any tier or specialization. Returns false if another
+	// compile is in progress (on this or another thread) or the code failed to compile.
+	bool beginCompile() {
+	    auto state = j_compileState.load(memory_order_acquire);
+	    do {
+	        if (state == CompileStateCompiling || state == CompileStateFailed)
+	            return false;
+	    } while (!j_compileState.compare_exchange_weak(state, CompileStateCompiling, memory_order_acq_rel));
+	    return true;
+	}
+
+	// Releases the claim taken by beginCompile
+	void endCompile(PyjionCompileState state) {
+	    j_compileState.store(state, memory_order_release);
+	}
+
+	// Calls are counted in the interpreter and jitted code, loop back-edges in the profiling tier
+	// and in interpreted frames that are being watched for OSR.
+	PY_UINT64_T hotness() const {
+	    return j_run_count + j_backedge_count;
+	}
+
+	// Hotness gained in the profiling tier, compared against optimizeThreshold
+	PY_UINT64_T profiledHotness() const {
+	    auto current = hotness();
+	    return current > j_probedHotness ? current - j_probedHotness : 0;
+	}
+
+	// Finds the loop headers (targets of backward jumps) and a RETURN_VALUE instruction
+	// an OSR frame can finish on. Returns false if the code can't be entered mid-loop.
+	bool scanLoops();
+
+	// Adds a compiled version, replacing the main entry point if main is set.
+	void addCompiledCode(JittedCode* code, bool main);
+	// Frees the retired versions, only once no frame is running this code.
+	void freeRetiredCode();
+	// Frees every compiled version and sends the code back to the interpreter, only once no
+	// frame is running this code.
+	void freeCompiledCode();
 };
 
 void setOptimizationLevel(unsigned short level);
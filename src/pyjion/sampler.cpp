@@ -0,0 +1,229 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+
+#include <atomic>
+#include <map>
+#include <vector>
+#include <algorithm>
+
+#ifndef WINDOWS
+#include <csignal>
+#include <sys/time.h>
+#include <ucontext.h>
+#endif
+
+#include "sampler.h"
+#include "pyjit.h"
+#include "ipycomp.h"
+
+using namespace std;
+
+#define SAMPLE_BUFFER_SIZE 65536
+
+struct SampledCode {
+    uintptr_t end;
+    PyCodeObject* code; // Borrowed, the code object outlives its compiled code
+    vector<pair<uint32_t, int>> lines; // (native offset, line) in native offset order
+};
+
+// Compiled code by start address
+static map<uintptr_t, SampledCode> g_sampledCode;
+
+// Written by the signal handler, slots are zero when they are free
+static atomic<uintptr_t> g_sampleBuffer[SAMPLE_BUFFER_SIZE];
+static atomic<size_t> g_sampleHead{0};
+static atomic<size_t> g_sampleTail{0};
+static atomic<size_t> g_samplesDropped{0};
+
+static bool g_samplerRunning = false;
+static size_t g_samplesTotal = 0;
+static size_t g_samplesOther = 0;
+static PyObject* g_lineSamples = nullptr; // {(filename, name, line): samples}
+
+static_assert(ATOMIC_POINTER_LOCK_FREE == 2, "The sample buffer is written from a signal handler");
+
+#ifndef WINDOWS
+static struct sigaction g_previousAction;
+
+static uintptr_t interruptedPC(void* context) {
+    auto uc = (ucontext_t*)context;
+#if defined(__linux__) && defined(__x86_64__)
+    return (uintptr_t)uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__linux__) && defined(__aarch64__)
+    return (uintptr_t)uc->uc_mcontext.pc;
+#elif defined(__APPLE__) && defined(__x86_64__)
+    return (uintptr_t)uc->uc_mcontext->__ss.__rip;
+#elif defined(__APPLE__) && defined(__aarch64__)
+    return (uintptr_t)uc->uc_mcontext->__ss.__pc;
+#else
+    return 0;
+#endif
+}
+
+// Async-signal-safe, only touches the lock-free ring
+static void samplerSignalHandler(int signal, siginfo_t* info, void* context) {
+    uintptr_t pc = interruptedPC(context);
+    if (pc == 0)
+        return;
+    size_t head = g_sampleHead.load(memory_order_relaxed);
+    do {
+        if (head - g_sampleTail.load(memory_order_acquire) >= SAMPLE_BUFFER_SIZE) {
+            g_samplesDropped.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+    } while (!g_sampleHead.compare_exchange_weak(head, head + 1, memory_order_acq_rel));
+    g_sampleBuffer[head % SAMPLE_BUFFER_SIZE].store(pc, memory_order_release);
+}
+#endif
+
+static int lineForOffset(SampledCode& sampled, uint32_t offset) {
+    auto line = upper_bound(sampled.lines.begin(), sampled.lines.end(), make_pair(offset, INT_MAX));
+    if (line == sampled.lines.begin())
+        return sampled.code->co_firstlineno;
+    return (--line)->second;
+}
+
+static void recordSample(uintptr_t pc) {
+    g_samplesTotal++;
+    auto sampled = g_sampledCode.upper_bound(pc);
+    if (sampled == g_sampledCode.begin() || pc >= (--sampled)->second.end) {
+        g_samplesOther++;
+        return;
+    }
+    if (g_lineSamples == nullptr && (g_lineSamples = PyDict_New()) == nullptr) {
+        PyErr_Clear();
+        return;
+    }
+    auto code = sampled->second.code;
+    PyObject* key = Py_BuildValue("(OOi)", code->co_filename, code->co_name,
+                                  lineForOffset(sampled->second, (uint32_t)(pc - sampled->first)));
+    if (key == nullptr) {
+        PyErr_Clear();
+        return;
+    }
+    PyObject* count = PyDict_GetItemWithError(g_lineSamples, key);
+    PyObject* newCount = PyLong_FromSsize_t(count != nullptr ? PyLong_AsSsize_t(count) + 1 : 1);
+    if (newCount == nullptr || PyDict_SetItem(g_lineSamples, key, newCount) == -1)
+        PyErr_Clear();
+    Py_XDECREF(newCount);
+    Py_DECREF(key);
+}
+
+// Resolves the samples in the ring against the current address table, called with the GIL held
+static void drainSamples() {
+    size_t tail = g_sampleTail.load(memory_order_relaxed);
+    while (tail != g_sampleHead.load(memory_order_acquire)) {
+        // Zero means the handler has claimed the slot but not written it yet
+        uintptr_t pc = g_sampleBuffer[tail % SAMPLE_BUFFER_SIZE].exchange(0, memory_order_acquire);
+        if (pc == 0)
+            break;
+        recordSample(pc);
+        g_sampleTail.store(++tail, memory_order_release);
+    }
+}
+
+void PyJit_SamplerSafePoint() {
+    if (g_samplerRunning &&
+        g_sampleHead.load(memory_order_relaxed) - g_sampleTail.load(memory_order_relaxed) >= SAMPLE_BUFFER_SIZE / 2)
+        drainSamples();
+}
+
+void PyJit_SamplerCodeLoaded(PyCodeObject* code, JittedCode* compiled) {
+    auto start = (uintptr_t)compiled->get_code_addr();
+    SampledCode sampled = {start + compiled->get_native_size(), code, {}};
+    auto sequencePoints = compiled->get_sequence_points();
+    for (size_t i = 0; i < compiled->get_sequence_points_length(); i++) {
+        sampled.lines.emplace_back(sequencePoints[i].nativeOffset, PyCode_Addr2Line(code, (int)sequencePoints[i].pythonOpcodeIndex));
+    }
+    sort(sampled.lines.begin(), sampled.lines.end());
+    g_sampledCode[start] = std::move(sampled);
+}
+
+void PyJit_SamplerCodeUnloaded(JittedCode* compiled) {
+    drainSamples();
+    g_sampledCode.erase((uintptr_t)compiled->get_code_addr());
+}
+
+bool PyJit_StartSampler(int hz) {
+#ifdef WINDOWS
+    PyErr_SetString(PyExc_NotImplementedError, "The sampling profiler needs SIGPROF");
+    return false;
+#else
+    if (g_samplerRunning)
+        PyJit_StopSampler();
+    struct sigaction action = {};
+    action.sa_sigaction = samplerSignalHandler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &g_previousAction) == -1) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        return false;
+    }
+    struct itimerval timer = {};
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = hz >= 1000000 ? 1 : 1000000 / hz;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, nullptr) == -1) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        sigaction(SIGPROF, &g_previousAction, nullptr);
+        return false;
+    }
+    g_samplerRunning = true;
+    return true;
+#endif
+}
+
+void PyJit_StopSampler() {
+#ifndef WINDOWS
+    if (!g_samplerRunning)
+        return;
+    struct itimerval timer = {};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    sigaction(SIGPROF, &g_previousAction, nullptr);
+    g_samplerRunning = false;
+    drainSamples();
+#endif
+}
+
+PyObject* PyJit_GetSamples() {
+    drainSamples();
+    PyObject* lines = g_lineSamples != nullptr ? PyDict_Copy(g_lineSamples) : PyDict_New();
+    if (lines == nullptr)
+        return nullptr;
+    return Py_BuildValue("{sNsnsnsn}",
+                         "lines", lines,
+                         "total", (Py_ssize_t)g_samplesTotal,
+                         "other", (Py_ssize_t)g_samplesOther,
+                         "dropped", (Py_ssize_t)g_samplesDropped.load(memory_order_relaxed));
+}
+
+void PyJit_ClearSamples() {
+    drainSamples();
+    Py_CLEAR(g_lineSamples);
+    g_samplesTotal = 0;
+    g_samplesOther = 0;
+    g_samplesDropped.store(0, memory_order_relaxed);
+}
@@ -0,0 +1,56 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+
+#ifndef PYJION_SAMPLER_H
+#define PYJION_SAMPLER_H
+
+#include <Python.h>
+
+class JittedCode;
+
+/* A sampling profiler for jitted code. A SIGPROF timer records the native PC of the thread
+ * it interrupts into a lock-free ring, nothing else happens in the signal handler. The PCs
+ * are resolved to Python lines later, with the GIL held, against a table of the address
+ * ranges of compiled code and their sequence points. The ring is drained before any code is
+ * freed so a PC is never resolved against code that has replaced it, and from frame evaluation
+ * once it's half full so a long profile doesn't fill it. */
+
+// Called for every successful compile, adds the code to the address table
+void PyJit_SamplerCodeLoaded(PyCodeObject* code, JittedCode* compiled);
+// Called before compiled code is freed
+void PyJit_SamplerCodeUnloaded(JittedCode* compiled);
+
+// Starts sampling hz times a second of CPU time, returns false with a Python error set if it can't
+bool PyJit_StartSampler(int hz);
+void PyJit_StopSampler();
+// Called with the GIL held on each frame evaluation, drains the ring once it's half full
+void PyJit_SamplerSafePoint();
+// {"total": samples, "other": samples outside jitted code, "dropped": samples lost to a full ring,
+//  "lines": {(filename, name, line): samples}}
+PyObject* PyJit_GetSamples();
+void PyJit_ClearSamples();
+
+#endif //PYJION_SAMPLER_H
@@ -0,0 +1,32 @@
+import pyjion
+from collections import namedtuple
+
+LineSamples = namedtuple('LineSamples', ['filename', 'name', 'line', 'samples'])
+
+
+def start(hz: int = 100) -> None:
+    """Start sampling the running native code hz times a second of CPU time."""
+    pyjion.start_sampling(hz)
+
+
+def stop() -> None:
+    """Stop sampling, the samples taken so far are kept."""
+    pyjion.stop_sampling()
+
+
+def clear() -> None:
+    """Forget the samples taken so far."""
+    pyjion.clear_samples()
+
+
+def samples() -> dict:
+    """Samples by (filename, name, line), plus the total, the samples outside jitted code and the dropped samples."""
+    return pyjion.get_samples()
+
+
+def top(n: int = 10) -> list:
+    """The n Python lines with the most samples."""
+    lines = [LineSamples(filename, name, line, count)
+             for (filename, name, line), count in samples()['lines'].items()]
+    lines.sort(key=lambda entry: entry.samples, reverse=True)
+    return lines[:n]
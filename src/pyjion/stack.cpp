@@ -47,7 +47,7 @@ StackEntryKind avkAsStackEntryKind(AbstractValueKind k){
         case AVK_Float:
             return STACK_KIND_VALUE_FLOAT;
         case AVK_Bool:
-            return STACK_KIND_VALUE_INT;
+            return STACK_KIND_VALUE_BOOL;
         default:
             return STACK_KIND_OBJECT;
     }
@@ -61,6 +61,8 @@ StackEntryKind lkAsStackEntryKind(LocalKind k){
             return STACK_KIND_VALUE_INT;
         case LK_Float:
             return STACK_KIND_VALUE_FLOAT;
+        case LK_Bool:
+            return STACK_KIND_VALUE_BOOL;
         default:
             return STACK_KIND_OBJECT;
     }
@@ -74,6 +76,8 @@ LocalKind stackEntryKindAsLocalKind(StackEntryKind k){
             return LK_Int;
         case STACK_KIND_VALUE_FLOAT:
             return LK_Float;
+        case STACK_KIND_VALUE_BOOL:
+            return LK_Bool;
         default:
             return LK_Pointer;
     }
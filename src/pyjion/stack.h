@@ -35,7 +35,8 @@
 enum StackEntryKind {
     STACK_KIND_VALUE_FLOAT = 0, // An unboxed float
     STACK_KIND_VALUE_INT = 1, // An unboxed int
-    STACK_KIND_OBJECT = 2 // A Python object, or a tagged int which might be an object
+    STACK_KIND_OBJECT = 2, // A Python object, or a tagged int which might be an object
+    STACK_KIND_VALUE_BOOL = 3 // An unboxed bool
 };
 
 StackEntryKind avkAsStackEntryKind(AbstractValueKind k);
@@ -44,10 +44,26 @@ bool supportsUnboxing(py_opcode opcode){
         case BINARY_TRUE_DIVIDE:
         case INPLACE_SUBTRACT:
         case BINARY_SUBTRACT:
+        case BINARY_AND:
+        case INPLACE_AND:
+        case BINARY_OR:
+        case INPLACE_OR:
+        case BINARY_XOR:
+        case INPLACE_XOR:
+        case BINARY_LSHIFT:
+        case INPLACE_LSHIFT:
+        case BINARY_RSHIFT:
+        case INPLACE_RSHIFT:
+        case UNARY_NEGATIVE:
+        case UNARY_INVERT:
+        case UNARY_NOT:
         case LOAD_CONST:
         case STORE_FAST:
         case LOAD_FAST:
         case DELETE_FAST:
+        case FOR_ITER:
+        case CALL_FUNCTION:
+        case CALL_METHOD:
             return true;
         default:
             return false;
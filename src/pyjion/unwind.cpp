@@ -0,0 +1,464 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+
+#include <cstring>
+#include <vector>
+#include <string>
+#include <mutex>
+
+#ifdef __linux__
+#include <elf.h>
+#endif
+
+#include "unwind.h"
+#include "pyjit.h"
+
+using namespace std;
+
+#if defined(_TARGET_AMD64_) && !defined(WINDOWS)
+#define PYJION_EH_FRAME
+
+extern "C" void __register_frame(void* begin);
+extern "C" void __deregister_frame(void* begin);
+
+// Windows x64 unwind operations, see UNWIND_CODE in the Windows SDK
+#define UWOP_PUSH_NONVOL 0
+#define UWOP_ALLOC_LARGE 1
+#define UWOP_ALLOC_SMALL 2
+#define UWOP_SET_FPREG 3
+#define UWOP_SAVE_NONVOL 4
+#define UWOP_SAVE_NONVOL_FAR 5
+#define UWOP_EPILOG 6
+#define UWOP_SPARE_CODE 7
+#define UWOP_SAVE_XMM128 8
+#define UWOP_SAVE_XMM128_FAR 9
+#define UWOP_PUSH_MACHFRAME 10
+
+#define DW_CFA_nop 0x00
+#define DW_CFA_advance_loc 0x40
+#define DW_CFA_offset 0x80
+#define DW_CFA_advance_loc1 0x02
+#define DW_CFA_def_cfa 0x0c
+#define DW_CFA_def_cfa_register 0x0d
+#define DW_CFA_def_cfa_offset 0x0e
+#define DW_EH_PE_absptr 0x00
+
+#define DWARF_RSP 7
+#define DWARF_RIP 16
+
+// Windows register numbers (rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi, r8-r15) to DWARF ones
+static const uint8_t g_dwarfRegisters[16] = {0, 2, 1, 3, 7, 6, 4, 5, 8, 9, 10, 11, 12, 13, 14, 15};
+
+struct UnwindRegistration {
+    vector<uint8_t> ehFrame;
+    size_t fdeOffset;
+};
+
+struct UnwindOperation {
+    uint8_t codeOffset;
+    uint8_t op;
+    uint8_t info;
+    uint32_t operand;
+};
+
+static void writeULEB(vector<uint8_t>& out, uint64_t value) {
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        if (value != 0)
+            byte |= 0x80;
+        out.push_back(byte);
+    } while (value != 0);
+}
+
+static void writeSLEB(vector<uint8_t>& out, int64_t value) {
+    bool more = true;
+    while (more) {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        if ((value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40)))
+            more = false;
+        else
+            byte |= 0x80;
+        out.push_back(byte);
+    }
+}
+
+template<typename T> static void write(vector<uint8_t>& out, T value) {
+    auto bytes = (uint8_t*)&value;
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+// Pads a CIE or FDE to a multiple of the pointer size and fills in its length
+static void finishEntry(vector<uint8_t>& out, size_t start) {
+    while ((out.size() - start) % sizeof(void*) != 0)
+        out.push_back(DW_CFA_nop);
+    uint32_t length = out.size() - start - sizeof(uint32_t);
+    memcpy(out.data() + start, &length, sizeof(length));
+}
+
+// Reads the unwind codes, they are stored in reverse order of the prolog
+static bool readUnwindInfo(const uint8_t* unwindInfo, size_t unwindSize, uint8_t& frameRegister, uint8_t& frameOffset, vector<UnwindOperation>& ops) {
+    if (unwindSize < 4 || (unwindInfo[0] & 0x7) > 2)
+        return false;
+    size_t count = unwindInfo[2];
+    frameRegister = unwindInfo[3] & 0xf;
+    frameOffset = unwindInfo[3] >> 4;
+    if (4 + count * 2 > unwindSize)
+        return false;
+    auto slots = (const uint16_t*)(unwindInfo + 4);
+    for (size_t i = 0; i < count;) {
+        UnwindOperation op = {(uint8_t)(slots[i] & 0xff), (uint8_t)((slots[i] >> 8) & 0xf), (uint8_t)(slots[i] >> 12), 0};
+        size_t used = 1;
+        switch (op.op) {
+            case UWOP_ALLOC_LARGE:
+                if (op.info == 0) {
+                    used = 2;
+                    if (i + 1 < count) op.operand = slots[i + 1] * 8;
+                } else {
+                    used = 3;
+                    if (i + 2 < count) op.operand = slots[i + 1] | ((uint32_t)slots[i + 2] << 16);
+                }
+                break;
+            case UWOP_SAVE_NONVOL:
+            case UWOP_SAVE_XMM128:
+            case UWOP_EPILOG:
+                used = 2;
+                if (i + 1 < count) op.operand = slots[i + 1] * (op.op == UWOP_SAVE_XMM128 ? 16 : 8);
+                break;
+            case UWOP_SAVE_NONVOL_FAR:
+            case UWOP_SAVE_XMM128_FAR:
+                used = 3;
+                if (i + 2 < count) op.operand = slots[i + 1] | ((uint32_t)slots[i + 2] << 16);
+                break;
+            default:
+                break;
+        }
+        if (i + used > count)
+            return false;
+        ops.push_back(op);
+        i += used;
+    }
+    return true;
+}
+
+// Builds a CIE, an FDE for the function and the terminator. The CFA rules follow the prolog,
+// epilogs aren't described so a stack walked from inside one is off by the registers already popped.
+static bool buildEhFrame(UnwindRegistration& reg, uint8_t* code, size_t size, const uint8_t* unwindInfo, size_t unwindSize) {
+    uint8_t frameRegister, frameOffset;
+    vector<UnwindOperation> ops;
+    if (!readUnwindInfo(unwindInfo, unwindSize, frameRegister, frameOffset, ops))
+        return false;
+    auto& out = reg.ehFrame;
+
+    write<uint32_t>(out, 0); // length
+    write<uint32_t>(out, 0); // CIE id
+    out.push_back(1);        // version
+    out.push_back('z');
+    out.push_back('R');
+    out.push_back(0);
+    writeULEB(out, 1);  // code alignment
+    writeSLEB(out, -8); // data alignment
+    writeULEB(out, DWARF_RIP);
+    writeULEB(out, 1);  // augmentation data length
+    out.push_back(DW_EH_PE_absptr);
+    // On entry the CFA is rsp + 8 and the return address is just below it
+    out.push_back(DW_CFA_def_cfa);
+    writeULEB(out, DWARF_RSP);
+    writeULEB(out, 8);
+    out.push_back(DW_CFA_offset | DWARF_RIP);
+    writeULEB(out, 1);
+    finishEntry(out, 0);
+
+    reg.fdeOffset = out.size();
+    write<uint32_t>(out, 0);
+    write<uint32_t>(out, out.size()); // offset back to the CIE
+    write<uint64_t>(out, (uint64_t)code);
+    write<uint64_t>(out, size);
+    writeULEB(out, 0);
+
+    uint32_t location = 0;
+    uint32_t spOffset = 8; // CFA - rsp
+    bool framed = false;
+    for (auto op = ops.rbegin(); op != ops.rend(); ++op) {
+        if (op->codeOffset > location) {
+            uint32_t delta = op->codeOffset - location;
+            if (delta < 0x40) {
+                out.push_back(DW_CFA_advance_loc | delta);
+            } else {
+                out.push_back(DW_CFA_advance_loc1);
+                out.push_back(delta);
+            }
+            location = op->codeOffset;
+        }
+        switch (op->op) {
+            case UWOP_PUSH_NONVOL:
+                spOffset += 8;
+                if (!framed) {
+                    out.push_back(DW_CFA_def_cfa_offset);
+                    writeULEB(out, spOffset);
+                }
+                out.push_back(DW_CFA_offset | g_dwarfRegisters[op->info]);
+                writeULEB(out, spOffset / 8);
+                break;
+            case UWOP_ALLOC_SMALL:
+            case UWOP_ALLOC_LARGE:
+                spOffset += op->op == UWOP_ALLOC_SMALL ? op->info * 8 + 8 : op->operand;
+                if (!framed) {
+                    out.push_back(DW_CFA_def_cfa_offset);
+                    writeULEB(out, spOffset);
+                }
+                break;
+            case UWOP_SET_FPREG:
+                framed = true;
+                out.push_back(DW_CFA_def_cfa);
+                writeULEB(out, g_dwarfRegisters[frameRegister]);
+                writeULEB(out, spOffset - frameOffset * 16);
+                break;
+            case UWOP_SAVE_NONVOL:
+            case UWOP_SAVE_NONVOL_FAR:
+                if (op->operand < spOffset) {
+                    out.push_back(DW_CFA_offset | g_dwarfRegisters[op->info]);
+                    writeULEB(out, (spOffset - op->operand) / 8);
+                }
+                break;
+            default:
+                // XMM registers aren't callee saved in the System V ABI, epilog markers have no CFA effect
+                break;
+        }
+    }
+    finishEntry(out, reg.fdeOffset);
+    write<uint32_t>(out, 0); // terminator
+    return true;
+}
+#endif
+
+void* PyJit_RegisterUnwindInfo(uint8_t* code, size_t size, const uint8_t* unwindInfo, size_t unwindSize) {
+#ifdef PYJION_EH_FRAME
+    auto reg = new UnwindRegistration();
+    if (!buildEhFrame(*reg, code, size, unwindInfo, unwindSize)) {
+        delete reg;
+        return nullptr;
+    }
+#ifdef __APPLE__
+    // libunwind takes a single FDE, libgcc takes the whole section
+    __register_frame(reg->ehFrame.data() + reg->fdeOffset);
+#else
+    __register_frame(reg->ehFrame.data());
+#endif
+    return reg;
+#else
+    return nullptr;
+#endif
+}
+
+void PyJit_DeregisterUnwindInfo(void* registration) {
+#ifdef PYJION_EH_FRAME
+    auto reg = (UnwindRegistration*)registration;
+    if (reg == nullptr)
+        return;
+#ifdef __APPLE__
+    __deregister_frame(reg->ehFrame.data() + reg->fdeOffset);
+#else
+    __deregister_frame(reg->ehFrame.data());
+#endif
+    delete reg;
+#endif
+}
+
+#if defined(PYJION_EH_FRAME) && defined(__linux__)
+/* The GDB JIT interface, see "JIT Compilation Interface" in the GDB manual. GDB puts a
+ * breakpoint on __jit_debug_register_code and reads the entry named by the descriptor. */
+extern "C" {
+typedef enum {
+    JIT_NOACTION = 0,
+    JIT_REGISTER_FN,
+    JIT_UNREGISTER_FN
+} jit_actions_t;
+
+struct jit_code_entry {
+    struct jit_code_entry* next_entry;
+    struct jit_code_entry* prev_entry;
+    const char* symfile_addr;
+    uint64_t symfile_size;
+};
+
+struct jit_descriptor {
+    uint32_t version;
+    uint32_t action_flag;
+    struct jit_code_entry* relevant_entry;
+    struct jit_code_entry* first_entry;
+};
+
+__attribute__((noinline, used, visibility("default"))) void __jit_debug_register_code() {
+    __asm__ volatile("" ::: "memory");
+}
+
+__attribute__((used, visibility("default"))) struct jit_descriptor __jit_debug_descriptor = {1, JIT_NOACTION, nullptr, nullptr};
+}
+
+struct DebuggerEntry {
+    jit_code_entry entry;
+    vector<uint8_t> symFile;
+};
+
+// Code is registered by the compiling thread without the GIL, and deregistered under it
+static mutex g_debuggerLock;
+
+enum SymFileSection {
+    SectionNull,
+    SectionText,
+    SectionEhFrame,
+    SectionSymtab,
+    SectionStrtab,
+    SectionShstrtab,
+    SectionCount
+};
+
+/* A relocatable ELF object with a .text section at the address of the code (NOBITS, the
+ * code isn't copied), the .eh_frame entries of every fragment and a symbol for the function. */
+static void buildSymFile(vector<uint8_t>& out, const char* name, void* code, size_t size, void* const* unwind, size_t unwindCount) {
+    const char shstrtab[] = "\0.text\0.eh_frame\0.symtab\0.strtab\0.shstrtab";
+    const Elf64_Word shstrtabNames[SectionCount] = {0, 1, 7, 17, 25, 33};
+    string strtab = string(1, '\0') + name;
+    // Each registration is a CIE, an FDE and a terminator. The CIE pointers are relative so the
+    // entries can be copied one after the other, with a single terminator at the end.
+    vector<uint8_t> ehFrame;
+    for (size_t i = 0; i < unwindCount; i++) {
+        auto reg = (UnwindRegistration*)unwind[i];
+        if (reg != nullptr)
+            ehFrame.insert(ehFrame.end(), reg->ehFrame.begin(), reg->ehFrame.end() - sizeof(uint32_t));
+    }
+    if (!ehFrame.empty())
+        write<uint32_t>(ehFrame, 0);
+    size_t ehFrameSize = ehFrame.size();
+
+    Elf64_Shdr sections[SectionCount];
+    memset(sections, 0, sizeof(sections));
+    size_t offset = sizeof(Elf64_Ehdr);
+    auto place = [&](SymFileSection index, Elf64_Word type, size_t dataSize, size_t align) {
+        offset = (offset + align - 1) & ~(align - 1);
+        sections[index].sh_name = shstrtabNames[index];
+        sections[index].sh_type = type;
+        sections[index].sh_offset = offset;
+        sections[index].sh_size = dataSize;
+        sections[index].sh_addralign = align;
+        offset += dataSize;
+    };
+    place(SectionEhFrame, SHT_PROGBITS, ehFrameSize, 8);
+    place(SectionSymtab, SHT_SYMTAB, sizeof(Elf64_Sym) * 2, 8);
+    place(SectionStrtab, SHT_STRTAB, strtab.size() + 1, 1);
+    place(SectionShstrtab, SHT_STRTAB, sizeof(shstrtab), 1);
+    size_t sectionHeaders = (offset + 7) & ~(size_t)7;
+
+    sections[SectionText].sh_name = shstrtabNames[SectionText];
+    sections[SectionText].sh_type = SHT_NOBITS;
+    sections[SectionText].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+    sections[SectionText].sh_addr = (Elf64_Addr)code;
+    sections[SectionText].sh_size = size;
+    sections[SectionText].sh_addralign = 16;
+    sections[SectionEhFrame].sh_flags = SHF_ALLOC;
+    sections[SectionSymtab].sh_link = SectionStrtab;
+    sections[SectionSymtab].sh_info = 1; // first global symbol
+    sections[SectionSymtab].sh_entsize = sizeof(Elf64_Sym);
+
+    out.assign(sectionHeaders + sizeof(sections), 0);
+    auto header = (Elf64_Ehdr*)out.data();
+    memcpy(header->e_ident, ELFMAG, SELFMAG);
+    header->e_ident[EI_CLASS] = ELFCLASS64;
+    header->e_ident[EI_DATA] = ELFDATA2LSB;
+    header->e_ident[EI_VERSION] = EV_CURRENT;
+    header->e_ident[EI_OSABI] = ELFOSABI_NONE;
+    header->e_type = ET_REL;
+    header->e_machine = EM_X86_64;
+    header->e_version = EV_CURRENT;
+    header->e_shoff = sectionHeaders;
+    header->e_ehsize = sizeof(Elf64_Ehdr);
+    header->e_shentsize = sizeof(Elf64_Shdr);
+    header->e_shnum = SectionCount;
+    header->e_shstrndx = SectionShstrtab;
+
+    // The FDE uses absolute addresses, so the .eh_frame can be read from wherever it sits
+    sections[SectionEhFrame].sh_addr = (Elf64_Addr)(out.data() + sections[SectionEhFrame].sh_offset);
+    if (ehFrameSize > 0)
+        memcpy(out.data() + sections[SectionEhFrame].sh_offset, ehFrame.data(), ehFrameSize);
+
+    Elf64_Sym symbols[2];
+    memset(symbols, 0, sizeof(symbols));
+    symbols[1].st_name = 1;
+    symbols[1].st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+    symbols[1].st_shndx = SectionText;
+    symbols[1].st_value = 0; // relative to .text
+    symbols[1].st_size = size;
+    memcpy(out.data() + sections[SectionSymtab].sh_offset, symbols, sizeof(symbols));
+    memcpy(out.data() + sections[SectionStrtab].sh_offset, strtab.c_str(), strtab.size() + 1);
+    memcpy(out.data() + sections[SectionShstrtab].sh_offset, shstrtab, sizeof(shstrtab));
+    memcpy(out.data() + sectionHeaders, sections, sizeof(sections));
+}
+#endif
+
+void* PyJit_RegisterDebuggerCode(const char* name, void* code, size_t size, void* const* unwind, size_t unwindCount) {
+#if defined(PYJION_EH_FRAME) && defined(__linux__)
+    if (code == nullptr)
+        return nullptr;
+    auto entry = new DebuggerEntry();
+    buildSymFile(entry->symFile, name, code, size, unwind, unwindCount);
+    entry->entry.symfile_addr = (const char*)entry->symFile.data();
+    entry->entry.symfile_size = entry->symFile.size();
+    entry->entry.prev_entry = nullptr;
+    lock_guard<mutex> lock(g_debuggerLock);
+    entry->entry.next_entry = __jit_debug_descriptor.first_entry;
+    if (entry->entry.next_entry != nullptr)
+        entry->entry.next_entry->prev_entry = &entry->entry;
+    __jit_debug_descriptor.first_entry = &entry->entry;
+    __jit_debug_descriptor.relevant_entry = &entry->entry;
+    __jit_debug_descriptor.action_flag = JIT_REGISTER_FN;
+    __jit_debug_register_code();
+    return entry;
+#else
+    return nullptr;
+#endif
+}
+
+void PyJit_DeregisterDebuggerCode(void* entry) {
+#if defined(PYJION_EH_FRAME) && defined(__linux__)
+    auto debuggerEntry = (DebuggerEntry*)entry;
+    if (debuggerEntry == nullptr)
+        return;
+    auto codeEntry = &debuggerEntry->entry;
+    lock_guard<mutex> lock(g_debuggerLock);
+    if (codeEntry->prev_entry != nullptr)
+        codeEntry->prev_entry->next_entry = codeEntry->next_entry;
+    else
+        __jit_debug_descriptor.first_entry = codeEntry->next_entry;
+    if (codeEntry->next_entry != nullptr)
+        codeEntry->next_entry->prev_entry = codeEntry->prev_entry;
+    __jit_debug_descriptor.relevant_entry = codeEntry;
+    __jit_debug_descriptor.action_flag = JIT_UNREGISTER_FN;
+    __jit_debug_register_code();
+    delete debuggerEntry;
+#endif
+}
@@ -0,0 +1,50 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+
+#ifndef PYJION_UNWIND_H
+#define PYJION_UNWIND_H
+
+#include <cstdint>
+#include <cstddef>
+
+/* Makes jitted frames visible to native stack walkers. The unwind info the CLR JIT produces
+ * for each function (Windows x64 UNWIND_INFO, the format CoreCLR uses on every platform) is
+ * translated into an .eh_frame CIE/FDE pair and registered with __register_frame so libgcc,
+ * libunwind, perf --call-graph=dwarf and C++ exceptions can unwind through jitted code.
+ * With PyJit_Settings().gdbJit set, each function is also described to GDB through the
+ * JIT interface (__jit_debug_register_code) as an in-memory ELF object.
+ * Only x64 Linux and macOS are supported, elsewhere these do nothing and return nullptr. */
+
+// Registers the unwind info for [code, code + size), returns a handle for PyJit_DeregisterUnwindInfo
+void* PyJit_RegisterUnwindInfo(uint8_t* code, size_t size, const uint8_t* unwindInfo, size_t unwindSize);
+void PyJit_DeregisterUnwindInfo(void* registration);
+
+// Describes a function to an attached debugger, unwind are the registrations of each of its
+// fragments (the main body, funclets and cold code) within [code, code + size)
+void* PyJit_RegisterDebuggerCode(const char* name, void* code, size_t size, void* const* unwind, size_t unwindCount);
+void PyJit_DeregisterDebuggerCode(void* entry);
+
+#endif //PYJION_UNWIND_H